@@ -0,0 +1,85 @@
+#ifndef CLI_HPP
+#define CLI_HPP
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief splits the command line into positional arguments and options.
+ *
+ * Options have the form "--name" or "--name=value" and can appear anywhere
+ * on the command line. Everything else is a positional argument; argv[0] is
+ * kept as positional argument 0, so positional indices match the ones of
+ * a command line without options.
+ */
+class cli_options {
+private:
+    std::vector<std::string> positional;
+    std::map<std::string, std::string> options;
+
+public:
+    // constructor
+    cli_options(int argc, char **argv) {
+        for (int i = 0; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (i > 0 && arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+                size_t eq = arg.find('=');
+                if (eq == std::string::npos)
+                    options[arg.substr(2)] = "";
+                else
+                    options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+            else
+                positional.push_back(arg);
+        }
+    }
+
+    // number of positional arguments (program name included)
+    size_t n_positional() const { return positional.size(); }
+
+    // i-th positional argument
+    const std::string &operator[](size_t i) const { return positional[i]; }
+
+    /**
+     * @brief reads a positional argument as a strictly positive integer
+     *
+     * @param i index of the positional argument
+     * @param def value returned if the argument is missing or not positive
+     * @return the value of the argument, or 'def'
+     */
+    int positive_int(size_t i, int def) const {
+        if (i < positional.size() && std::atoi(positional[i].c_str()) > 0)
+            return std::atoi(positional[i].c_str());
+        return def;
+    }
+
+    // true if the option "--name" was given
+    bool has(const std::string &name) const {
+        return options.find(name) != options.end();
+    }
+
+    // value of the option "--name=value" ('def' if missing)
+    std::string get(const std::string &name, const std::string &def = "") const {
+        auto it = options.find(name);
+        return it == options.end() ? def : it->second;
+    }
+
+    // value of the option "--name=value" as an integer ('def' if missing)
+    int get_int(const std::string &name, int def) const {
+        auto it = options.find(name);
+        return it == options.end() || it->second.empty() ?
+            def : std::atoi(it->second.c_str());
+    }
+
+    // value of the option "--name=value" as a floating point ('def' if missing)
+    double get_double(const std::string &name, double def) const {
+        auto it = options.find(name);
+        return it == options.end() || it->second.empty() ?
+            def : std::atof(it->second.c_str());
+    }
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/shared_queue.hpp"
+#include "auxiliary/placement.hpp"
+
+
+/**
+ * @brief fixed set of reusable frames, all of the same size and type.
+ *
+ * The buffers are carved out of a page-aligned anonymous mapping
+ * (optionally backed by transparent huge pages) that is touched once at
+ * construction, so no allocation or page fault happens while frames are
+ * recycled. Free frames are kept in a shared_queue: acquire waits until a
+ * frame is released, which bounds the number of frames in flight.
+ *
+ * With --pin and workers on several NUMA nodes, the pool is split in parts,
+ * one per node of the workers (see placement::worker_nodes), each with its
+ * own mapping bound to the node and its own free frames: a batch takes all
+ * its frames from one part (part_of_worker) and goes in the queue of the
+ * node of the part.
+ *
+ * The frames of mapped videos are views of the file: a pool of views has no
+ * buffers, only the headers the reader points to the file.
+ */
+class frame_pool {
+private:
+    struct part {
+        size_t first;           // first frame of the part
+        size_t region_bytes;
+        uchar *region;
+        std::unique_ptr<shared_queue<cv::Mat>> free_frames;
+    };
+
+    int rows, cols, type;
+    bool views;
+    size_t frame_stride;    // bytes between 2 buffers (multiple of the page size)
+    std::vector<cv::Mat> frames;
+    std::vector<part> parts;
+
+    // part of the i-th frame
+    part &part_of(size_t i) {
+        size_t p = parts.size() - 1;
+        while (parts[p].first > i)
+            p--;
+        return parts[p];
+    }
+
+    uchar *buffer(size_t i) {
+        part &p = part_of(i);
+        return p.region + (i - p.first) * frame_stride;
+    }
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param rows rows of the frames
+     * @param cols columns of the frames
+     * @param type OpenCV type of the frames (e.g. CV_8UC3)
+     * @param part_frames number of frames of each part, for each node of
+     * placement::worker_nodes() (a single part, with all the frames, if the
+     * workers aren't placed, run on one node or the frames are views)
+     * @param huge_pages whether to ask for transparent huge pages
+     * @param views whether the frames are views of other memory (e.g. of a
+     * mapped video), so no buffer is allocated
+     */
+    frame_pool(int rows, int cols, int type, std::vector<size_t> part_frames,
+               bool huge_pages = false, bool views = false) :
+            rows(rows), cols(cols), type(type), views(views), frame_stride(0) {
+        std::vector<int> nodes = placement::worker_nodes();
+        if (views || nodes.size() != part_frames.size() || part_frames.size() == 1) {
+            size_t n_frames = 0;
+            for (size_t n : part_frames)
+                n_frames += n;
+            part_frames = {n_frames};
+            nodes = {nodes.size() == 1 ? nodes[0] : -1};
+        }
+        size_t n_frames = 0;
+        for (size_t n : part_frames)
+            n_frames += n;
+        frames.resize(n_frames);
+
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t frame_bytes = size_t(rows) * cols * CV_ELEM_SIZE(type);
+        frame_stride = (frame_bytes + page - 1) / page * page;
+        size_t first = 0;
+        for (size_t k = 0; k < part_frames.size(); k++) {
+            parts.push_back({first, 0, nullptr,
+                             std::unique_ptr<shared_queue<cv::Mat>>(
+                                 new shared_queue<cv::Mat>(part_frames[k]))});
+            part &p = parts.back();
+            first += part_frames[k];
+            if (views) {
+                for (size_t i = p.first; i < first; i++)
+                    p.free_frames->push(&frames[i]);
+                continue;
+            }
+            if (part_frames[k] == 0)
+                continue;
+
+            p.region_bytes = frame_stride * part_frames[k];
+            void *mem = mmap(nullptr, p.region_bytes, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+                throw std::bad_alloc();
+            p.region = static_cast<uchar *>(mem);
+            #ifdef MADV_HUGEPAGE
+            if (huge_pages)
+                madvise(p.region, p.region_bytes, MADV_HUGEPAGE);
+            #endif
+            placement::bind_memory(p.region, p.region_bytes, nodes[k]);  // with --pin
+            std::memset(p.region, 0, p.region_bytes);   // fault the pages in now
+
+            for (size_t i = p.first; i < first; i++) {
+                frames[i] = cv::Mat(rows, cols, type, buffer(i));
+                p.free_frames->push(&frames[i]);
+            }
+        }
+    }
+
+    // a pool of a single part (see above)
+    frame_pool(int rows, int cols, int type, size_t n_frames, bool huge_pages = false,
+               bool views = false) :
+            frame_pool(rows, cols, type, std::vector<size_t>{n_frames}, huge_pages, views) {}
+
+    // destructor
+    ~frame_pool() {
+        for (part &p : parts)
+            if (p.region != nullptr)
+                munmap(p.region, p.region_bytes);
+    }
+
+    frame_pool(const frame_pool &) = delete;
+    frame_pool &operator=(const frame_pool &) = delete;
+
+    // number of frames in the pool
+    size_t size() const { return frames.size(); }
+
+    // number of free frames (the others are in flight)
+    size_t available() {
+        size_t n = 0;
+        for (part &p : parts)
+            n += p.free_frames->size();
+        return n;
+    }
+
+    // number of parts of the pool (one per node of the workers, or 1)
+    size_t n_parts() const { return parts.size(); }
+
+    // part whose frames are near the i-th worker
+    size_t part_of_worker(int i) const {
+        return parts.size() > 1 ? placement::worker_part(i) : 0;
+    }
+
+    // position of a frame of the pool (0 .. size()-1), to attach data to it
+    size_t slot(const cv::Mat *frame) const { return frame - frames.data(); }
+
+    // takes a free frame of a part, waiting until one is released if there are none
+    cv::Mat * acquire(size_t part = 0) { return parts[part].free_frames->pop(); }
+
+    /**
+     * @brief gives a frame back to the pool (to its part)
+     *
+     * If the frame header doesn't point to its buffer anymore (e.g. the
+     * VideoCapture released it at the end of the video), it is restored.
+     * Views are left as they are, the reader points them again.
+     *
+     * @param frame a frame returned by acquire
+     */
+    void release(cv::Mat *frame) {
+        size_t i = frame - frames.data();
+        if (!views && (frame->data != buffer(i) || frame->rows != rows || frame->cols != cols))
+            *frame = cv::Mat(rows, cols, type, buffer(i));
+        part_of(i).free_frames->push(frame);
+    }
+};
+
+#endif
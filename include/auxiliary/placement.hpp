@@ -0,0 +1,319 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+
+// threads that can be placed
+enum class thread_role : uint8_t {
+    decoder,    // reads the video (the emitter of the FastFlow farm)
+    worker,     // runs the kernels on whole frames
+    collector,  // puts the results in frame order (FastFlow farm)
+    pool,       // helper of the intra-frame pool (tile_pool)
+    count
+};
+
+inline const char *thread_role_name(thread_role role) {
+    static const char *names[] = {"decoder", "workers", "collector", "intra-frame pool"};
+    return names[static_cast<int>(role)];
+}
+
+
+/**
+ * @brief placement of the threads on the cores and of the frame buffers on
+ * the NUMA nodes, with --pin[=compact|scatter|<cores>].
+ *
+ * The cores allowed to the process are listed in the order given (e.g.
+ * "0-7,16-23"), or ordered by NUMA node ("compact", the default: a node
+ * is filled before the next one is used) or alternating the nodes
+ * ("scatter"). They are then handed out in this order: decoders first,
+ * then the workers, the collector and the threads of the intra-frame
+ * pool, wrapping around when the threads are more than the cores. Every
+ * thread pins itself (pin_self) or is pinned by its creator (pin) when it
+ * starts.
+ *
+ * When the workers run on several nodes, the drivers give each node a part
+ * of the frame pool, bound to the node, and a queue: the batches of frames
+ * of a part are pushed in the queue of its node, so the frames are read by
+ * the workers of the node where their buffers are (see frame_pool).
+ *
+ * The topology comes from /sys (no libnuma needed); without it, all the
+ * cores are on node 0.
+ */
+class placement {
+private:
+    struct settings {
+        bool on = false;
+        std::string mode;
+        std::vector<int> cores;     // in the order they are handed out
+        int first[static_cast<int>(thread_role::count) + 1] = {};   // first core of a role
+        std::mutex m;               // cores actually used
+        std::map<int, std::set<int>> used[static_cast<int>(thread_role::count)];
+        std::set<int> memory;       // nodes the frame buffers went to
+    };
+
+    static settings &config() {
+        static settings s;
+        return s;
+    }
+
+    // parses a list of cores like "0-3,8,10-11" (empty if malformed)
+    static std::vector<int> parse_list(const std::string &text) {
+        std::vector<int> list;
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            int first, last;
+            char dash;
+            std::stringstream is(item);
+            if (!(is >> first))
+                return {};
+            last = first;
+            if (is >> dash && (dash != '-' || !(is >> last) || last < first))
+                return {};
+            for (int c = first; c <= last; c++)
+                list.push_back(c);
+        }
+        return list;
+    }
+
+    // cores the process may run on
+    static std::vector<int> allowed_cores() {
+        std::vector<int> cores;
+        #ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int c = 0; c < CPU_SETSIZE; c++)
+                if (CPU_ISSET(c, &set))
+                    cores.push_back(c);
+        #endif
+        if (cores.empty())
+            for (unsigned c = 0; c < std::max(std::thread::hardware_concurrency(), 1u); c++)
+                cores.push_back(c);
+        return cores;
+    }
+
+    static int core_of(thread_role role, int i) {
+        settings &s = config();
+        int r = static_cast<int>(role);
+        int first = s.first[r], n = s.first[r + 1] - first;
+        if (role == thread_role::pool)   // the pool takes all the cores left
+            n = std::max<int>(s.cores.size() - first, 1);
+        if (n <= 0)                         // no core planned for the role
+            return s.cores[(first + i) % s.cores.size()];
+        return s.cores[(first + i % n) % s.cores.size()];
+    }
+
+    static void record(thread_role role, int core) {
+        settings &s = config();
+        std::lock_guard<std::mutex> lk(s.m);
+        s.used[static_cast<int>(role)][node_of(core)].insert(core);
+    }
+
+    // "0-3,8" for {0, 1, 2, 3, 8}
+    static std::string format_list(const std::set<int> &list) {
+        std::string text;
+        for (auto it = list.begin(); it != list.end();) {
+            int first = *it, last = first;
+            for (++it; it != list.end() && *it == last + 1; ++it)
+                last++;
+            text += (text.empty() ? "" : ",") + std::to_string(first);
+            if (last > first)
+                text += "-" + std::to_string(last);
+        }
+        return text;
+    }
+
+public:
+    // NUMA node of a core (0 if unknown)
+    static int node_of(int core) {
+        static std::map<int, int> nodes = []() {
+            std::map<int, int> m;
+            std::ifstream possible("/sys/devices/system/node/possible");
+            std::string list;
+            std::getline(possible, list);
+            for (int node : parse_list(list)) {
+                std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) +
+                                "/cpulist");
+                if (f && std::getline(f, list))
+                    for (int c : parse_list(list))
+                        m[c] = node;
+            }
+            return m;
+        }();
+        auto it = nodes.find(core);
+        return it == nodes.end() ? 0 : it->second;
+    }
+
+    // nodes the workers run on, in increasing order (empty if off)
+    static std::vector<int> worker_nodes() {
+        settings &s = config();
+        std::set<int> nodes;
+        if (s.on)
+            for (int i = 0; i < s.first[2] - s.first[1]; i++)
+                nodes.insert(node_of(core_of(thread_role::worker, i)));
+        return std::vector<int>(nodes.begin(), nodes.end());
+    }
+
+    // number of workers on each node of worker_nodes()
+    static std::vector<int> workers_per_node() {
+        settings &s = config();
+        std::vector<int> nodes = worker_nodes(), counts(nodes.size(), 0);
+        for (int i = 0; i < s.first[2] - s.first[1] && !nodes.empty(); i++)
+            counts[worker_part(i)]++;
+        return counts;
+    }
+
+    // position in worker_nodes() of the node of the i-th worker (0 if off)
+    static size_t worker_part(int i) {
+        std::vector<int> nodes = worker_nodes();
+        if (nodes.empty())
+            return 0;
+        return std::lower_bound(nodes.begin(), nodes.end(),
+                                node_of(core_of(thread_role::worker, i))) - nodes.begin();
+    }
+
+    /**
+     * @brief plans the placement (to be called before the threads are
+     * started; the threads of the intra-frame pool, if already started, are
+     * placed by tile_pool::place)
+     *
+     * @param spec "compact" (also if empty), "scatter" or a list of cores
+     * @param n_decoders threads reading the video
+     * @param n_workers threads running the kernels
+     * @param n_collectors threads collecting the results
+     * @return false if spec is malformed or has no allowed core (the
+     * placement stays off)
+     */
+    static bool configure(const std::string &spec, int n_decoders, int n_workers,
+                          int n_collectors) {
+        settings &s = config();
+        std::vector<int> allowed = allowed_cores();
+        std::vector<int> cores;
+        if (spec.empty() || spec == "compact" || spec == "scatter") {
+            std::map<int, std::vector<int>> by_node;
+            for (int c : allowed)
+                by_node[node_of(c)].push_back(c);
+            if (spec == "scatter") {
+                for (size_t k = 0; cores.size() < allowed.size(); k++)
+                    for (auto &node : by_node)
+                        if (k < node.second.size())
+                            cores.push_back(node.second[k]);
+            } else
+                for (auto &node : by_node)
+                    cores.insert(cores.end(), node.second.begin(), node.second.end());
+        } else
+            for (int c : parse_list(spec))
+                if (std::find(allowed.begin(), allowed.end(), c) != allowed.end())
+                    cores.push_back(c);
+        if (cores.empty()) {
+            std::cerr << "No usable core in --pin=" << spec << ", ignored" << std::endl;
+            return false;
+        }
+
+        s.mode = spec.empty() ? "compact" : spec;
+        s.cores = cores;
+        int counts[] = {std::max(n_decoders, 0), std::max(n_workers, 0),
+                        std::max(n_collectors, 0), 0};
+        for (int r = 0; r < static_cast<int>(thread_role::count); r++)
+            s.first[r + 1] = s.first[r] + counts[r];
+        s.on = true;
+        return true;
+    }
+
+    // whether the threads are placed
+    static bool enabled() { return config().on; }
+
+    // pins the calling thread, the i-th with the role (nothing if off)
+    static void pin_self(thread_role role, int i) {
+        if (!enabled())
+            return;
+        int core = core_of(role, i);
+        #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            return;
+        #endif
+        record(role, core);
+    }
+
+    // pins a thread, the i-th with the role (nothing if off)
+    static void pin(std::thread &t, thread_role role, int i) {
+        if (!enabled())
+            return;
+        int core = core_of(role, i);
+        #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        if (pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) != 0)
+            return;
+        #endif
+        record(role, core);
+    }
+
+    /**
+     * @brief binds memory to a NUMA node (to be called before the memory is
+     * touched; nothing if off)
+     *
+     * @param node the node (e.g. one of worker_nodes())
+     */
+    static void bind_memory(void *p, size_t bytes, int node) {
+        settings &s = config();
+        if (!s.on || bytes == 0 || node < 0)
+            return;
+
+        #if defined(__linux__) && defined(SYS_mbind)
+        const int MPOL_BIND_ = 2;   // from numaif.h
+        std::vector<unsigned long> mask(node / (8 * sizeof(long)) + 1, 0);
+        mask[node / (8 * sizeof(long))] |= 1ul << (node % (8 * sizeof(long)));
+        if (syscall(SYS_mbind, p, bytes, MPOL_BIND_, mask.data(),
+                    mask.size() * 8 * sizeof(long) + 1, 0) != 0)
+            return;
+        std::lock_guard<std::mutex> lk(s.m);
+        s.memory.insert(node);
+        #endif
+    }
+
+    // prints where the threads and the frame buffers went (nothing if off)
+    static void report() {
+        settings &s = config();
+        if (!s.on)
+            return;
+        std::lock_guard<std::mutex> lk(s.m);
+        std::cout << "Placement (" << s.mode << "):" << std::endl;
+        for (int r = 0; r < static_cast<int>(thread_role::count); r++) {
+            if (s.used[r].empty())
+                continue;
+            std::cout << "  " << thread_role_name(static_cast<thread_role>(r)) << ":";
+            for (auto &node : s.used[r])
+                std::cout << " cores " << format_list(node.second) << " (node " << node.first
+                          << ")";
+            std::cout << std::endl;
+        }
+        if (!s.memory.empty())
+            std::cout << "  frame buffers: "
+                      << (s.memory.size() == 1 ? "node " : "a part per node, nodes ")
+                      << format_list(s.memory) << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SYNTHETIC_FRAMES_HPP
+#define SYNTHETIC_FRAMES_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+
+/**
+ * @brief generator of synthetic BGR frames, to measure the kernels without
+ * a video.
+ *
+ * The background is a pseudo-random texture (so no kernel can take
+ * shortcuts on uniform areas). Every frame is the background with some
+ * sensor noise (changes of 1 level, below any sensible threshold) and a
+ * rectangle whose pixels are strongly changed, covering the fraction
+ * 'density' of the frame and moving from a frame to the next. The frames
+ * are deterministic: the same parameters always give the same frames.
+ */
+class synthetic_frames {
+private:
+    int rows, cols;
+    int motion_rows, motion_cols;   // size of the rectangle
+    cv::Mat background_rgb;
+
+    // linear congruential generator, good enough for textures
+    static uint32_t next(uint32_t &state) {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param rows rows of the frames
+     * @param cols columns of the frames
+     * @param density fraction of the pixels of every frame changed by the
+     * motion (0 .. 1)
+     * @param seed seed of the texture of the background
+     */
+    synthetic_frames(int rows, int cols, double density, uint32_t seed = 12345) :
+            rows(rows), cols(cols), background_rgb(rows, cols, CV_8UC3) {
+        // rectangle with the aspect ratio of the frame
+        double area = std::min(std::max(density, 0.0), 1.0) * rows * cols;
+        motion_cols = std::min<int>(cols, std::lround(std::sqrt(area * cols / rows)));
+        motion_rows = motion_cols > 0 ?
+            std::min<int>(rows, std::lround(area / motion_cols)) : 0;
+
+        uint32_t state = seed;
+        for (int i = 0; i < rows; i++) {
+            uchar *row = background_rgb.ptr<uchar>(i);
+            for (int j = 0; j < 3 * cols; j++)
+                row[j] = next(state) & 0xff;
+        }
+    }
+
+    // the background (the first frame of the "video")
+    const cv::Mat &background() const { return background_rgb; }
+
+    /**
+     * @brief writes frame i in 'out' (allocated if needed)
+     */
+    void frame(size_t i, cv::Mat &out) const {
+        background_rgb.copyTo(out);
+
+        uint32_t state = 7919u * uint32_t(i) + 1;
+        for (int r = 0; r < rows; r++) {
+            uchar *row = out.ptr<uchar>(r);
+            for (int j = 0; j < 3 * cols; j += 7)
+                row[j] ^= next(state) & 1;
+        }
+
+        if (motion_rows == 0 || motion_cols == 0)
+            return;
+        int top = (i * 2) % (rows - motion_rows + 1);
+        int left = (i * 3) % (cols - motion_cols + 1);
+        // white where the background is dark and vice versa, so the gray
+        // level of every pixel changes by at least 128
+        for (int r = top; r < top + motion_rows; r++) {
+            uchar *row = out.ptr<uchar>(r);
+            for (int j = 3 * left; j < 3 * (left + motion_cols); j += 3) {
+                uchar value = row[j] + row[j + 1] + row[j + 2] < 3 * 128 ? 255 : 0;
+                row[j] = row[j + 1] = row[j + 2] = value;
+            }
+        }
+    }
+};
+
+#endif
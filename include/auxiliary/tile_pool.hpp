@@ -0,0 +1,265 @@
+#ifndef TILE_POOL_HPP
+#define TILE_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "parallel/shared_queue.hpp"
+#include "auxiliary/placement.hpp"
+
+
+/**
+ * @brief persistent pool of threads for the data parallelism inside a
+ * frame (the "nw" workers of rgb2gray, smooth and motion_detect).
+ *
+ * The threads are created once, pinned to cores, and shared by all the
+ * kernels and by all the threads calling them (e.g. the workers of the
+ * farms). A call splits the work in tasks (usually cache-sized tiles of
+ * rows) handed out dynamically to the calling thread and to up to nw - 1
+ * idle pool threads: if no pool thread is idle, the caller does all the
+ * work itself, so the threads running kernels are never more than the
+ * callers plus the pool.
+ *
+ * The size of the pool comes from a global thread budget: 'budget' threads
+ * in total, of which 'n_callers' are the threads calling the kernels (1 for
+ * the sequential program, the workers for the farms). Set it with configure
+ * before the first call.
+ */
+class tile_pool {
+private:
+    static constexpr int SPINS_BEFORE_PARKING = 2048;
+    static constexpr size_t TILE_BYTES = 32 * 1024;     // about the L1 data cache
+
+    struct job {
+        void (*call)(void *, int);
+        void *fn;
+        int n_tasks;
+        std::atomic<int> next;      // next task to be run
+        std::atomic<int> active;    // pool threads still working on the job
+    };
+
+    struct alignas(CACHE_LINE) helper {
+        std::atomic<job *> assigned{nullptr};
+        std::mutex m;
+        std::condition_variable cv;
+        std::thread t;
+    };
+
+    struct settings {
+        int budget = std::max<int>(std::thread::hardware_concurrency(), 1);
+        int n_callers = 1;
+        bool pin = true;
+    };
+
+    std::vector<std::unique_ptr<helper>> helpers;
+    std::mutex idle_lock;
+    std::vector<int> idle;
+    std::atomic<bool> stopping;
+
+    static settings &config() {
+        static settings s;
+        return s;
+    }
+
+    template<typename F>
+    static void invoke(void *fn, int task) { (*static_cast<F *>(fn))(task); }
+
+    static void run(job &j) {
+        for (int t = j.next.fetch_add(1, std::memory_order_relaxed); t < j.n_tasks;
+             t = j.next.fetch_add(1, std::memory_order_relaxed))
+            j.call(j.fn, t);
+    }
+
+    void helper_loop(int id) {
+        helper &h = *helpers[id];
+        while (true) {
+            job *j;
+            for (int spin = 0; (j = h.assigned.load(std::memory_order_acquire)) == nullptr;
+                 spin++) {
+                if (stopping.load(std::memory_order_relaxed))
+                    return;
+                if (spin < SPINS_BEFORE_PARKING) {
+                    cpu_relax();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lk(h.m);
+                h.cv.wait(lk, [&]() {
+                    return h.assigned.load(std::memory_order_acquire) != nullptr ||
+                           stopping.load();
+                });
+            }
+
+            run(*j);
+            h.assigned.store(nullptr, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lk(idle_lock);
+                idle.push_back(id);
+            }
+            j->active.fetch_sub(1, std::memory_order_release);  // last access to j
+        }
+    }
+
+    static void pin_to_core(std::thread &t, int core) {
+        #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+        #endif
+    }
+
+    tile_pool(int n_threads, int first_core, bool pin) : stopping(false) {
+        int n_cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+        for (int i = 0; i < n_threads; i++)
+            helpers.emplace_back(new helper);
+        for (int i = 0; i < n_threads; i++) {
+            helpers[i]->t = std::thread(&tile_pool::helper_loop, this, i);
+            if (placement::enabled())
+                placement::pin(helpers[i]->t, thread_role::pool, i);
+            else if (pin)
+                pin_to_core(helpers[i]->t, (first_core + i) % n_cores);
+            idle.push_back(i);
+        }
+    }
+
+public:
+    /**
+     * @brief sets the thread budget (to be called before the first use of
+     * the pool)
+     *
+     * @param budget max number of threads running kernels at the same time
+     * (default: number of cores)
+     * @param n_callers threads that call the kernels, included in the budget
+     * @param pin whether to pin the pool threads to cores (the cores after
+     * the first 'n_callers'; with --pin, the cores given by placement)
+     */
+    static void configure(int budget, int n_callers, bool pin = true) {
+        settings &s = config();
+        if (budget > 0)
+            s.budget = budget;
+        s.n_callers = std::max(n_callers, 1);
+        s.pin = pin;
+    }
+
+    // max number of threads working on frames (see configure)
+    static int budget() { return config().budget; }
+
+    // the pool shared by all the kernels
+    static tile_pool &get() {
+        static tile_pool pool(std::max(config().budget - config().n_callers, 0),
+                              config().n_callers, config().pin);
+        return pool;
+    }
+
+    // destructor
+    ~tile_pool() {
+        stopping = true;
+        for (auto &h : helpers) {
+            {
+                std::lock_guard<std::mutex> lk(h->m);
+            }
+            h->cv.notify_one();
+        }
+        for (auto &h : helpers)
+            h->t.join();
+    }
+
+    tile_pool(const tile_pool &) = delete;
+    tile_pool &operator=(const tile_pool &) = delete;
+
+    // number of threads of the pool
+    int size() const { return helpers.size(); }
+
+    // pins the threads of the pool where placement says, for a placement
+    // planned after the pool was started (nothing if off)
+    void place() {
+        for (size_t i = 0; i < helpers.size(); i++)
+            placement::pin(helpers[i]->t, thread_role::pool, i);
+    }
+
+    /**
+     * @brief runs fn(t) for every t in [0, n_tasks), on the calling thread
+     * and on up to nw - 1 idle threads of the pool; returns when all the
+     * tasks are done
+     *
+     * @param n_tasks number of tasks
+     * @param nw max number of threads to use (if 1, sequential version)
+     * @param fn callable (int t)
+     */
+    template<typename F>
+    void parallel_for(int n_tasks, int nw, F &&fn) {
+        if (nw <= 1 || n_tasks <= 1 || helpers.empty()) {
+            for (int t = 0; t < n_tasks; t++)
+                fn(t);
+            return;
+        }
+
+        using fn_type = typename std::remove_reference<F>::type;
+        job j;
+        j.call = &invoke<fn_type>;
+        j.fn = (void *)&fn;
+        j.n_tasks = n_tasks;
+        j.next.store(0, std::memory_order_relaxed);
+        j.active.store(0, std::memory_order_relaxed);
+
+        // hand the job to the idle threads
+        int wanted = std::min(nw, n_tasks) - 1;
+        {
+            std::lock_guard<std::mutex> lk(idle_lock);
+            for (; wanted > 0 && !idle.empty(); wanted--) {
+                helper &h = *helpers[idle.back()];
+                idle.pop_back();
+                j.active.fetch_add(1, std::memory_order_relaxed);
+                h.assigned.store(&j, std::memory_order_release);
+                {
+                    std::lock_guard<std::mutex> hl(h.m);
+                }
+                h.cv.notify_one();
+            }
+        }
+
+        run(j);
+        for (int spin = 0; j.active.load(std::memory_order_acquire) > 0; spin++) {
+            if (spin < SPINS_BEFORE_PARKING)
+                cpu_relax();
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief splits 'rows' rows into tiles of about TILE_BYTES and runs
+     * fn(first_row, last_row) on every tile (see parallel_for)
+     *
+     * @param rows number of rows
+     * @param row_bytes bytes touched per row (to size the tiles)
+     * @param nw max number of threads to use (if 1, sequential version)
+     * @param fn callable (int first_row, int last_row), last_row excluded
+     */
+    template<typename F>
+    void for_row_tiles(int rows, size_t row_bytes, int nw, F &&fn) {
+        if (rows <= 0)
+            return;
+        if (nw <= 1 || helpers.empty()) {
+            fn(0, rows);
+            return;
+        }
+        int tile_rows = std::max<int>(1, TILE_BYTES / std::max<size_t>(row_bytes, 1));
+        int n_tiles = (rows + tile_rows - 1) / tile_rows;
+        parallel_for(n_tiles, nw, [&](int t) {
+            fn(t * tile_rows, std::min(rows, (t + 1) * tile_rows));
+        });
+    }
+};
+
+#endif
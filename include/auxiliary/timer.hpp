@@ -13,18 +13,18 @@
 template <typename T>
 class timer {
 private:
-    std::chrono::system_clock::time_point start;
-    std::chrono::system_clock::time_point stop;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point stop;
     const std::string msg;
 
 public:
     // constructor
     timer(const std::string msg) :
-        msg(msg), start(std::chrono::system_clock::now()) {}
+        msg(msg), start(std::chrono::steady_clock::now()) {}
     
     // destructor
     ~timer() {
-        stop = std::chrono::system_clock::now();
+        stop = std::chrono::steady_clock::now();
         std::chrono::duration<double> elapsed = stop - start;
         long casted_elapsed = std::chrono::duration_cast<T>(elapsed).count();
     
@@ -46,4 +46,19 @@ public:
     }
 };
 
+
+/**
+ * @brief runs a function and measures how long it takes
+ *
+ * @param f the function to be timed
+ * @return the elapsed time in microseconds
+ */
+template <typename F>
+long measure_us(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+}
+
 #endif
\ No newline at end of file
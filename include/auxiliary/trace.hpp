@@ -0,0 +1,380 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+
+// what a span of time of a thread was spent on
+enum class trace_stage : uint8_t {
+    decode,         // reading a frame from the video
+    push_wait,      // handing a task to a full queue
+    queue_wait,     // waiting for a task
+    gray,           // rgb2gray
+    smooth,         // smoothing
+    detect,         // motion detection
+    single_pass,    // fused kernel, region of interest or pyramid
+    count
+};
+
+inline const char *trace_stage_name(trace_stage stage) {
+    static const char *names[] = {"decode", "push_wait", "queue_wait", "gray", "smooth",
+                                  "detect", "single_pass"};
+    return names[static_cast<int>(stage)];
+}
+
+
+/**
+ * @brief records where the threads spend their time, to be inspected in a
+ * trace viewer (chrome://tracing, Perfetto) and as latency histograms.
+ *
+ * Every thread records its spans (stage, frame, begin and end) in a ring
+ * buffer of its own, so recording takes no lock and no atomic operation;
+ * when a ring is full the oldest spans are overwritten. Timestamps come
+ * from steady_clock. A sampling thread reads the occupancy of the queues
+ * being watched every SAMPLE_PERIOD_US. Everything is written by
+ * trace_session when the program ends.
+ *
+ * When tracing is off, which is the default, every span costs a load and
+ * a branch.
+ */
+class tracer {
+public:
+    static constexpr size_t RING_SPANS = 1 << 16;   // spans kept per thread
+    static constexpr int SAMPLE_PERIOD_US = 1000;
+
+    struct span {
+        uint64_t begin_ns, end_ns;
+        uint32_t frame;
+        trace_stage stage;
+    };
+
+    struct sample {
+        uint64_t time_ns;
+        uint32_t probe;
+        uint32_t value;
+    };
+
+    // spans of a thread
+    struct ring {
+        std::string thread_name;
+        std::vector<span> spans;
+        size_t n_recorded = 0;
+
+        ring() : spans(RING_SPANS) {}
+    };
+
+private:
+    struct probe {
+        std::string name;
+        std::function<size_t()> read;
+        bool active;
+    };
+
+    struct state {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::mutex m;                               // rings and probes
+        std::vector<std::unique_ptr<ring>> rings;
+        std::vector<probe> probes;
+        std::vector<sample> samples;
+        std::thread sampler;
+        std::condition_variable stop_sampling;
+        bool sampling = false;
+    };
+
+    static inline std::atomic<bool> on{false};
+
+    static state &get_state() {
+        static state s;
+        return s;
+    }
+
+    // ring of the calling thread, created at its first span
+    static ring &own_ring() {
+        thread_local ring *r = nullptr;
+        if (r == nullptr) {
+            state &s = get_state();
+            std::lock_guard<std::mutex> lk(s.m);
+            s.rings.emplace_back(new ring());
+            r = s.rings.back().get();
+        }
+        return *r;
+    }
+
+    static void sample_probes() {
+        state &s = get_state();
+        std::unique_lock<std::mutex> lk(s.m);
+        while (s.sampling) {
+            uint64_t t = now_ns();
+            for (uint32_t p = 0; p < s.probes.size(); p++)
+                if (s.probes[p].active)
+                    s.samples.push_back({t, p, uint32_t(s.probes[p].read())});
+            s.stop_sampling.wait_for(lk, std::chrono::microseconds(SAMPLE_PERIOD_US));
+        }
+    }
+
+public:
+    // whether spans are being recorded
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+    // nanoseconds since the start of the program
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - get_state().start).count();
+    }
+
+    // starts recording spans and sampling the queues
+    static void start() {
+        state &s = get_state();
+        std::lock_guard<std::mutex> lk(s.m);
+        if (s.sampling)
+            return;
+        s.sampling = true;
+        s.sampler = std::thread(sample_probes);
+        on.store(true);
+    }
+
+    // stops recording (to be called once the other threads are done)
+    static void stop() {
+        state &s = get_state();
+        on.store(false);
+        {
+            std::lock_guard<std::mutex> lk(s.m);
+            if (!s.sampling)
+                return;
+            s.sampling = false;
+            s.stop_sampling.notify_all();
+        }
+        s.sampler.join();
+    }
+
+    // records a span of the calling thread
+    static void record(trace_stage stage, uint32_t frame, uint64_t begin_ns, uint64_t end_ns) {
+        ring &r = own_ring();
+        r.spans[r.n_recorded % RING_SPANS] = {begin_ns, end_ns, frame, stage};
+        r.n_recorded++;
+    }
+
+    // frame the calling thread is working on (for the spans of the stages)
+    static uint32_t &current_frame() {
+        thread_local uint32_t frame = 0;
+        return frame;
+    }
+
+    // sets the frame the calling thread is working on
+    static void set_frame(size_t frame) {
+        if (enabled())
+            current_frame() = frame;
+    }
+
+    // names the calling thread in the trace
+    static void name_thread(const std::string &name) {
+        if (enabled())
+            own_ring().thread_name = name;
+    }
+
+    /**
+     * @brief starts sampling a value (e.g. the size of a queue)
+     *
+     * @return id of the probe, for unwatch
+     */
+    static int watch(const std::string &name, std::function<size_t()> read) {
+        state &s = get_state();
+        std::lock_guard<std::mutex> lk(s.m);
+        s.probes.push_back({name, read, true});
+        return s.probes.size() - 1;
+    }
+
+    // stops sampling a value (before what it reads is destroyed)
+    static void unwatch(int id) {
+        state &s = get_state();
+        std::lock_guard<std::mutex> lk(s.m);
+        s.probes[id].active = false;
+    }
+
+    /**
+     * @brief writes the spans and the samples in the Chrome trace format
+     * ('prefix'.json) and the latency histograms of the stages
+     * ('prefix'_hist.txt). To be called after stop.
+     */
+    static void dump(const std::string &prefix) {
+        state &s = get_state();
+        std::lock_guard<std::mutex> lk(s.m);
+
+        std::ofstream trace(prefix + ".json");
+        trace << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [" << std::endl;
+        bool first = true;
+        auto separator = [&]() -> std::ofstream & {
+            if (!first)
+                trace << "," << std::endl;
+            first = false;
+            return trace;
+        };
+        std::vector<std::vector<uint64_t>> durations(static_cast<int>(trace_stage::count));
+        size_t n_dropped = 0;
+        for (size_t t = 0; t < s.rings.size(); t++) {
+            ring &r = *s.rings[t];
+            std::string name = r.thread_name.empty() ? "thread " + std::to_string(t) :
+                                                        r.thread_name;
+            separator() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                        << t << ", \"args\": {\"name\": \"" << name << "\"}}";
+            size_t n = std::min(r.n_recorded, RING_SPANS);
+            n_dropped += r.n_recorded - n;
+            for (size_t i = r.n_recorded - n; i < r.n_recorded; i++) {
+                const span &sp = r.spans[i % RING_SPANS];
+                separator() << "{\"name\": \"" << trace_stage_name(sp.stage)
+                            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t
+                            << ", \"ts\": " << sp.begin_ns / 1000.0
+                            << ", \"dur\": " << (sp.end_ns - sp.begin_ns) / 1000.0
+                            << ", \"args\": {\"frame\": " << sp.frame << "}}";
+                durations[static_cast<int>(sp.stage)].push_back(sp.end_ns - sp.begin_ns);
+            }
+        }
+        for (const sample &sm : s.samples)
+            separator() << "{\"name\": \"" << s.probes[sm.probe].name
+                        << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << sm.time_ns / 1000.0
+                        << ", \"args\": {\"size\": " << sm.value << "}}";
+        trace << std::endl << "]}" << std::endl;
+
+        // histograms with power-of-2 buckets of microseconds
+        std::ofstream hist(prefix + "_hist.txt");
+        for (int st = 0; st < static_cast<int>(trace_stage::count); st++) {
+            std::vector<uint64_t> &d = durations[st];
+            if (d.empty())
+                continue;
+            std::sort(d.begin(), d.end());
+            double total = 0;
+            for (uint64_t ns : d)
+                total += ns;
+            auto at = [&](double q) {
+                return d[std::min(d.size() - 1, size_t(q * d.size()))] / 1000.0;
+            };
+            hist << trace_stage_name(static_cast<trace_stage>(st)) << ": " << d.size()
+                 << " spans, mean " << total / d.size() / 1000.0 << " us, p50 " << at(0.5)
+                 << " us, p90 " << at(0.9) << " us, p99 " << at(0.99) << " us, max "
+                 << d.back() / 1000.0 << " us" << std::endl;
+            std::vector<size_t> buckets;
+            for (uint64_t ns : d) {
+                size_t b = 0;
+                for (uint64_t us = ns / 1000; us > 0; us >>= 1)
+                    b++;
+                if (buckets.size() <= b)
+                    buckets.resize(b + 1, 0);
+                buckets[b]++;
+            }
+            for (size_t b = 0; b < buckets.size(); b++)
+                if (buckets[b] > 0)
+                    hist << "  < " << (1ul << b) << " us\t" << buckets[b] << std::endl;
+        }
+
+        std::cout << "Trace written to " << prefix << ".json and " << prefix << "_hist.txt";
+        if (n_dropped > 0)
+            std::cout << " (" << n_dropped << " oldest spans dropped)";
+        std::cout << std::endl;
+    }
+};
+
+
+/**
+ * @brief span of the calling thread from its construction to its
+ * destruction (nothing is recorded if tracing is off)
+ */
+class trace_span {
+private:
+    trace_stage stage;
+    bool active;
+    uint32_t frame;
+    uint64_t begin_ns;
+
+public:
+    // constructor, for the frame set with tracer::set_frame
+    explicit trace_span(trace_stage stage) : stage(stage), active(tracer::enabled()) {
+        if (active) {
+            frame = tracer::current_frame();
+            begin_ns = tracer::now_ns();
+        }
+    }
+
+    // constructor, for a given frame
+    trace_span(trace_stage stage, size_t frame) :
+            stage(stage), active(tracer::enabled()), frame(frame) {
+        if (active)
+            begin_ns = tracer::now_ns();
+    }
+
+    // destructor
+    ~trace_span() {
+        if (active)
+            tracer::record(stage, frame, begin_ns, tracer::now_ns());
+    }
+
+    trace_span(const trace_span &) = delete;
+    trace_span &operator=(const trace_span &) = delete;
+};
+
+
+/**
+ * @brief samples a value during the lifetime of the object (to be created
+ * after what it reads and destroyed before it)
+ */
+class trace_watch {
+private:
+    int id = -1;
+
+public:
+    // constructor
+    trace_watch(const std::string &name, std::function<size_t()> read) {
+        if (tracer::enabled())
+            id = tracer::watch(name, read);
+    }
+
+    // destructor
+    ~trace_watch() {
+        if (id >= 0)
+            tracer::unwatch(id);
+    }
+
+    trace_watch(const trace_watch &) = delete;
+    trace_watch &operator=(const trace_watch &) = delete;
+};
+
+
+/**
+ * @brief tracing of a run, with --trace[=<prefix>]: starts the tracer at
+ * construction and writes the files (default prefix "trace") at destruction
+ */
+class trace_session {
+private:
+    std::string prefix;
+
+public:
+    // constructor
+    trace_session(bool enable, const std::string &prefix) :
+            prefix(prefix.empty() ? "trace" : prefix) {
+        if (enable)
+            tracer::start();
+        else
+            this->prefix.clear();
+    }
+
+    // destructor
+    ~trace_session() {
+        if (prefix.empty())
+            return;
+        tracer::stop();
+        tracer::dump(prefix);
+    }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include <string>
+#include <functional>
+#include "opencv2/opencv.hpp"
+
+#include "auxiliary/cli.hpp"
+#include "sequential/frame_pipeline.hpp"
+
+
+// setup of a farm: number of workers and workers of each stage
+struct farm_profile {
+    int n_workers = 1;
+    int nw_rgb2gray = 1;
+    int nw_smooth = 1;
+    int nw_motion_detect = 1;
+};
+
+/**
+ * @brief key of a profile in the profiles file: host, resolution, thread
+ * budget and the options choosing the kernels in 'params' (e.g. "myhost
+ * 1920x1080 16 simd-avx2,fused", or "generic" without any)
+ */
+std::string profile_key(int rows, int cols, int budget, const pipeline_params &params);
+
+/**
+ * @brief looks for the profile of 'key' in a profiles file
+ *
+ * @return true if the profile was found (and put in 'profile')
+ */
+bool load_profile(const std::string &path, const std::string &key, farm_profile &profile);
+
+// saves the profile of 'key' in a profiles file, replacing the old one if any
+void save_profile(const std::string &path, const std::string &key,
+                  const farm_profile &profile);
+
+/**
+ * @brief measures the decode rate and the service time of the stages on
+ * the next 'n_frames' frames of the video, with several numbers of workers
+ * per stage, and picks the setup of the farm with the best throughput
+ * within the thread budget. The frames are processed while measuring: the
+ * result of each one is passed to 'emit'.
+ *
+ * @param cap the video, after the background
+ * @param background the background image
+ * @param params parameters of the computation (the numbers of workers are ignored)
+ * @param budget max number of threads working on frames
+ * @param decoders number of threads decoding the video
+ * @param n_frames number of frames to measure
+ * @param emit callback receiving (frame index, motion) for each frame measured
+ * @return the best setup; 'n_frames' is set to the frames actually read
+ */
+farm_profile autotune_farm(cv::VideoCapture &cap, cv::Mat *background,
+                           pipeline_params params, int budget, int decoders,
+                           size_t &n_frames,
+                           const std::function<void(size_t, bool)> &emit);
+
+/**
+ * @brief handles --autotune for the farms: takes the setup from the
+ * profiles file or tunes it on the first frames of the video (and saves
+ * it), then applies it to 'n_workers' and 'params'.
+ *
+ * @return the number of frames already processed (0 without --autotune)
+ */
+size_t apply_autotune(const cli_options &args, cv::VideoCapture &cap,
+                      cv::Mat *background, int &n_workers, pipeline_params &params,
+                      const std::function<void(size_t, bool)> &emit);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef BATCH_SIZER_HPP
+#define BATCH_SIZER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+
+/**
+ * @brief chooses how many frames the producer groups in a task.
+ *
+ * With a fixed size, next() always returns it. In adaptive mode the size
+ * starts at 1 and the workers report, for every task, the time spent
+ * getting it from the queue (synchronization) and the time spent
+ * processing it (service): every WINDOW tasks, if synchronization took more
+ * than MAX_OVERHEAD of the service time, the size is doubled, up to
+ * 'max_size'. The size never shrinks.
+ */
+class batch_sizer {
+private:
+    static constexpr unsigned WINDOW = 8;
+    static constexpr double MAX_OVERHEAD = 0.05;
+
+    std::atomic<size_t> size;
+    const size_t max_size;
+    const bool adaptive;
+    std::atomic<uint64_t> sync_ns, service_ns;
+    std::atomic<unsigned> n_tasks;
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param size fixed size (ignored in adaptive mode)
+     * @param max_size max size in adaptive mode
+     * @param adaptive whether to grow the size at runtime
+     */
+    batch_sizer(size_t size, size_t max_size, bool adaptive) :
+            size(adaptive ? 1 : std::max<size_t>(size, 1)),
+            max_size(adaptive ? std::max<size_t>(max_size, 1) : std::max<size_t>(size, 1)),
+            adaptive(adaptive), sync_ns(0), service_ns(0), n_tasks(0) {}
+
+    // size of the next task
+    size_t next() const { return size.load(std::memory_order_relaxed); }
+
+    // max size a task can ever have
+    size_t get_max_size() const { return max_size; }
+
+    /**
+     * @brief reports the times measured by a worker for a task
+     *
+     * @param sync time spent getting the task from the queue (ns)
+     * @param service time spent processing the task (ns)
+     */
+    void record(uint64_t sync, uint64_t service) {
+        if (!adaptive)
+            return;
+        sync_ns += sync;
+        service_ns += service;
+        if (++n_tasks % WINDOW != 0)
+            return;
+
+        uint64_t window_sync = sync_ns.exchange(0);
+        uint64_t window_service = service_ns.exchange(0);
+        size_t cur = size.load();
+        if (window_sync > MAX_OVERHEAD * window_service && cur < max_size)
+            size.compare_exchange_strong(cur, std::min(2 * cur, max_size));
+    }
+};
+
+#endif
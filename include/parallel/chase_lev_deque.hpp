@@ -0,0 +1,115 @@
+#ifndef CHASE_LEV_DEQUE_HPP
+#define CHASE_LEV_DEQUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+#include "parallel/shared_queue.hpp"
+
+
+/**
+ * @brief bounded Chase-Lev work-stealing deque of pointers.
+ *
+ * The owner pushes and pops at the bottom, any other thread steals from the
+ * top (Chase & Lev, "Dynamic circular work-stealing deque", with the C11
+ * orderings of Le et al.). The buffer has a fixed capacity: push fails
+ * when the deque is full instead of growing it.
+ */
+template<typename T>
+class chase_lev_deque {
+private:
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<std::atomic<T*>[]> buffer;
+
+    alignas(CACHE_LINE) std::atomic<long> top;
+    alignas(CACHE_LINE) std::atomic<long> bottom;
+
+    static size_t round_capacity(size_t n) {
+        size_t c = 2;
+        while (c < n)
+            c <<= 1;
+        return c;
+    }
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param capacity max number of elements (rounded up to a power of 2)
+     */
+    chase_lev_deque(size_t capacity) :
+            capacity(round_capacity(capacity)), mask(round_capacity(capacity) - 1),
+            buffer(new std::atomic<T*>[round_capacity(capacity)]), top(0),
+            bottom(0) {}
+
+    size_t get_capacity() const { return capacity; }
+
+    /**
+     * @brief pushes an element at the bottom (owner only)
+     *
+     * @return false if the deque is full
+     */
+    bool push(T *item) {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if (b - t >= (long)capacity)
+            return false;
+        buffer[b & mask].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief pops the element at the bottom (owner only)
+     *
+     * @return the element, or nullptr if the deque is empty
+     */
+    T * pop() {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+        if (t > b) {    // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = buffer[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {   // last element: race with the thieves
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /**
+     * @brief steals the element at the top (any thread)
+     *
+     * @return the element, or nullptr if the deque is empty or another
+     * thread won the race for the element
+     */
+    T * steal() {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        T *item = buffer[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+    // approximate number of elements
+    size_t size() const {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+};
+
+#endif
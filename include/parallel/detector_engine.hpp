@@ -0,0 +1,140 @@
+#ifndef DETECTOR_ENGINE_HPP
+#define DETECTOR_ENGINE_HPP
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/motion_detector.hpp"
+#include "parallel/shared_queue.hpp"
+#include "sequential/motion_map.hpp"
+#include "sequential/video_state.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+
+/*
+ * Internals of motion_detector, shared by the sequential backend
+ * (motion_detector.cpp) and the parallel ones (parallel_engines.cpp), which
+ * are in a file of their own so that the programs using only the
+ * sequential backend don't depend on FastFlow.
+ */
+
+// a frame submitted, from submit until its result is delivered
+struct detect_task {
+    cv::Mat *frame;
+    size_t n_frame;
+    bool motion;
+    bool has_promise;
+    std::promise<bool> promise;
+    motion_map map;     // with --heatmap, where the motion is
+};
+
+
+/**
+ * @brief state shared by the backends: what the parameters ask for, the
+ * tasks (recycled, at most max_in_flight) and the delivery of the results
+ * in submission order. A backend only has to run process on every task it
+ * gets through dispatch.
+ */
+struct motion_detector::engine {
+    pipeline_params params;
+    video_state video;          // attached to params
+    result_callback on_result;
+
+    std::vector<detect_task> tasks;
+    shared_queue<detect_task> free_tasks;
+
+    // tasks done but not delivered yet, at (n_frame - 1) % tasks.size()
+    mutable std::mutex m;
+    std::condition_variable delivered;
+    std::vector<detect_task *> done;
+    size_t n_submitted = 0, n_delivered = 0, n_motion_frames = 0;
+
+    engine(cv::Mat &background_frame, const pipeline_params &p, int n_workers,
+           result_callback on_result, size_t max_in_flight) :
+            params(p), video(params, background_frame, std::max(n_workers, tile_pool::budget())),
+            on_result(on_result), tasks(max_in_flight), free_tasks(max_in_flight),
+            done(max_in_flight, nullptr) {
+        for (detect_task &t : tasks)
+            free_tasks.push(&t);
+    }
+
+    virtual ~engine() {}
+
+    // hands a task to the backend
+    virtual void dispatch(detect_task *t) = 0;
+
+    // computes the result of a task, with a Mat for the smoothed frame of
+    // the calling thread, then delivers it
+    void process(detect_task *t, cv::Mat &frame_smooth) {
+        tracer::set_frame(t->n_frame);
+        cv::Mat *background = video.background;
+        frame_smooth.create(background->rows, background->cols, CV_8UC1);
+        t->motion = frame_has_motion(background, t->frame, &frame_smooth, params,
+                                     video.heatmap ? &t->map : nullptr);
+        complete(t);
+    }
+
+    // delivers the results of the tasks done, in submission order
+    void complete(detect_task *t) {
+        std::lock_guard<std::mutex> lk(m);
+        done[(t->n_frame - 1) % done.size()] = t;
+        while (true) {
+            detect_task *&next = done[n_delivered % done.size()];
+            if (next == nullptr || next->n_frame != n_delivered + 1)
+                break;
+            detect_task *ready = next;
+            next = nullptr;
+            n_delivered++;
+            if (ready->motion)
+                n_motion_frames++;
+            if (video.heatmap)
+                video.heatmap->add(ready->n_frame, ready->motion, ready->map);
+            if (on_result)
+                on_result(ready->n_frame, ready->motion, ready->frame);
+            if (ready->has_promise)
+                ready->promise.set_value(ready->motion);
+            free_tasks.push(ready);
+        }
+        if (n_delivered == n_submitted)
+            delivered.notify_all();
+    }
+
+    size_t submit(cv::Mat *frame, std::future<bool> *result) {
+        detect_task *t = free_tasks.pop();     // waits if all the tasks are in flight
+        t->frame = frame;
+        t->has_promise = result != nullptr;
+        if (result != nullptr) {
+            t->promise = std::promise<bool>();
+            *result = t->promise.get_future();
+        }
+        {
+            std::lock_guard<std::mutex> lk(m);
+            t->n_frame = ++n_submitted;
+        }
+        dispatch(t);
+        return t->n_frame;
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lk(m);
+        delivered.wait(lk, [this]() { return n_delivered == n_submitted; });
+    }
+};
+
+
+
+// creates the engine of a backend
+using engine_factory = motion_detector::engine *(*)(cv::Mat &background_frame,
+                                                    const pipeline_params &p, int n_workers,
+                                                    motion_detector::result_callback on_result,
+                                                    size_t max_in_flight);
+
+// makes a backend available to the motion_detector constructor (the
+// parallel backends register themselves in parallel_engines.cpp)
+bool register_detector_backend(detector_backend backend, engine_factory factory);
+
+#endif
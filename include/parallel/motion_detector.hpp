@@ -0,0 +1,131 @@
+#ifndef MOTION_DETECTOR_HPP
+#define MOTION_DETECTOR_HPP
+
+#include <string>
+#include <memory>
+#include <future>
+#include <functional>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+// where the frames submitted to a motion_detector are processed
+enum class detector_backend {
+    sequential,     // on the thread calling submit
+    threads,        // native threads sharing a queue
+    fastflow        // farm of FastFlow workers, run as an accelerator
+};
+
+// reads a backend name ("seq", "threads" or "ff"); false if unknown
+bool parse_detector_backend(const std::string &name, detector_backend &backend);
+
+const char * detector_backend_name(detector_backend backend);
+
+
+/**
+ * @brief motion detection engine, to be embedded in a program that gets
+ * the frames by itself (e.g. from a network stream): frames are pushed
+ * one by one with submit and the results come back through a callback
+ * or a future, in submission order.
+ *
+ * The frames belong to the caller and are not copied: a frame must stay
+ * valid until its result is delivered, and it may be modified (the
+ * grayscale conversion is done in place), after which the caller can
+ * reuse it. At most 'max_in_flight' frames are processed at the same
+ * time: submit waits when they are all taken, so the memory used doesn't
+ * grow if the caller is faster than the engine.
+ *
+ * The engine owns what the parameters ask for (a video_state: background,
+ * region of interest, pyramid, running background, previous frames of the
+ * incremental detection, heatmap): every engine is independent, and
+ * several videos can be processed by the same program (with their own
+ * heatmap_prefix). The numbers of workers in the parameters are for the
+ * intra-frame pool (tile_pool), which is shared by all the engines.
+ *
+ * submit and flush are to be called by one thread at a time. The callback
+ * runs on the threads of the engine, one call at a time, and must not
+ * call submit or flush.
+ */
+class motion_detector {
+public:
+    /**
+     * @brief called with the result of every frame, in submission order
+     *
+     * @param n_frame number of the frame (the first one after the
+     * background is 1)
+     * @param motion whether motion was detected in the frame
+     * @param frame the frame, that the caller can reuse from now on
+     */
+    using result_callback = std::function<void(size_t n_frame, bool motion, cv::Mat *frame)>;
+
+    struct engine;      // backend, see detector_engine.hpp
+
+private:
+    std::unique_ptr<engine> impl;
+    detector_backend used_backend;
+
+public:
+    /**
+     * @brief constructor, starts the threads of the backend
+     *
+     * @param background first frame of the video (modified: converted
+     * into the background)
+     * @param params parameters of the computation (min_diff, perc, kernels
+     * and options; use_gray_frames already applied for grayscale frames)
+     * @param backend where the frames are processed
+     * @param n_workers threads processing frames (threads and fastflow)
+     * @param on_result callback for the results (may be empty)
+     * @param max_in_flight max frames being processed (default 4 *
+     * n_workers, 1 for the sequential backend)
+     */
+    motion_detector(cv::Mat &background, const pipeline_params &params,
+                    detector_backend backend = detector_backend::sequential, int n_workers = 1,
+                    result_callback on_result = nullptr, size_t max_in_flight = 0);
+
+    // destructor, waits for the results of all the frames submitted
+    ~motion_detector();
+
+    motion_detector(const motion_detector &) = delete;
+    motion_detector &operator=(const motion_detector &) = delete;
+
+    /**
+     * @brief submits a frame, waiting if max_in_flight frames are being
+     * processed
+     *
+     * @param frame frame of the same size and type as the background
+     * @return the number of the frame
+     */
+    size_t submit(cv::Mat *frame);
+
+    // like submit, the result is also delivered through the future
+    std::future<bool> submit_with_future(cv::Mat *frame);
+
+    // waits until the results of all the frames submitted are delivered
+    void flush();
+
+    // frames submitted so far
+    size_t submitted() const;
+
+    // frames with motion among the ones whose result has been delivered
+    size_t motion_frames() const;
+
+    // max frames being processed at the same time
+    size_t max_in_flight() const;
+
+    // backend processing the frames (sequential if the one asked for is
+    // not linked in the program, see parallel_engines.cpp)
+    detector_backend backend() const;
+
+    // the background and the parameters of the video, with what the
+    // options ask for attached (e.g. to process frames apart, as the
+    // temporal_sampler does)
+    cv::Mat * background() const;
+    const pipeline_params &params() const;
+
+    // prints the statistics of the options that have them (pyramid,
+    // running background, incremental detection) and writes the heatmap
+    void report() const;
+};
+
+#endif
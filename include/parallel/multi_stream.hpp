@@ -0,0 +1,174 @@
+#ifndef MULTI_STREAM_HPP
+#define MULTI_STREAM_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+#include "parallel/shared_queue.hpp"
+
+
+/**
+ * @brief scheduler of the tasks of several streams (videos) on a single
+ * pool of workers.
+ *
+ * Every stream has a bounded queue of its own, filled by its producer (the
+ * decoder of the stream), which waits when the queue is full: a fast
+ * stream can't take more than its share of the tasks in flight. Workers
+ * take the tasks round-robin over the streams, starting from a position
+ * shared by all the workers and advanced at every pop, so every stream
+ * with tasks waiting is served in turn. Workers that find all the queues
+ * empty spin for a while and then park on a condition variable, like in
+ * shared_queue.
+ *
+ * With the frame pool split per NUMA node (see frame_pool), a stream has a
+ * queue per part: the producer pushes a task in the queue of the part of
+ * its frames, and workers take first from the queues of the part of their
+ * node, then from the other ones.
+ */
+template<typename T>
+class multi_stream_scheduler {
+private:
+    static constexpr int SPINS_BEFORE_PARKING = 256;
+
+    std::vector<std::unique_ptr<shared_queue<T>>> queues;  // n_parts per stream
+    size_t n_parts;
+
+    alignas(CACHE_LINE) std::atomic<size_t> next_stream;  // round-robin position
+    alignas(CACHE_LINE) std::atomic<size_t> pushing;      // streams not finished
+
+    // parking of the workers waiting for tasks
+    alignas(CACHE_LINE) std::mutex m;
+    std::condition_variable not_empty;
+    std::atomic<int> parked_workers;
+
+    // first task found visiting the streams from the round-robin position,
+    // in the queues of 'part' first
+    T * try_take(size_t &stream, size_t part) {
+        size_t n = queues.size() / n_parts;
+        size_t start = next_stream.fetch_add(1, std::memory_order_relaxed);
+        for (size_t j = 0; j < n_parts; j++) {
+            size_t p = (part + j) % n_parts;
+            for (size_t i = 0; i < n; i++) {
+                size_t s = (start + i) % n;
+                T *task = queues[s * n_parts + p]->poll();
+                if (task != nullptr) {
+                    stream = s;
+                    return task;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void wake_workers() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_workers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lk(m);
+            not_empty.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param n_streams number of streams
+     * @param capacity max number of tasks waiting in the queue of each stream
+     * (split among its parts)
+     * @param n_parts number of parts of the frame pools
+     */
+    multi_stream_scheduler(size_t n_streams, size_t capacity, size_t n_parts = 1) :
+            n_parts(std::max<size_t>(n_parts, 1)), next_stream(0), pushing(n_streams),
+            parked_workers(0) {
+        size_t per_part = (capacity + this->n_parts - 1) / this->n_parts;
+        for (size_t q = 0; q < n_streams * this->n_parts; q++)
+            queues.emplace_back(new shared_queue<T>(per_part));
+    }
+
+    // capacity of the queues of each stream
+    size_t get_capacity() const {
+        size_t c = 0;
+        for (size_t p = 0; p < n_parts; p++)
+            c += queues[p]->get_capacity();
+        return c;
+    }
+
+    // number of tasks waiting in the queues of a stream (approximate)
+    size_t size(size_t stream) {
+        size_t n = 0;
+        for (size_t p = 0; p < n_parts; p++)
+            n += queues[stream * n_parts + p]->size();
+        return n;
+    }
+
+    // whether no task is waiting in any queue (approximate)
+    bool empty() {
+        for (auto &q : queues)
+            if (!q->empty())
+                return false;
+        return true;
+    }
+
+    // whether all the producers finished pushing
+    bool get_finished() { return pushing.load() == 0; }
+
+    /**
+     * @brief pushes a task of a stream in the queue of a part, waiting while
+     * the queue is full (to be called by the producers of the stream only)
+     */
+    void push(size_t stream, T *task, size_t part = 0) {
+        queues[stream * n_parts + part % n_parts]->push(task);
+        wake_workers();
+    }
+
+    // the producers of a stream finished pushing tasks
+    void no_more_pushes(size_t stream) {
+        for (size_t p = 0; p < n_parts; p++)
+            queues[stream * n_parts + p]->no_more_pushes();
+        if (--pushing == 0) {
+            std::lock_guard<std::mutex> lk(m);
+            not_empty.notify_all();
+        }
+    }
+
+    /**
+     * @brief pops the next task, waiting while all the queues are empty and
+     * some stream is not finished
+     *
+     * @param stream where to put the stream of the task
+     * @param part part of the node of the worker (its queues are visited first)
+     * @return the task (or nullptr if all the streams are finished and
+     * their queues are empty)
+     */
+    T * pop(size_t &stream, size_t part = 0) {
+        part %= n_parts;
+        for (int spin = 0; ; spin++) {
+            T *task = try_take(stream, part);
+            if (task != nullptr)
+                return task;
+            if (pushing.load() == 0)
+                // tasks pushed before the last no_more_pushes are visible now
+                return try_take(stream, part);
+            if (spin < SPINS_BEFORE_PARKING) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m);
+            parked_workers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while ((task = try_take(stream, part)) == nullptr && pushing.load() > 0)
+                not_empty.wait(lk);
+            parked_workers--;
+            if (task != nullptr)
+                return task;
+            spin = 0;   // finished while waiting: take what's left
+        }
+    }
+};
+
+#endif
@@ -3,19 +3,54 @@
 
 #include <queue>
 #include <atomic>
+#include <vector>
 #include "opencv2/opencv.hpp"
 
 #include "parallel/shared_queue.hpp"
+#include "parallel/work_stealing.hpp"
+#include "parallel/multi_stream.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/motion_map.hpp"
+#include "parallel/reorder_buffer.hpp"
+#include "parallel/batch_sizer.hpp"
+#include "auxiliary/frame_pool.hpp"
 
 
-void pick_and_comp(shared_queue<cv::Mat> *q, const int th_num,
-                   cv::Mat *background, int nw_rgb2gray, int nw_smooth,
-                   int nw_motion_detect, int min_diff, float perc,
-                   std::atomic<int>& n_motion_frames);
+// group of consecutive frames dispatched to a worker as a single task
+struct frame_batch {
+    std::vector<cv::Mat *> frames;
+    std::vector<char> motion;   // result for each frame
+    std::vector<motion_map> maps;   // with --heatmap, where the motion is in each frame
+    size_t segment;             // segment of the video the frames come from
+    size_t seq;                 // position of the batch in the batches of its segment
+    size_t first_index;         // position of frames[0] in the video
+    size_t stride = 1;          // distance in the video between consecutive frames
+    size_t part = 0;            // part of the frame pool of its frames (see frame_pool)
+};
 
-void main_comp(cv::Mat *background, cv::Mat *frame_rgb, int nw_rgb2gray,
-               int nw_smooth, int nw_motion_detect, int min_diff, float perc,
-               std::atomic<int>& n_motion_frames);
+class segmented_results;    // see segmented_decoding.hpp
+
+// what the workers need for the batches of a video: the pool its frames go
+// back to, its background and parameters, and where its results go
+struct video_context {
+    frame_pool *pool;
+    cv::Mat *background;
+    const pipeline_params *params;
+    segmented_results *results;
+};
+
+// Queue is shared_queue<frame_batch>, work_stealing_scheduler<frame_batch>
+// (a single video) or multi_stream_scheduler<frame_batch> (a video per stream)
+template<typename Queue>
+void pick_and_comp(Queue *q, const std::vector<video_context> &videos, const int th_num,
+                   std::atomic<int>& n_motion_frames, batch_sizer *sizer);
+
+bool main_comp(cv::Mat *background, cv::Mat *frame_rgb, cv::Mat *frame_smooth,
+               const pipeline_params &params,
+               std::atomic<int>& n_motion_frames, motion_map *map = nullptr);
+
+// adds the maps of the frames of a processed batch to the heatmap (if any)
+void add_to_heatmap(motion_heatmap *heatmap, const frame_batch &batch);
 
 void print_usage_parallel_prog(const std::string prog_name);
 
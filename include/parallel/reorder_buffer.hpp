@@ -0,0 +1,77 @@
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+
+/**
+ * @brief puts back in order results produced out of order.
+ *
+ * Results are inserted with their index in the stream and emitted (through
+ * a callback) strictly in index order. The buffer is a ring of 'capacity'
+ * slots: a result too far ahead of the next one to be emitted waits until
+ * there is room, so memory and the reordering latency stay bounded even if
+ * a worker is slow. The callback is called under the lock of the buffer,
+ * so it never runs concurrently with itself.
+ */
+template<typename T>
+class reorder_buffer {
+private:
+    std::vector<T> slots;
+    std::vector<bool> ready;
+    size_t next;    // index of the next result to be emitted
+    std::function<void(size_t, const T&)> emit;
+    std::mutex m;
+    std::condition_variable room;
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param capacity max distance between the next result to be emitted
+     * and the results waiting in the buffer
+     * @param first_index index of the first result of the stream
+     * @param emit callback receiving (index, result) in index order
+     */
+    reorder_buffer(size_t capacity, size_t first_index,
+                   std::function<void(size_t, const T&)> emit) :
+            slots(capacity), ready(capacity, false), next(first_index),
+            emit(emit) {}
+
+    /**
+     * @brief inserts a result and emits all the results that are now in
+     * order. Waits while 'index' is 'capacity' or more results ahead of the
+     * next one to be emitted.
+     *
+     * @param index index of the result in the stream
+     * @param value the result
+     */
+    void insert(size_t index, const T &value) {
+        std::unique_lock<std::mutex> lk(m);
+        room.wait(lk, [&]() { return index < next + slots.size(); });
+
+        slots[index % slots.size()] = value;
+        ready[index % slots.size()] = true;
+
+        bool emitted = false;
+        while (ready[next % slots.size()]) {
+            ready[next % slots.size()] = false;
+            emit(next, slots[next % slots.size()]);
+            next++;
+            emitted = true;
+        }
+        if (emitted)
+            room.notify_all();
+    }
+
+    // index of the next result to be emitted
+    size_t get_next() {
+        std::lock_guard<std::mutex> lk(m);
+        return next;
+    }
+};
+
+#endif
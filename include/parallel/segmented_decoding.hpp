@@ -0,0 +1,144 @@
+#ifndef SEGMENTED_DECODING_HPP
+#define SEGMENTED_DECODING_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/parallel_funcs.hpp"
+#include "parallel/shared_queue.hpp"
+#include "parallel/reorder_buffer.hpp"
+#include "parallel/batch_sizer.hpp"
+#include "auxiliary/frame_pool.hpp"
+
+
+// range of frames of the video decoded by a VideoCapture of its own
+struct video_segment {
+    size_t first;       // index of the first frame of the segment
+    size_t n_frames;    // number of frames (0: until the end of the video)
+    size_t stride = 1;  // only one frame every 'stride' is read (see temporal_sampler)
+};
+
+/**
+ * @brief splits the frames from 'first_frame' to the end of the video (the
+ * frames after the background are 1 .. n-1) into 'n_segments' ranges of
+ * about the same length. With 'gop' > 0, the segments start at multiples
+ * of 'gop', i.e. on keyframes if the video has a fixed GOP of that length,
+ * so no segment decodes frames before its start. The last segment runs
+ * until the end of the video, since the frame count reported by the
+ * container may be an estimate.
+ *
+ * @param cap the video
+ * @param n_segments number of segments wanted (fewer if the video is short
+ * or its length is unknown)
+ * @param gop GOP length of the video (0 if unknown)
+ * @param first_frame first frame to be decoded
+ * @return the segments, in frame order
+ */
+std::vector<video_segment> split_video(cv::VideoCapture &cap, size_t n_segments,
+                                       size_t gop, size_t first_frame = 1);
+
+/**
+ * @brief opens the video and moves it to the first frame of a segment
+ *
+ * @return false if the video can't be opened
+ */
+bool open_segment(cv::VideoCapture &cap, const std::string &path,
+                  const video_segment &segment);
+
+/**
+ * @brief reads the frames of a segment into batches and hands them out.
+ * Batches are taken from 'free_batches' (waiting for one if there are
+ * none) and their frames from the part of 'pool' of the batch. With a
+ * stride, the frames between the ones read are skipped with grab.
+ *
+ * @param cap the video, positioned on the first frame of the segment
+ * @param segment_id position of the segment (stored in the batches)
+ * @param segment the segment
+ * @param pool where to take the frames from
+ * @param free_batches where to take the batches from
+ * @param sizer size of the batches
+ * @param push called with every batch filled
+ * @return the number of frames of the segment, read or skipped
+ */
+size_t decode_segment(cv::VideoCapture &cap, size_t segment_id,
+                      const video_segment &segment, frame_pool *pool,
+                      shared_queue<frame_batch> *free_batches, batch_sizer *sizer,
+                      const std::function<void(frame_batch *)> &push);
+
+
+/**
+ * @brief decodes the segments of a video in parallel, one thread (and one
+ * VideoCapture) per segment.
+ */
+class segmented_decoder {
+private:
+    std::vector<std::thread> threads;
+    std::atomic<size_t> running;
+
+public:
+    /**
+     * @brief constructor, starts the threads (see decode_segment for the
+     * parameters)
+     *
+     * @param on_finished called (by the last decoding thread) once all the
+     * segments have been read
+     */
+    segmented_decoder(const std::string &path, const std::vector<video_segment> &segments,
+                      frame_pool *pool, shared_queue<frame_batch> *free_batches,
+                      batch_sizer *sizer, std::function<void(frame_batch *)> push,
+                      std::function<void()> on_finished);
+
+    // destructor, waits for the threads
+    ~segmented_decoder() { join(); }
+
+    // waits for all the segments to be read
+    void join();
+};
+
+
+/**
+ * @brief merges in frame order the per-frame results of batches coming
+ * out of order from several segments.
+ *
+ * Every segment has a reorder buffer of its own, keyed by the position of
+ * the batch in the segment. The results of the first segment are emitted
+ * as soon as they are in order; those of the other segments are kept (one
+ * flag per frame) and emitted by flush, once the video is over. With a
+ * single segment it's just a reorder buffer. Every batch is recycled as
+ * soon as its results have been taken.
+ */
+class segmented_results {
+private:
+    std::vector<std::unique_ptr<reorder_buffer<frame_batch *>>> buffers;
+    std::vector<std::vector<char>> pending;     // results of segments 1..
+    std::vector<size_t> pending_first;          // first frame of segments 1..
+    std::vector<size_t> pending_stride;         // stride of segments 1..
+    std::function<void(size_t, bool)> emit_frame;
+    std::function<void(frame_batch *)> recycle;
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param segments the segments of the video
+     * @param capacity max number of batches in flight
+     * @param emit_frame callback receiving (frame index, motion) in frame order
+     * @param recycle callback receiving the batches whose results have been taken
+     */
+    segmented_results(const std::vector<video_segment> &segments, size_t capacity,
+                      std::function<void(size_t, bool)> emit_frame,
+                      std::function<void(frame_batch *)> recycle);
+
+    // inserts a processed batch (see reorder_buffer::insert)
+    void insert(frame_batch *batch);
+
+    // emits the results of the segments after the first one
+    void flush();
+};
+
+#endif
@@ -2,22 +2,129 @@
 #define SHARED_QUEUE_HPP
 
 #include <mutex>
-#include <queue>
 #include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <cstddef>
 
 
+// cache line size, to keep the hot atomics of the queue on separate lines
+constexpr size_t CACHE_LINE = 64;
+
+// hint to the CPU that the thread is busy-waiting
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+/**
+ * @brief bounded lock-free multi-producer/multi-consumer queue of pointers.
+ *
+ * Ring buffer where every cell has a sequence number telling whether it can
+ * be written (seq == position) or read (seq == position + 1) by the thread
+ * that claims that position with a CAS on the enqueue/dequeue counter
+ * (D. Vyukov's bounded MPMC queue). Producers block when the queue is full,
+ * so the frames in flight never exceed the capacity. A thread that can't
+ * push/pop spins for a while and then parks on a condition variable; the
+ * mutex is only taken when some thread is parked.
+ */
 template<typename T>
 class shared_queue {
 private:
-    std::mutex m;
-    std::condition_variable cond_var;
-    std::queue<T*> q;
-    std::atomic<bool> finished;
+    struct alignas(CACHE_LINE) cell {
+        std::atomic<size_t> seq;
+        T *data;
+    };
+
+    static constexpr int SPINS_BEFORE_PARKING = 256;
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<cell[]> cells;
+
+    alignas(CACHE_LINE) std::atomic<size_t> enqueue_pos;
+    alignas(CACHE_LINE) std::atomic<size_t> dequeue_pos;
+    alignas(CACHE_LINE) std::atomic<bool> finished;
+
+    // parking of producers waiting for space and consumers waiting for frames
+    alignas(CACHE_LINE) std::mutex m;
+    std::condition_variable not_full, not_empty;
+    std::atomic<int> parked_producers, parked_consumers;
+
+    // smallest power of 2 >= n (and >= 2)
+    static size_t round_capacity(size_t n) {
+        size_t c = 2;
+        while (c < n)
+            c <<= 1;
+        return c;
+    }
+
+    bool try_push(T *frame) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell &c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                      std::memory_order_relaxed)) {
+                    c.data = frame;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (seq < pos)
+                return false;   // full
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T *&frame) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell &c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                                      std::memory_order_relaxed)) {
+                    frame = c.data;
+                    c.seq.store(pos + capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (seq < pos + 1)
+                return false;   // empty
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // wakes up the threads parked on 'cv', if any
+    void wake(std::atomic<int> &parked, std::condition_variable &cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lk(m);
+            cv.notify_all();
+        }
+    }
 
 public:
-    // constructor
-    shared_queue() : finished(false) {}
+    /**
+     * @brief constructor
+     *
+     * @param capacity max number of elements in the queue (rounded up to a
+     * power of 2)
+     */
+    shared_queue(size_t capacity = 64) :
+            capacity(round_capacity(capacity)), mask(round_capacity(capacity) - 1),
+            cells(new cell[round_capacity(capacity)]), enqueue_pos(0),
+            dequeue_pos(0), finished(false), parked_producers(0),
+            parked_consumers(0) {
+        for (size_t i = 0; i < this->capacity; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
 
     // destructor
     ~shared_queue() {}
@@ -25,68 +132,109 @@ public:
     // getter for "finished"
     bool get_finished() { return finished; /* atomic */ }
 
+    // getter for the capacity
+    size_t get_capacity() const { return capacity; }
+
     /**
-     * @brief push a frame in the queue assuring access synchronization
-     * 
-     * Creates a "unique_lock", pushes the frame into the queue and releases
-     * the lock notifying a waiting thread through a condition variable.
-     * 
+     * @brief push a frame in the queue, waiting while the queue is full
+     *
+     * Spins for a while trying to push, then parks on a condition variable
+     * until a consumer makes room. Wakes up a parked consumer, if any.
+     *
      * @param frame the pointer to the frame to be pushed in the queue
      */
     void push(T *frame) {
-        std::unique_lock<std::mutex> lk(m);
-        q.push(frame);
-        cond_var.notify_one();
+        for (int spin = 0; !try_push(frame); spin++) {
+            if (spin < SPINS_BEFORE_PARKING) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m);
+            parked_producers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!try_push(frame))
+                not_full.wait(lk);
+            parked_producers--;
+            break;
+        }
+        wake(parked_consumers, not_empty);
     }
 
     /**
-     * @brief pop a frame from the queue assuring access synchronization
-     * 
-     * Creates a "unique_lock", through a condition variable it waits while
-     * the queue is empty or the main thread finished pushing frames.
-     * Then, if the queue isn't empty, it pops a frame and returns it.
-     * 
-     * @return the pointer to the frame popped from the queue (or nullptr)
+     * @brief pop a frame from the queue, waiting while it is empty and the
+     * producer didn't finish pushing frames
+     *
+     * Spins for a while trying to pop, then parks on a condition variable
+     * until a frame is pushed or no_more_pushes is called. Wakes up a
+     * parked producer, if any.
+     *
+     * @return the pointer to the frame popped from the queue (or nullptr
+     * if the queue is empty and no more frames will be pushed)
      */
     T * pop() {
-        std::unique_lock<std::mutex> lk(m);
-        
-        cond_var.wait(lk, [this](){ return !q.empty() || finished; });
-        
-        if (!q.empty()) {   // q can be empty if finished is true
-            T *frame = q.front();
-            q.pop();
-            return frame;
+        T *frame = nullptr;
+        for (int spin = 0; !try_pop(frame); spin++) {
+            if (finished.load(std::memory_order_acquire))
+                // frames pushed before no_more_pushes are visible now
+                return try_pop(frame) ? frame : nullptr;
+            if (spin < SPINS_BEFORE_PARKING) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m);
+            parked_consumers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!try_pop(frame) && !finished)
+                not_empty.wait(lk);
+            parked_consumers--;
+            if (frame == nullptr)   // finished while waiting
+                return try_pop(frame) ? frame : nullptr;
+            break;
         }
-        return nullptr; // if q is empty and finished is true
+        wake(parked_producers, not_full);
+        return frame;
     }
 
     /**
-     * @brief get the size of the queue assuring access synchronization
-     * 
+     * @brief pop a frame from the queue without waiting. Wakes up a parked
+     * producer, if any.
+     *
+     * @return the pointer to the frame popped from the queue (or nullptr
+     * if the queue is empty)
+     */
+    T * poll() {
+        T *frame = nullptr;
+        if (try_pop(frame))
+            wake(parked_producers, not_full);
+        return frame;
+    }
+
+    /**
+     * @brief get the (approximate, if other threads are using the queue)
+     * size of the queue
+     *
      * @return the size of the queue
      */
     size_t size() {
-        std::lock_guard<std::mutex> lk(m);
-        return q.size();
+        size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
     }
 
     /**
-     * @brief checks whether the queue is empty assuring access synchronization
-     * 
+     * @brief checks whether the queue is empty
+     *
      * @return true if the queue is empty
      * @return false if the queue is not empty
      */
-    bool empty() {
-        std::lock_guard<std::mutex> lk(m);
-        return q.empty();
-    }
+    bool empty() { return size() == 0; }
 
     // set finished to true and notifies all waiting threads
     void no_more_pushes() {
         finished = true;    // atomic
-        cond_var.notify_all();
+        std::lock_guard<std::mutex> lk(m);
+        not_empty.notify_all();
     }
 };
 
-#endif
\ No newline at end of file
+#endif
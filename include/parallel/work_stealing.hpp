@@ -0,0 +1,219 @@
+#ifndef WORK_STEALING_HPP
+#define WORK_STEALING_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+#include "parallel/shared_queue.hpp"
+#include "parallel/chase_lev_deque.hpp"
+
+
+/**
+ * @brief work-stealing scheduler: a single producer spreads tasks over one
+ * Chase-Lev deque per worker, the workers take tasks from their own deque
+ * and, when it's empty, steal from the neighbouring ones.
+ *
+ * The producer is the owner of all the deques (it's the only thread pushing
+ * at their bottom), while the workers always take from the top, so each
+ * deque is served in FIFO order and a worker only contends with the thieves
+ * visiting its deque, instead of with all the workers as in shared_queue.
+ * Tasks are pushed round-robin, skipping full deques. Like shared_queue,
+ * it's bounded and threads that can't push/pop spin for a while and then
+ * park on a condition variable. With the frame pool split per NUMA node
+ * (see frame_pool), a task only goes in the deques of the workers on the
+ * node of its part.
+ */
+template<typename T>
+class work_stealing_scheduler {
+private:
+    static constexpr int SPINS_BEFORE_PARKING = 256;
+
+    struct alignas(CACHE_LINE) worker_stats {
+        std::atomic<size_t> steals{0};
+    };
+
+    std::vector<std::unique_ptr<chase_lev_deque<T>>> deques;
+    std::vector<size_t> deque_part;     // part of the frame pool near each worker
+    std::unique_ptr<worker_stats[]> stats;
+    size_t next_deque;  // round-robin position (producer only)
+
+    alignas(CACHE_LINE) std::atomic<bool> finished;
+
+    // parking of the producer waiting for space and workers waiting for tasks
+    alignas(CACHE_LINE) std::mutex m;
+    std::condition_variable not_full, not_empty;
+    std::atomic<int> parked_producers, parked_workers;
+
+    bool try_push(T *task, size_t part) {
+        size_t n = deques.size();
+        for (size_t i = 0; i < n; i++) {
+            size_t d = (next_deque + i) % n;
+            if (deque_part[d] == part && deques[d]->push(task)) {
+                next_deque = (d + 1) % n;
+                return true;
+            }
+        }
+        return false;   // all full
+    }
+
+    // own deque first, then the neighbours in order
+    T * try_take(size_t worker) {
+        size_t n = deques.size();
+        for (size_t i = 0; i < n; i++) {
+            size_t d = (worker + i) % n;
+            T *task = deques[d]->steal();
+            if (task != nullptr) {
+                if (i > 0)
+                    stats[worker].steals.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // like try_take, but doesn't give up while some deque has tasks (steal
+    // fails also when losing a race for a task)
+    T * drain(size_t worker) {
+        while (!empty()) {
+            T *task = try_take(worker);
+            if (task != nullptr)
+                return task;
+        }
+        return nullptr;
+    }
+
+    // wakes up the threads parked on 'cv', if any
+    void wake(std::atomic<int> &parked, std::condition_variable &cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lk(m);
+            cv.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param n_workers number of workers (one deque each)
+     * @param capacity max number of tasks waiting, split among the deques
+     * (each deque capacity is rounded up to a power of 2)
+     * @param worker_parts part of the frame pool near each worker (empty if
+     * the pool has a single part)
+     */
+    work_stealing_scheduler(size_t n_workers, size_t capacity,
+                            const std::vector<size_t> &worker_parts = {}) :
+            stats(new worker_stats[std::max<size_t>(n_workers, 1)]), next_deque(0),
+            finished(false), parked_producers(0), parked_workers(0) {
+        n_workers = std::max<size_t>(n_workers, 1);
+        size_t per_worker = (capacity + n_workers - 1) / n_workers;
+        for (size_t i = 0; i < n_workers; i++) {
+            deques.emplace_back(new chase_lev_deque<T>(per_worker));
+            deque_part.push_back(i < worker_parts.size() ? worker_parts[i] : 0);
+        }
+    }
+
+    // getter for "finished"
+    bool get_finished() { return finished; /* atomic */ }
+
+    // total capacity of the deques
+    size_t get_capacity() const {
+        size_t c = 0;
+        for (auto &d : deques)
+            c += d->get_capacity();
+        return c;
+    }
+
+    /**
+     * @brief push a task in the next deque with room (producer only),
+     * waiting while all the deques are full
+     *
+     * @param task the pointer to the task
+     * @param part part of the frame pool of the task (it goes in the deques
+     * of the workers near it)
+     */
+    void push(T *task, size_t part = 0) {
+        if (std::find(deque_part.begin(), deque_part.end(), part) == deque_part.end())
+            part = deque_part[0];
+        for (int spin = 0; !try_push(task, part); spin++) {
+            if (spin < SPINS_BEFORE_PARKING) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m);
+            parked_producers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!try_push(task, part))
+                not_full.wait(lk);
+            parked_producers--;
+            break;
+        }
+        wake(parked_workers, not_empty);
+    }
+
+    /**
+     * @brief take a task for a worker, from its deque or stealing it from
+     * another one, waiting while there are none and the producer didn't
+     * finish pushing tasks
+     *
+     * @param worker number of the worker (0 .. number of workers - 1)
+     * @return the pointer to the task (or nullptr if all the deques are
+     * empty and no more tasks will be pushed)
+     */
+    T * pop(size_t worker) {
+        worker %= deques.size();
+        T *task = nullptr;
+        for (int spin = 0; (task = try_take(worker)) == nullptr; spin++) {
+            if (finished.load(std::memory_order_acquire))
+                // tasks pushed before no_more_pushes are visible now
+                return drain(worker);
+            if (spin < SPINS_BEFORE_PARKING) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m);
+            parked_workers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while ((task = try_take(worker)) == nullptr && !finished)
+                not_empty.wait(lk);
+            parked_workers--;
+            if (task == nullptr) {  // finished while waiting
+                lk.unlock();
+                return drain(worker);
+            }
+            break;
+        }
+        wake(parked_producers, not_full);
+        return task;
+    }
+
+    // (approximate) number of tasks waiting in all the deques
+    size_t size() const {
+        size_t s = 0;
+        for (auto &d : deques)
+            s += d->size();
+        return s;
+    }
+
+    // checks whether all the deques are empty
+    bool empty() const { return size() == 0; }
+
+    // number of tasks a worker stole from the other deques
+    size_t steals(size_t worker) const {
+        return stats[worker].steals.load(std::memory_order_relaxed);
+    }
+
+    // set finished to true and notifies all waiting threads
+    void no_more_pushes() {
+        finished = true;    // atomic
+        std::lock_guard<std::mutex> lk(m);
+        not_empty.notify_all();
+    }
+};
+
+#endif
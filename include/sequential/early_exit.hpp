@@ -0,0 +1,96 @@
+#ifndef EARLY_EXIT_HPP
+#define EARLY_EXIT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+#include "auxiliary/tile_pool.hpp"
+
+
+/**
+ * @brief minimum number of different pixels for which motion_detect finds
+ * motion, i.e. the smallest n with float(n) / float(n_pixels) > perc (the
+ * test is monotonic in n, so it can be decided by comparing counts).
+ *
+ * @param n_pixels number of pixels of the image
+ * @param perc percentage of different pixels to detect motion
+ * @return the threshold (n_pixels + 1 if motion can never be detected)
+ */
+inline uint64_t min_motion_pixels(int n_pixels, float perc) {
+    auto motion = [&](uint64_t n) { return float(n) / float(n_pixels) > perc; };
+    if (!motion(n_pixels))
+        return uint64_t(n_pixels) + 1;
+    // start from the real-valued threshold and fix the rounding
+    int64_t n = std::min<int64_t>(std::max<int64_t>(int64_t(double(perc) * n_pixels), 0), n_pixels);
+    while (n > 0 && motion(n - 1))
+        n--;
+    while (!motion(n))
+        n++;
+    return n;
+}
+
+
+/**
+ * @brief counts different pixels tile by tile, stopping as soon as the
+ * result of the motion detection is known: the count already reached the
+ * threshold (motion), or the pixels left can't make it reach the threshold
+ * (no motion).
+ *
+ * Tiles of rows are handed out dynamically to the threads of the
+ * tile_pool; after each tile
+ * the local count and the number of pixels of the tile are added together
+ * to a single atomic word, so every thread sees a consistent (count,
+ * scanned pixels) snapshot and decides exactly.
+ *
+ * @param rows number of rows of the images
+ * @param cols number of columns of the images
+ * @param perc percentage of different pixels to detect motion
+ * @param nw number of threads to use (if 1, sequential version)
+ * @param count_row callable (int i) -> number of different pixels of row i
+ * @return true if more than 'perc'% of the pixels are different
+ */
+template <typename RowCounter>
+bool early_exit_motion_detect(int rows, int cols, float perc, int nw,
+                              RowCounter count_row) {
+    const uint64_t n_pixels = uint64_t(rows) * cols;
+    const uint64_t threshold = min_motion_pixels(rows * cols, perc);
+    if (threshold == 0)
+        return true;
+    if (threshold > n_pixels)
+        return false;
+
+    // tiles of about 16K pixels
+    const int tile_rows = std::max(1, 16384 / std::max(cols, 1));
+    const int n_tiles = (rows + tile_rows - 1) / tile_rows;
+
+    // high 32 bits: different pixels, low 32 bits: scanned pixels
+    std::atomic<uint64_t> progress(0);
+    std::atomic<int> decision(-1);  // -1 unknown, 0 no motion, 1 motion
+
+    tile_pool::get().parallel_for(n_tiles, nw, [&](int t) {
+        if (decision.load(std::memory_order_relaxed) != -1)
+            return;
+
+        int last_row = std::min(rows, (t + 1) * tile_rows);
+        uint64_t n_different = 0;
+        for (int i = t * tile_rows; i < last_row; i++)
+            n_different += count_row(i);
+
+        uint64_t tile_pixels = uint64_t(last_row - t * tile_rows) * cols;
+        uint64_t now = progress.fetch_add((n_different << 32) | tile_pixels) +
+                       ((n_different << 32) | tile_pixels);
+        uint64_t count = now >> 32;
+        uint64_t scanned = now & 0xFFFFFFFFu;
+        if (count >= threshold)
+            decision.store(1, std::memory_order_relaxed);
+        else if (count + (n_pixels - scanned) < threshold)
+            decision.store(0, std::memory_order_relaxed);
+    });
+
+    if (decision.load() != -1)
+        return decision.load() == 1;
+    return (progress.load() >> 32) >= threshold;
+}
+
+#endif
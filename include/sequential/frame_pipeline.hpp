@@ -0,0 +1,80 @@
+#ifndef FRAME_PIPELINE_HPP
+#define FRAME_PIPELINE_HPP
+
+#include <string>
+#include "opencv2/opencv.hpp"
+
+#include "auxiliary/cli.hpp"
+
+class running_background;   // see running_background.hpp
+class pyramid_detector;     // see pyramid.hpp
+class roi_mask;             // see roi_mask.hpp
+class incremental_detector; // see incremental.hpp
+struct motion_map;          // see motion_map.hpp
+
+/**
+ * @brief parameters of the per-frame computation, shared by all the
+ * executables (sequential, native threads, FastFlow)
+ */
+struct pipeline_params {
+    int nw_rgb2gray = 1;        // workers for the rgb2gray operation
+    int nw_smooth = 1;          // workers for the smoothing operation
+    int nw_motion_detect = 1;   // workers for the motion detection
+    unsigned min_diff = 10;     // min difference between 2 pixels to be considered different
+    float perc = 0.05;          // percentage of different pixels to detect motion
+    bool fused = false;         // single pass gray -> smooth -> diff
+    bool simd = false;          // vectorized kernels (ISA chosen at startup)
+    int radius = 1;             // radius of the smoothing neighborhood
+    bool early_exit = false;    // stop motion detection once the result is known
+    int bg_shift = 0;           // adaptive background with weight 2^-bg_shift (0: fixed)
+    running_background *running_bg = nullptr;   // set by running_background::attach
+    int pyramid_factor = 1;     // coarse detection at 1/pyramid_factor of the resolution (1: off)
+    float pyramid_margin = 0.02;    // full resolution if the coarse percentage is this close to perc
+    pyramid_detector *pyramid = nullptr;    // set by pyramid_detector::attach
+    int stride = 1;             // frames sampled by the readers (see temporal_sampler)
+    std::string roi_path;       // mask of the region of interest (empty: whole frame)
+    roi_mask *roi = nullptr;    // set by roi_mask::attach
+    int block_size = 0;         // blocks recomputed only if changed since the previous frame (0: off)
+    incremental_detector *incremental = nullptr;    // set by incremental_detector::attach
+    int cell_size = 0;          // cells of the motion heatmap (0: off)
+    bool motion_box = false;    // with the heatmap, rectangle of the motion of each frame
+    std::string heatmap_prefix; // where the heatmap is written (see motion_heatmap::write)
+    bool gray_frames = false;   // frames are already grayscale (set by use_gray_frames)
+    bool specialize = false;    // kernels specialized for the frame width, radius and threshold
+    // set by use_specialized_kernels (nullptr: generic kernel)
+    void (*specialized_smooth)(cv::Mat *, cv::Mat *, int) = nullptr;
+    bool (*specialized_detect)(cv::Mat *, cv::Mat *, float, int) = nullptr;
+};
+
+// reads the parameters from the command line (workers from position 'nw_pos')
+pipeline_params parse_pipeline_params(const cli_options &args, size_t nw_pos);
+
+// prints the description of the options read by parse_pipeline_params
+void print_pipeline_options();
+
+// the frames are grayscale (the Y plane of a mapped_video): skips rgb2gray
+// and disables the options that need the color frames
+void use_gray_frames(pipeline_params &params);
+
+// turns the first frame of the video into the background
+cv::Mat * make_background(cv::Mat *background_rgb, const pipeline_params &params);
+
+// checks whether a frame contains motion w.r.t. the background (and, with
+// the heatmap, where)
+bool frame_has_motion(cv::Mat *background, cv::Mat *frame_rgb,
+                      cv::Mat *frame_smooth, const pipeline_params &params,
+                      motion_map *map = nullptr);
+
+// time spent in each stage for a frame, in microseconds
+struct stage_times {
+    long rgb2gray = 0;
+    long smooth = 0;
+    long motion_detect = 0;     // the whole frame with the fused kernel
+};
+
+// like frame_has_motion, measuring the time of each stage
+bool frame_has_motion_timed(cv::Mat *background, cv::Mat *frame_rgb,
+                            cv::Mat *frame_smooth, const pipeline_params &params,
+                            stage_times &times);
+
+#endif
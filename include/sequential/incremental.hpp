@@ -0,0 +1,97 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+/**
+ * @brief incremental motion detection: the frames are split in blocks
+ * (block x block pixels), and only the blocks that changed since the
+ * previous frame are converted, smoothed and compared with the background.
+ * The other ones take their number of different pixels from the previous
+ * frame.
+ *
+ * A block is compared with the previous frame as read (RGB, or grayscale
+ * for YUV videos), row by row with memcmp. Its own pixels decide whether
+ * its grayscale values must be converted again; its pixels plus a halo of
+ * 'radius' pixels around it (the smoothing neighborhood) decide whether it
+ * must be smoothed and compared again. Smoothing and comparison of a block
+ * are done in one pass, with the same arithmetic as smooth / smooth_radius
+ * and motion_detect, so the result is the same as the full computation,
+ * and the work is proportional to the area that changed.
+ *
+ * The previous frame, with its grayscale version and the counts of its
+ * blocks, is kept in a cache. The caches are taken by the threads for the
+ * time of a frame, so the detector can be shared by the workers of the
+ * farms: a thread gets the most recently used free cache (any frame of
+ * the video gives the right result, the closest ones skip more blocks),
+ * and a new one is made if they are all taken.
+ */
+class incremental_detector {
+private:
+    struct cache {
+        cv::Mat input;      // frame as read (unused for grayscale frames)
+        cv::Mat gray;       // grayscale frame
+        std::vector<unsigned> counts;   // different pixels in each block
+        std::vector<uchar> changed;     // blocks whose pixels changed
+        std::vector<uchar> dirty;       // blocks to be smoothed again (halo included)
+        std::vector<int> to_do;         // indexes of the blocks of a step
+        bool valid = false;     // false until the first frame
+    };
+
+    int rows, cols, block;
+    int blocks_x, blocks_y;
+    std::mutex m;
+    std::vector<std::unique_ptr<cache>> free_caches;    // the most recent one last
+
+    std::atomic<size_t> n_frames{0};
+    std::atomic<size_t> n_recomputed{0};    // blocks smoothed and compared
+
+    std::unique_ptr<cache> acquire();
+    void release(std::unique_ptr<cache> c);
+
+    // columns [x0, x1) and rows [y0, y1) of block b
+    void block_bounds(int b, int &x0, int &x1, int &y0, int &y1) const;
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param rows height of the frames
+     * @param cols width of the frames
+     * @param block side of the blocks, in pixels
+     */
+    incremental_detector(int rows, int cols, int block);
+
+    /**
+     * @brief checks whether a frame contains motion w.r.t. the background,
+     * recomputing only the blocks changed since the previous frame
+     *
+     * @param background pointer to the background image
+     * @param frame_rgb the frame (not modified)
+     * @param params parameters of the computation (min_diff, perc, radius,
+     * gray_frames and workers)
+     * @return true if motion is detected in the frame
+     */
+    bool detect(cv::Mat *background, cv::Mat *frame_rgb, const pipeline_params &params);
+
+    // prints the fraction of blocks that were recomputed
+    void report() const;
+
+    /**
+     * @brief sets up the detector asked by 'params' (if any) and attaches it
+     * to 'params'
+     *
+     * @return the detector (nullptr without --incremental)
+     */
+    static std::unique_ptr<incremental_detector> attach(pipeline_params &params,
+                                                        int rows, int cols);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef MAPPED_VIDEO_HPP
+#define MAPPED_VIDEO_HPP
+
+#include <string>
+#include <memory>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+struct yuv_file;    // see mapped_video.cpp
+
+
+/**
+ * @brief reader of uncompressed YUV videos that memory-maps the file
+ * instead of decoding it. It can replace a cv::VideoCapture anywhere.
+ *
+ * Supported files:
+ * - .y4m, 8 bits per sample (any chroma subsampling);
+ * - .yuv (planar YUV 4:2:0) and .nv12, whose size must be in the file name,
+ *   e.g. "foreman_352x288.yuv".
+ *
+ * The frames read are the Y planes of the file, as read-only CV_8UC1 views
+ * of the mapping: no copy and no color conversion. The frames after the
+ * current one are prefetched with madvise. The chroma planes are never
+ * read, the mapping is set up so that readahead doesn't bring them in.
+ * A file is mapped once, and all its readers share the mapping, which
+ * stays until the end of the program: the frames stay valid after their
+ * reader is released (e.g. by the reader of a segment).
+ */
+class mapped_video : public cv::VideoCapture {
+private:
+    static constexpr size_t PREFETCH_FRAMES = 8;
+
+    std::shared_ptr<const yuv_file> file;
+    size_t pos = 0;         // index of the next frame to be grabbed
+    bool grabbed = false;   // whether frame pos - 1 can be retrieved
+
+    // asks the kernel to read the Y plane of frame i in advance
+    void prefetch(size_t i) const;
+
+public:
+    using cv::VideoCapture::open;
+    using cv::VideoCapture::operator>>;
+
+    // constructor, the video is opened by open
+    mapped_video() {}
+
+    // whether the file is one of the supported ones (by its extension)
+    static bool supports(const std::string &path);
+
+    bool open(const cv::String &filename, int api_preference = cv::CAP_ANY) override;
+    bool isOpened() const override;
+    void release() override;
+    bool grab() override;
+    bool retrieve(cv::OutputArray image, int flag = 0) override;
+    bool read(cv::OutputArray image) override;
+    cv::VideoCapture &operator>>(cv::Mat &image) override;
+
+    // supports CAP_PROP_POS_FRAMES (exact seek)
+    bool set(int prop_id, double value) override;
+
+    // supports CAP_PROP_POS_FRAMES, CAP_PROP_FRAME_COUNT (exact),
+    // CAP_PROP_FRAME_WIDTH, CAP_PROP_FRAME_HEIGHT and CAP_PROP_FPS
+    double get(int prop_id) const override;
+};
+
+
+/**
+ * @brief makes a reader for a video, not opened yet: a mapped_video for the
+ * files it supports, a cv::VideoCapture otherwise
+ */
+std::unique_ptr<cv::VideoCapture> make_capture(const std::string &path);
+
+/**
+ * @brief opens a video with make_capture; for a mapped video, also tells
+ * the computation that the frames are already grayscale (see use_gray_frames)
+ *
+ * @param path path of the video
+ * @param params parameters of the computation
+ * @return the reader (check isOpened)
+ */
+std::unique_ptr<cv::VideoCapture> open_video(const std::string &path, pipeline_params &params);
+
+#endif
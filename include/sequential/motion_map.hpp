@@ -0,0 +1,111 @@
+#ifndef MOTION_MAP_HPP
+#define MOTION_MAP_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+#include "sequential/frame_pipeline.hpp"
+
+
+// rectangle of a frame: columns [x0, x1), rows [y0, y1)
+struct motion_box {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+
+    // grows the rectangle to contain 'other'
+    void merge(const motion_box &other) {
+        if (other.empty())
+            return;
+        if (empty()) {
+            *this = other;
+            return;
+        }
+        x0 = std::min(x0, other.x0);
+        y0 = std::min(y0, other.y0);
+        x1 = std::max(x1, other.x1);
+        y1 = std::max(y1, other.y1);
+    }
+};
+
+
+/**
+ * @brief where the pixels different from the background are in a frame:
+ * their number in each cell of a grid (cell x cell pixels, the cells on the
+ * right and at the bottom may be smaller), and optionally the rectangle
+ * containing them all. Filled by motion_detect_map in the same pass that
+ * counts them.
+ */
+struct motion_map {
+    int cell = 0;
+    int cells_x = 0, cells_y = 0;
+    std::vector<unsigned> counts;   // cells_y rows of cells_x cells
+    motion_box box;                 // empty if no pixel differs (or not asked)
+
+    // sets the size of the grid for a frame, all the cells at 0
+    void reset(int rows, int cols, int cell_size) {
+        cell = cell_size;
+        cells_x = (cols + cell - 1) / cell;
+        cells_y = (rows + cell - 1) / cell;
+        counts.assign(size_t(cells_x) * cells_y, 0);
+        box = motion_box();
+    }
+};
+
+
+/**
+ * @brief motion heatmap of a video: sums the maps of the frames with motion
+ * and, with --motion-box, keeps the rectangle of every one of them. The
+ * frames can be added in any order and by any thread (under a lock, once
+ * per frame), so the collectors of the farms add them as they come.
+ */
+class motion_heatmap {
+private:
+    int rows, cols, cell;
+    bool with_boxes;
+    std::string prefix;
+
+    mutable std::mutex m;
+    std::vector<uint64_t> counts;
+    std::vector<std::pair<size_t, motion_box>> boxes;   // (frame, rectangle)
+    motion_box overall;         // rectangle of all the frames with motion
+    size_t n_frames = 0;        // frames with motion added
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param rows height of the frames
+     * @param cols width of the frames
+     * @param cell side of the cells, in pixels
+     * @param with_boxes keep the rectangle of every frame with motion
+     * @param prefix where to write the heatmap (see write)
+     */
+    motion_heatmap(int rows, int cols, int cell, bool with_boxes, const std::string &prefix);
+
+    // adds the map of a frame, if it has motion
+    void add(size_t n_frame, bool motion, const motion_map &map);
+
+    /**
+     * @brief writes the heatmap to <prefix>.csv (a line per row of cells,
+     * different pixels summed over the frames with motion) and, with the
+     * rectangles, <prefix>_boxes.csv (frame,x0,y0,x1,y1 for every frame with
+     * motion, in frame order), and prints where they are
+     */
+    void write();
+
+    /**
+     * @brief sets up the heatmap asked by 'params' (if any)
+     *
+     * @return the heatmap (nullptr without --heatmap)
+     */
+    static std::unique_ptr<motion_heatmap> attach(const pipeline_params &params,
+                                                  int rows, int cols);
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef PYRAMID_HPP
+#define PYRAMID_HPP
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+/**
+ * @brief converts a RGB image to grayscale and downsamples it in a single
+ * pass: every pixel of 'small' is the average of the 3 channels of a
+ * factor x factor block of 'rgb_img' (the rows and columns left over at the
+ * bottom and on the right are ignored).
+ *
+ * @param rgb_img cv::Mat with 3 channels (R-G-B)
+ * @param small Mat where to put the result (rows / factor x cols / factor)
+ * @param factor downsampling factor
+ * @param nw number of threads to use (if 1, sequential version)
+ */
+void rgb2gray_downsample(const cv::Mat &rgb_img, cv::Mat &small, int factor, int nw);
+
+
+/**
+ * @brief coarse-to-fine motion detection: every frame is first compared
+ * with the background at 1/factor of the resolution (grayscale conversion
+ * and downsampling fused, then smoothing and motion detection on the small
+ * frame). Only if the percentage of different pixels found there is within
+ * 'margin' of perc, the frame goes through the full resolution computation.
+ *
+ * The decisions taken at low resolution can differ from the full resolution
+ * ones only for frames whose percentage moves by more than the margin, so
+ * the margin trades speed for accuracy. To estimate the speedup, a frame
+ * every SAMPLE_PERIOD goes to full resolution anyway (and takes its result
+ * from there). Counters are atomic, the detector can be shared by the
+ * workers of the farms.
+ */
+class pyramid_detector {
+private:
+    static constexpr size_t SAMPLE_PERIOD = 64;
+
+    int factor;
+    float margin;
+    int radius;             // smoothing radius at low resolution
+    cv::Mat background;     // background at low resolution
+
+    std::atomic<size_t> n_frames{0};
+    std::atomic<size_t> n_escalated{0};     // frames too close to perc
+    std::atomic<size_t> n_full{0};          // frames at full resolution (samples included)
+    std::atomic<long> coarse_us{0};     // time spent at low resolution
+    std::atomic<long> full_us{0};       // time spent at full resolution
+
+    // grayscale + downsampling + smoothing of a frame
+    void coarse_frame(const cv::Mat &rgb_img, cv::Mat &small_gray, cv::Mat &small_smooth,
+                      const pipeline_params &params) const;
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param background_rgb the first frame of the video (not modified)
+     * @param params parameters of the computation (pyramid factor and margin,
+     * smoothing radius, kernels)
+     */
+    pyramid_detector(const cv::Mat &background_rgb, const pipeline_params &params);
+
+    /**
+     * @brief checks whether a frame contains motion, at low resolution if
+     * that's enough to decide
+     *
+     * @param frame_rgb the frame (not modified at low resolution)
+     * @param params parameters of the computation
+     * @param full_res the full resolution computation, called if the low
+     * resolution result is too close to perc
+     * @return true if motion is detected in the frame
+     */
+    bool detect(cv::Mat *frame_rgb, const pipeline_params &params,
+                const std::function<bool()> &full_res);
+
+    // prints the fraction of frames that needed the full resolution and the
+    // estimated speedup w.r.t. computing all of them at full resolution
+    void report() const;
+
+    /**
+     * @brief sets up the detector asked by 'params' (if any) and attaches it
+     * to 'params'. To be called before make_background, which converts the
+     * first frame in place.
+     *
+     * @return the detector (nullptr without --pyramid)
+     */
+    static std::unique_ptr<pyramid_detector> attach(pipeline_params &params,
+                                                    const cv::Mat &background_rgb);
+};
+
+#endif
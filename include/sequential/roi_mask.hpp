@@ -0,0 +1,67 @@
+#ifndef ROI_MASK_HPP
+#define ROI_MASK_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+// columns [first, last) of a row
+struct pixel_span {
+    int first;
+    int last;
+};
+
+/**
+ * @brief region of interest of the frames, compiled from a mask image into
+ * per-row run-length spans, so the kernels visit only the pixels inside it
+ * (see roi_motion_detect).
+ *
+ * Besides the spans of the region, it keeps the spans of the region grown
+ * by 1 pixel in every direction (the halo): smoothing a pixel of the region
+ * needs the grayscale values of its 3x3 neighborhood.
+ */
+class roi_mask {
+private:
+    int rows, cols;
+    size_t n_pixels;        // pixels inside the region
+    // spans of row i: spans[row_first[i]] .. spans[row_first[i + 1] - 1]
+    std::vector<pixel_span> spans, halo_spans;
+    std::vector<int> row_first, halo_row_first;
+
+    // appends the spans of the nonzero elements of 'row' to 'out'
+    static void compile_row(const uchar *row, int cols, std::vector<pixel_span> &out);
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param mask CV_8UC1 image as big as the frames: nonzero pixels are
+     * inside the region
+     */
+    explicit roi_mask(const cv::Mat &mask);
+
+    // spans of the region in row i
+    const pixel_span *begin(int i) const { return spans.data() + row_first[i]; }
+    const pixel_span *end(int i) const { return spans.data() + row_first[i + 1]; }
+
+    // spans of the region grown by 1 pixel in row i
+    const pixel_span *halo_begin(int i) const { return halo_spans.data() + halo_row_first[i]; }
+    const pixel_span *halo_end(int i) const { return halo_spans.data() + halo_row_first[i + 1]; }
+
+    // number of pixels inside the region
+    size_t area() const { return n_pixels; }
+
+    /**
+     * @brief loads the mask of --roi (if any), resized to the frames if
+     * needed, and attaches the region to 'params'
+     *
+     * @return the region (nullptr without --roi, or if the mask can't be read)
+     */
+    static std::unique_ptr<roi_mask> attach(pipeline_params &params, int rows, int cols);
+};
+
+#endif
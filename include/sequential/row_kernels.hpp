@@ -0,0 +1,78 @@
+#ifndef ROW_KERNELS_HPP
+#define ROW_KERNELS_HPP
+
+#include <cstdint>
+#include "opencv2/opencv.hpp"
+
+
+/**
+ * @brief converts a row of a RGB image into grayscale (same arithmetic as
+ * rgb2gray).
+ *
+ * @param rgb_row pointer to the first byte of the RGB row
+ * @param gray_row pointer to the grayscale row to be filled
+ * @param cols number of pixels in the row
+ */
+inline void rgb2gray_row(const uchar *rgb_row, uchar *gray_row, int cols) {
+    for (int j = 0; j < cols; j++)
+        gray_row[j] = (rgb_row[3*j] + rgb_row[3*j + 1] + rgb_row[3*j + 2]) / 3;
+}
+
+
+/**
+ * @brief smoothed value of a pixel on the border of the image (same
+ * arithmetic as the border loops of smooth).
+ *
+ * @param up row above the pixel (nullptr if the pixel is on the first row)
+ * @param mid row of the pixel
+ * @param down row below the pixel (nullptr if the pixel is on the last row)
+ * @param j column of the pixel
+ * @param cols number of columns of the image
+ * @return the average of the valid neighbors of the pixel
+ */
+inline uchar border_smooth_pixel(const uchar *up, const uchar *mid,
+                                 const uchar *down, int j, int cols) {
+    int col_lower_offset = j > 0 ? -1 : 0;
+    int col_upper_offset = j < cols - 1 ? 1 : 0;
+    uint8_t n_neighbors = ((up != nullptr) + 1 + (down != nullptr)) *
+                          (col_upper_offset - col_lower_offset + 1);
+    uchar sum = 0;
+    for (const uchar *row : {up, mid, down})
+        if (row != nullptr)
+            for (int c = col_lower_offset; c <= col_upper_offset; c++)
+                sum += row[j + c];
+    return sum / n_neighbors;
+}
+
+
+/**
+ * @brief compares a row with a running background stored in 8.8 fixed point
+ * and computes the row of the updated background in the same pass. The
+ * update is acc += (pixel - acc) * 2^-shift, with an arithmetic shift; the
+ * background value of a pixel is its accumulator rounded to 8 bits.
+ *
+ * There are no branches and all the arithmetic is on ints, so the loop is
+ * vectorized by the compiler (see the per-ISA copies in simd_funcs.cpp).
+ *
+ * @param acc row of the running background (8.8 fixed point)
+ * @param frame row of the smoothed frame
+ * @param acc_out row where to put the updated background
+ * @param cols number of pixels in the row
+ * @param min_diff min difference between 2 pixels to be considered different
+ * @param shift weight of the frame in the update (2^-shift)
+ * @return the number of pixels differing from the background by more than 'min_diff'
+ */
+inline unsigned detect_update_row(const uint16_t *acc, const uchar *frame,
+                                  uint16_t *acc_out, int cols,
+                                  unsigned min_diff, int shift) {
+    unsigned n = 0;
+    for (int j = 0; j < cols; j++) {
+        int a = acc[j];
+        int diff = ((a + 128) >> 8) - frame[j];
+        n += unsigned(diff < 0 ? -diff : diff) > min_diff;
+        acc_out[j] = a + (((frame[j] << 8) - a) >> shift);
+    }
+    return n;
+}
+
+#endif
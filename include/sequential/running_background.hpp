@@ -0,0 +1,87 @@
+#ifndef RUNNING_BACKGROUND_HPP
+#define RUNNING_BACKGROUND_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+/**
+ * @brief background that follows slow changes of the scene (e.g. light):
+ * every frame without motion is blended into it with weight 2^-shift, i.e.
+ * an exponential running average.
+ *
+ * The background is stored in 8.8 fixed point (uint16 per pixel), so the
+ * small updates are not lost to rounding. The comparison with the frame
+ * and the update are done in the same pass (see detect_update_row): the
+ * updated background is written into a new version, which is published
+ * only if the frame has no motion.
+ *
+ * Versions are immutable once published, so any number of threads can
+ * detect motion at the same time without locks, each against the version
+ * that was current when it started. A thread publishes its version only if
+ * the current one is still the one it started from (compare and swap);
+ * otherwise its update is dropped, since it would undo the one published
+ * in the meantime. So in the farms the frames used for the updates, and
+ * the results, may differ a little from run to run.
+ */
+class running_background {
+private:
+    struct version {
+        cv::Mat acc;                        // 8.8 fixed point background
+        std::atomic<int> readers{0};        // threads comparing frames with it
+        std::atomic<bool> claimed{false};   // being written by a thread
+    };
+
+    // 2 versions per thread (the one read and the one written) + the current one
+    std::vector<std::unique_ptr<version>> versions;
+    std::atomic<int> current{0};
+    std::atomic<size_t> n_updates{0};
+    int shift;
+
+    // index of the current version, protected from reuse until release
+    int acquire();
+    void release(int v) { versions[v]->readers--; }
+
+    // index of a version that nobody reads or writes
+    int claim();
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param background the initial background (smoothed grayscale)
+     * @param shift weight of a frame in the update (2^-shift, 1 .. 8)
+     * @param max_threads max number of threads calling detect at the same time
+     */
+    running_background(const cv::Mat &background, int shift, int max_threads);
+
+    /**
+     * @brief checks whether a frame contains motion w.r.t. the background and,
+     * if not, blends the frame into the background.
+     *
+     * @param frame_smooth the smoothed grayscale frame
+     * @param params parameters of the computation (min_diff, perc, simd and
+     * workers of the motion detection)
+     * @return true if motion is detected in the frame
+     */
+    bool detect(cv::Mat *frame_smooth, const pipeline_params &params);
+
+    // number of frames blended into the background so far
+    size_t updates() const { return n_updates; }
+
+    /**
+     * @brief sets up the running background asked by 'params' (if any) and
+     * attaches it to 'params'
+     *
+     * @return the running background (nullptr without --adaptive-bg)
+     */
+    static std::unique_ptr<running_background> attach(pipeline_params &params,
+                                                      const cv::Mat &background,
+                                                      int max_threads);
+};
+
+#endif
@@ -3,15 +3,26 @@
 
 #include "opencv2/opencv.hpp"
 
+#include "sequential/motion_map.hpp"
+
 // image conversion RGB to grayscale
 cv::Mat * rgb2gray(cv::Mat *rgb_img, int nw);
 
 // smoothing
 void smooth_clean_code(cv::Mat *gray_img, cv::Mat *smooth_img);
 void smooth(cv::Mat * gray_img, cv::Mat *smooth_img, int nw);
+void smooth_radius(cv::Mat *gray_img, cv::Mat *smooth_img, int radius, int nw);
 
 // motion detection
 bool motion_detect(cv::Mat *img1, cv::Mat *img2, unsigned min_detect_diff,
                    float perc, int nw);
+bool motion_detect_map(cv::Mat *img1, cv::Mat *img2, unsigned min_detect_diff,
+                       float perc, int nw, motion_map &map, bool with_box);
+bool motion_detect_early_exit(cv::Mat *img1, cv::Mat *img2,
+                              unsigned min_detect_diff, float perc, int nw);
+
+// rgb2gray + smooth + motion detection in a single pass over the frame
+bool fused_motion_detect(cv::Mat *background, cv::Mat *rgb_img,
+                         unsigned min_detect_diff, float perc, int nw);
 
 #endif
\ No newline at end of file
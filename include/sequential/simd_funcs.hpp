@@ -0,0 +1,43 @@
+#ifndef SIMD_FUNCS_HPP
+#define SIMD_FUNCS_HPP
+
+#include <string>
+#include <cstdint>
+#include "opencv2/opencv.hpp"
+
+
+// instruction sets for which vectorized kernels are available
+enum class simd_isa { scalar, sse41, avx2, avx512 };
+
+// best instruction set supported by the CPU (checked once with cpuid)
+simd_isa detected_simd_isa();
+
+// instruction set used by the *_simd kernels
+simd_isa active_simd_isa();
+
+// limits the instruction set used by the kernels ("scalar", "sse4", "avx2", "avx512")
+bool limit_simd_isa(const std::string &name);
+
+const char * simd_isa_name(simd_isa isa);
+
+// vectorized versions of the kernels in sequential_funcs.hpp (same results, bit for bit)
+cv::Mat * rgb2gray_simd(cv::Mat *rgb_img, int nw);
+void smooth_simd(cv::Mat *gray_img, cv::Mat *smooth_img, int nw);
+bool motion_detect_simd(cv::Mat *img1, cv::Mat *img2, unsigned min_detect_diff,
+                        float perc, int nw);
+bool motion_detect_early_exit_simd(cv::Mat *img1, cv::Mat *img2,
+                                   unsigned min_detect_diff, float perc, int nw);
+bool fused_motion_detect_simd(cv::Mat *background, cv::Mat *rgb_img,
+                              unsigned min_detect_diff, float perc, int nw);
+
+// rgb2gray + smooth + motion detection only inside a region (see roi_mask.hpp)
+class roi_mask;
+bool roi_motion_detect(cv::Mat *background, cv::Mat *rgb_img, const roi_mask &roi,
+                       unsigned min_detect_diff, float perc, int nw, bool simd);
+
+// vectorized detect_update_row (see row_kernels.hpp)
+unsigned detect_update_row_simd(const uint16_t *acc, const uchar *frame,
+                                uint16_t *acc_out, int cols, unsigned min_diff,
+                                int shift);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SPECIALIZED_FUNCS_HPP
+#define SPECIALIZED_FUNCS_HPP
+
+#include <string>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+/*
+ * Versions of smooth, smooth_radius and motion_detect instantiated at
+ * compile time for common frame widths, smoothing radiuses and thresholds
+ * (see specialized_funcs.cpp for the list), so that the compiler can unroll
+ * the row loops, take the border handling out of them and fold the
+ * constants. Same results as the generic kernels, bit for bit.
+ */
+
+// kernels with the signatures of the generic ones, minus the parameters
+// fixed at compile time
+using smooth_kernel = void (*)(cv::Mat *gray_img, cv::Mat *smooth_img, int nw);
+using detect_kernel = bool (*)(cv::Mat *img1, cv::Mat *img2, float perc, int nw);
+
+// smoothing specialized for the width (radius 1) or for the radius (any
+// width); nullptr if there is no instantiation
+smooth_kernel specialized_smooth(int cols, int radius);
+
+// motion detection specialized for the width and the threshold, or only
+// for the threshold; nullptr if there is no instantiation
+detect_kernel specialized_motion_detect(int cols, unsigned min_detect_diff);
+
+// description of the specialization of a kernel (e.g. "width 1920"),
+// "generic" if it isn't one of the specialized kernels
+std::string specialization_name(smooth_kernel kernel);
+std::string specialization_name(detect_kernel kernel);
+
+/**
+ * @brief with --specialize, picks the specialized kernels for the frames of
+ * a video and stores them in the parameters; the stages without a
+ * matching instantiation keep the generic kernels. To be called once the
+ * size of the frames is known (after use_gray_frames).
+ *
+ * @param params parameters of the computation
+ * @param cols width of the frames
+ */
+void use_specialized_kernels(pipeline_params &params, int cols);
+
+#endif
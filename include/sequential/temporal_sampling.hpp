@@ -0,0 +1,131 @@
+#ifndef TEMPORAL_SAMPLING_HPP
+#define TEMPORAL_SAMPLING_HPP
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <utility>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+
+
+/**
+ * @brief moves a video to a frame, opening it if needed. Seeking decodes
+ * from the keyframe before the target, so it's exact with the usual
+ * backends; if the position is off, the video is read up to the frame.
+ *
+ * @param cap the video
+ * @param path path of the video
+ * @param index index of the frame to move to
+ * @return false if the video can't be opened
+ */
+bool seek_frame(cv::VideoCapture &cap, const std::string &path, size_t index);
+
+/**
+ * @brief skips frames of a video with grab, i.e. without retrieving them
+ * (which also skips decoding with the backends that decode lazily)
+ *
+ * @return the number of frames skipped (less than 'n' at the end of the video)
+ */
+size_t skip_frames(cv::VideoCapture &cap, size_t n);
+
+
+/**
+ * @brief temporal subsampling: only one frame every 'stride' is processed
+ * by the readers (the samples), the results of the frames in between are
+ * filled in here, in frame order.
+ *
+ * If two consecutive samples have the same result, the frames between
+ * them get it too. If the result flips, the frames between them are read
+ * again (from a VideoCapture of the sampler, moved there with seek_frame)
+ * and processed one by one until the first one with the new result: the
+ * frames after it get the new result. The frames after the last sample
+ * are all processed. So the results are the same as processing every
+ * frame as long as the runs of frames with and without motion are at
+ * least 'stride' frames long.
+ *
+ * The samples are queued and handled by a thread of the sampler, which
+ * also calls 'emit': sample is called where the results are put in order
+ * (e.g. under the lock of a reorder buffer), and must not make the workers
+ * wait while the frames around a transition are read again.
+ */
+class temporal_sampler {
+private:
+    std::string path;
+    cv::Mat *background;
+    pipeline_params params;
+    std::function<void(size_t, bool)> emit;
+
+    // for reading the frames again
+    std::unique_ptr<cv::VideoCapture> cap;
+    cv::Mat frame_rgb, frame_smooth;
+
+    // samples waiting for the thread of the sampler, in frame order
+    std::mutex m;
+    std::condition_variable not_empty;
+    std::deque<std::pair<size_t, bool>> samples;
+    bool no_more_samples = false;
+    std::thread refiner;
+
+    bool has_last = false;      // whether a sample was handled
+    size_t last = 0;            // index of the last sample
+    bool last_motion = false;   // result of the last sample
+
+    size_t n_samples = 0;       // samples received
+    size_t n_refined = 0;       // frames processed here
+    size_t n_filled = 0;        // frames not processed whose result was filled in
+    size_t n_filled_motion = 0; // frames processed or filled in here with motion
+
+    // emits the result of a frame that isn't a sample
+    void fill(size_t index, bool motion);
+
+    // processes the next frame of 'cap' (false if the video is over)
+    bool process_next(bool &motion);
+
+    // emits the results of the frames since the previous sample, and then
+    // the one of the sample
+    void refine(size_t index, bool motion);
+
+    // body of the thread: handles the samples until finish
+    void run();
+
+public:
+    /**
+     * @brief constructor
+     *
+     * @param path path of the video
+     * @param background the background image
+     * @param params parameters of the computation
+     * @param emit callback receiving (frame index, motion) for every frame, in order
+     */
+    temporal_sampler(const std::string &path, cv::Mat *background,
+                     const pipeline_params &params,
+                     std::function<void(size_t, bool)> emit);
+
+    // waits for the thread of the sampler (if finish wasn't called)
+    ~temporal_sampler();
+
+    /**
+     * @brief takes the result of a sample, to be called in frame order;
+     * the thread of the sampler emits the results of the frames since the
+     * previous sample, and then the one of the sample
+     */
+    void sample(size_t index, bool motion);
+
+    // waits until all the samples are handled and processes the frames
+    // after the last one, to be called at the end
+    void finish();
+
+    // number of frames with motion emitted for frames that aren't samples
+    size_t filled_motion_frames() const { return n_filled_motion; }
+
+    // prints how many frames were sampled, processed again and filled in
+    void report() const;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef VIDEO_STATE_HPP
+#define VIDEO_STATE_HPP
+
+#include <memory>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/roi_mask.hpp"
+#include "sequential/pyramid.hpp"
+#include "sequential/running_background.hpp"
+#include "sequential/incremental.hpp"
+#include "sequential/motion_map.hpp"
+
+
+/**
+ * @brief what the detection of a video needs besides its frames: the
+ * background and the objects the options ask for (region of interest,
+ * pyramid, running background, previous frames of the incremental
+ * detection, heatmap), set up from the first frame in the order they
+ * depend on each other and attached to the parameters of the video. Used
+ * by the executables and by the motion_detector engine, one per video.
+ */
+class video_state {
+public:
+    cv::Mat *background;
+    std::unique_ptr<roi_mask> roi;
+    std::unique_ptr<pyramid_detector> pyramid;
+    std::unique_ptr<running_background> running_bg;
+    std::unique_ptr<incremental_detector> incremental;
+    std::unique_ptr<motion_heatmap> heatmap;
+
+    /**
+     * @brief constructor
+     *
+     * @param params parameters of the video (use_gray_frames already
+     * applied), to which the objects are attached: they must not outlive
+     * this object
+     * @param first_frame first frame of the video (modified: converted into
+     * the background)
+     * @param max_threads max threads processing frames at the same time
+     * (see running_background)
+     */
+    video_state(pipeline_params &params, cv::Mat &first_frame, int max_threads);
+
+    // destructor
+    ~video_state() { delete background; }
+
+    video_state(const video_state &) = delete;
+    video_state &operator=(const video_state &) = delete;
+
+    // prints the statistics of the options that have them (pyramid,
+    // incremental detection, running background) and writes the heatmap
+    void report() const;
+};
+
+#endif
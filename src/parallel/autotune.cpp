@@ -0,0 +1,232 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/autotune.hpp"
+#include "sequential/simd_funcs.hpp"
+#include "auxiliary/timer.hpp"
+#include "auxiliary/tile_pool.hpp"
+
+
+using namespace std;
+
+
+string profile_key(int rows, int cols, int budget, const pipeline_params &params) {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    // the options choosing the kernels, which have different costs per stage
+    vector<string> kernels;
+    if (params.simd)
+        kernels.push_back(string("simd-") + simd_isa_name(active_simd_isa()));
+    if (params.fused)
+        kernels.push_back("fused");
+    if (params.radius != 1)
+        kernels.push_back("radius-" + to_string(params.radius));
+    if (params.specialized_smooth != nullptr || params.specialized_detect != nullptr)
+        kernels.push_back("specialized");
+    if (params.roi != nullptr)
+        kernels.push_back("roi");
+    if (params.early_exit)
+        kernels.push_back("early-exit");
+    if (params.bg_shift > 0)
+        kernels.push_back("adaptive-bg");
+    if (params.pyramid_factor > 1)
+        kernels.push_back("pyramid-" + to_string(params.pyramid_factor));
+    if (params.block_size > 0)
+        kernels.push_back("incremental-" + to_string(params.block_size));
+    if (params.gray_frames)
+        kernels.push_back("gray");
+
+    ostringstream key;
+    key << host << ' ' << cols << 'x' << rows << ' ' << budget << ' ';
+    if (kernels.empty())
+        key << "generic";
+    for (size_t k = 0; k < kernels.size(); k++)
+        key << (k > 0 ? "," : "") << kernels[k];
+    return key.str();
+}
+
+
+// splits a line of the profiles file into key (first 4 fields) and profile
+// (the lines of older versions, without the kernels, don't match any key)
+static bool parse_profile_line(const string &line, string &key, farm_profile &profile) {
+    istringstream in(line);
+    string host, resolution, budget, kernels;
+    if (!(in >> host >> resolution >> budget >> kernels >> profile.n_workers
+             >> profile.nw_rgb2gray >> profile.nw_smooth >> profile.nw_motion_detect))
+        return false;
+    key = host + ' ' + resolution + ' ' + budget + ' ' + kernels;
+    return true;
+}
+
+
+bool load_profile(const string &path, const string &key, farm_profile &profile) {
+    ifstream in(path);
+    string line, line_key;
+    farm_profile p;
+    while (getline(in, line))
+        if (parse_profile_line(line, line_key, p) && line_key == key) {
+            profile = p;
+            return true;
+        }
+    return false;
+}
+
+
+void save_profile(const string &path, const string &key, const farm_profile &profile) {
+    // keep the profiles of the other keys
+    vector<string> lines;
+    {
+        ifstream in(path);
+        string line, line_key;
+        farm_profile p;
+        while (getline(in, line))
+            if (!parse_profile_line(line, line_key, p) || line_key != key)
+                lines.push_back(line);
+    }
+    ostringstream line;
+    line << key << ' ' << profile.n_workers << ' ' << profile.nw_rgb2gray << ' '
+         << profile.nw_smooth << ' ' << profile.nw_motion_detect;
+    lines.push_back(line.str());
+
+    ofstream out(path, ios::trunc);
+    for (auto &l : lines)
+        out << l << '\n';
+    if (!out)
+        cerr << "Cannot save the profile in " << path << endl;
+}
+
+
+farm_profile autotune_farm(cv::VideoCapture &cap, cv::Mat *background,
+                           pipeline_params params, int budget, int decoders,
+                           size_t &n_frames,
+                           const function<void(size_t, bool)> &emit) {
+    int rows = background->rows;
+    int cols = background->cols;
+    budget = max(budget, 1);
+
+    // numbers of workers per stage to try: powers of 2 up to the budget
+    vector<int> candidates;
+    for (int nw = 1; nw < budget; nw *= 2)
+        candidates.push_back(nw);
+    candidates.push_back(budget);
+
+    // the candidates take turns on the frames, so they all see similar content
+    vector<stage_times> totals(candidates.size());
+    vector<long> n_measured(candidates.size(), 0);
+    long decode_us = 0;
+    size_t n_read = 0;
+    cv::Mat frame_rgb(rows, cols, CV_8UC3);
+    cv::Mat frame_smooth(rows, cols, CV_8UC1);
+    for (; n_read < n_frames; n_read++) {
+        long t_decode = measure_us([&]() { cap >> frame_rgb; });
+        if (frame_rgb.empty())
+            break;
+        decode_us += t_decode;
+
+        size_t c = n_read % candidates.size();
+        params.nw_rgb2gray = params.nw_smooth = params.nw_motion_detect = candidates[c];
+        stage_times times;
+        bool motion = frame_has_motion_timed(background, &frame_rgb, &frame_smooth,
+                                             params, times);
+        totals[c].rgb2gray += times.rgb2gray;
+        totals[c].smooth += times.smooth;
+        totals[c].motion_detect += times.motion_detect;
+        n_measured[c]++;
+        emit(n_read + 1, motion);   // frame 0 is the background
+    }
+    n_frames = n_read;
+
+    farm_profile best;
+    if (n_read == 0)
+        return best;
+
+    // average time of each stage with each candidate (only the measured ones)
+    vector<int> measured;
+    vector<double> t_gray, t_smooth, t_detect;
+    for (size_t c = 0; c < candidates.size(); c++) {
+        if (n_measured[c] == 0)
+            continue;
+        measured.push_back(candidates[c]);
+        t_gray.push_back(double(totals[c].rgb2gray) / n_measured[c]);
+        t_smooth.push_back(double(totals[c].smooth) / n_measured[c]);
+        t_detect.push_back(double(totals[c].motion_detect) / n_measured[c]);
+    }
+    double decode_rate = decode_us > 0 ? 1e6 * n_read / decode_us * decoders : 1e12;
+
+    // fastest number of workers for a stage, using at most 'cores' threads
+    auto best_nw = [&](const vector<double> &t, int cores, double &time) {
+        int nw = measured[0];
+        time = t[0];
+        for (size_t c = 1; c < measured.size() && measured[c] <= cores; c++)
+            if (t[c] < time) {
+                time = t[c];
+                nw = measured[c];
+            }
+        return nw;
+    };
+
+    // W workers get budget / W threads per frame each; the throughput is
+    // limited by the decoders too. Fewer workers (i.e. lower latency) are
+    // preferred unless more give a clear gain.
+    double best_throughput = 0;
+    for (int w = 1; w <= budget; w++) {
+        int cores = max(budget / w, 1);
+        double tg, ts, td;
+        farm_profile p;
+        p.n_workers = w;
+        p.nw_rgb2gray = best_nw(t_gray, cores, tg);
+        p.nw_smooth = best_nw(t_smooth, cores, ts);
+        p.nw_motion_detect = best_nw(t_detect, cores, td);
+        // a single kernel, with the workers of the slowest stage
+        if (params.fused || params.roi != nullptr)
+            p.nw_rgb2gray = p.nw_smooth = p.nw_motion_detect;
+        double service = max(tg + ts + td, 1.0);
+        double throughput = min(decode_rate, w * 1e6 / service);
+        if (throughput > best_throughput * 1.02) {
+            best_throughput = throughput;
+            best = p;
+        }
+    }
+
+    cout << "Autotuning on " << n_read << " frames: decode " << decode_rate
+         << " frames/s, stages with 1 worker " << t_gray[0] << " + " << t_smooth[0]
+         << " + " << t_detect[0] << " us" << endl;
+    return best;
+}
+
+
+size_t apply_autotune(const cli_options &args, cv::VideoCapture &cap,
+                      cv::Mat *background, int &n_workers, pipeline_params &params,
+                      const function<void(size_t, bool)> &emit) {
+    if (!args.has("autotune"))
+        return 0;
+
+    string path = args.get("profiles", "autotune_profiles.txt");
+    string key = profile_key(background->rows, background->cols, tile_pool::budget(), params);
+    farm_profile profile;
+    size_t n_frames = 0;
+    if (load_profile(path, key, profile))
+        cout << "Using the profile saved for " << key << endl;
+    else {
+        n_frames = max(args.get_int("autotune", 200), 1);
+        profile = autotune_farm(cap, background, params, tile_pool::budget(),
+                                max(args.get_int("segments", 1), 1), n_frames, emit);
+        if (n_frames > 0)
+            save_profile(path, key, profile);
+    }
+
+    n_workers = max(profile.n_workers, 1);
+    params.nw_rgb2gray = profile.nw_rgb2gray;
+    params.nw_smooth = profile.nw_smooth;
+    params.nw_motion_detect = profile.nw_motion_detect;
+    cout << "Farm setup: " << n_workers << " workers, " << params.nw_rgb2gray << " / "
+         << params.nw_smooth << " / " << params.nw_motion_detect
+         << " workers for rgb2gray / smoothing / motion detection" << endl;
+    return n_frames;
+}
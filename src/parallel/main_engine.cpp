@@ -0,0 +1,93 @@
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/motion_detector.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/mapped_video.hpp"
+#include "auxiliary/timer.hpp"
+#include "auxiliary/cli.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+
+
+using namespace std;
+
+/*
+ * Example of use of the motion_detector engine: the program reads the
+ * video by itself, in a pool of frames that it owns, and pushes the frames
+ * to the engine, which gives them back with their results.
+ */
+
+// usage of the program
+static void print_usage(const string prog_name) {
+    cout << "Usage: " << prog_name << " <video_path> <seq|threads|ff> [<number of threads>] "
+         << "[<n workers rgb2gray>] [<n workers smoothing] [<n workers motion_detect>]" << endl
+         << "Processes the video with the motion_detector engine and the chosen backend "
+         << "(default 1 thread)." << endl;
+    print_pipeline_options();
+    cout << "  --max-in-flight=<n>\tmax frames processed at the same time "
+         << "(default 4 * number of threads, 1 for seq)" << endl
+         << "  --huge-pages\tback the frame buffers with transparent huge pages" << endl;
+}
+
+
+int main(int argc, char** argv) {
+    cli_options args(argc, argv);
+    detector_backend backend;
+    if (args.n_positional() < 3 || args.n_positional() > 7 ||
+        !parse_detector_backend(args[2], backend)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    int n_workers = args.positive_int(3, 1);
+    pipeline_params params = parse_pipeline_params(args, 4);
+
+    // the threads of the engine call the kernels (the calling thread with
+    // the sequential backend)
+    tile_pool::configure(args.get_int("budget", 0),
+                         backend == detector_backend::sequential ? 1 : n_workers);
+    trace_session trace(args.has("trace"), args.get("trace"));
+
+    timer<std::chrono::milliseconds> tc("Overall completion time");
+
+    // read video (Y4M and raw YUV files are mapped in memory)
+    std::unique_ptr<cv::VideoCapture> cap = open_video(args[1], params);
+    int rows = cap->get(cv::CAP_PROP_FRAME_HEIGHT);
+    int cols = cap->get(cv::CAP_PROP_FRAME_WIDTH);
+    cv::Mat background(rows, cols, CV_8UC3);
+    *cap >> background;
+
+    // the frames go back to the pool once their results are delivered (the
+    // frames of mapped videos are views of the file, with no buffers)
+    bool print_frames = args.has("print-frames");
+    std::unique_ptr<frame_pool> pool;
+    motion_detector detector(background, params, backend, n_workers,
+                             [&](size_t n_frame, bool motion, cv::Mat *frame) {
+        if (motion && print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+        pool->release(frame);
+    }, args.get_int("max-in-flight", 0));
+    pool.reset(new frame_pool(rows, cols, params.gray_frames ? CV_8UC1 : CV_8UC3,
+                              detector.max_in_flight() + 1, args.has("huge-pages"),
+                              params.gray_frames));
+    cout << "Backend: " << detector_backend_name(detector.backend()) << endl;
+
+    while (true) {
+        cv::Mat *frame = pool->acquire();
+        *cap >> *frame;
+        if (frame->empty()) {
+            pool->release(frame);
+            break;
+        }
+        detector.submit(frame);
+    }
+    detector.flush();
+    cap->release();
+
+    detector.report();
+    cout << "Number of frames with detected motion: " << detector.motion_frames() << endl;
+    return 0;
+}
@@ -6,119 +6,395 @@
 #include "opencv2/opencv.hpp"
 
 #include "sequential/sequential_funcs.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/video_state.hpp"
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+#include "parallel/autotune.hpp"
 #include "parallel/parallel_funcs.hpp"
+#include "parallel/segmented_decoding.hpp"
+#include "parallel/batch_sizer.hpp"
 #include "auxiliary/timer.hpp"
+#include "auxiliary/cli.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
 
 
 using namespace std;
 using namespace ff;
 
-struct FrameWithMotionFlag {
-    cv::Mat *frame;
-    bool motion;
-};
+/*
+ * Tasks are batches of consecutive frames (frame_batch, see
+ * parallel_funcs.hpp). The frames come from a frame_pool and the batches
+ * go back to the Emitter through the feedback channel (Collector ->
+ * Emitter) once their results have been emitted in order. The Emitter
+ * keeps at most batches.size() batches in flight: it is invoked once at
+ * startup to fill the farm, then once for every batch that comes back.
+ *
+ * With a single segment the Emitter decodes the video itself; otherwise
+ * a segmented_decoder decodes the segments in parallel into the 'ready'
+ * queue and the Emitter just forwards the batches decoded.
+ *
+ * With the frame pool split per NUMA node, every batch takes its frames
+ * from the part of a node and the Emitter sends it to the workers of that
+ * node, in turn.
+ */
+struct Emitter : ff_monode_t<frame_batch> {
+    cv::VideoCapture &cap;
+    frame_pool *pool;
+    std::vector<frame_batch> batches;
+    std::vector<frame_batch *> free_batches;
+    std::vector<std::vector<int>> part_workers;     // workers near each part of the pool
+    std::vector<size_t> next_worker;                // of each part, round-robin
+    batch_sizer *sizer;     // size of the batches (see Comp)
+    size_t n_frame, seq;
+    bool video_finished;
+
+    // segmented decoding
+    std::string path;
+    std::vector<video_segment> segments;
+    std::unique_ptr<segmented_decoder> decoder;
+    shared_queue<frame_batch> free_queue, ready;
+    size_t in_flight;
 
-struct Emitter : ff_node_t<FrameWithMotionFlag> {
-    cv::VideoCapture cap;
-    int rows, cols;
+    Emitter(cv::VideoCapture &cap, frame_pool *pool, size_t n_batches,
+            batch_sizer *sizer, int n_workers, const std::string &path,
+            const std::vector<video_segment> &segments) :
+            cap(cap), pool(pool), batches(n_batches), part_workers(pool->n_parts()),
+            next_worker(pool->n_parts(), 0), sizer(sizer),
+            n_frame(segments[0].first), seq(0), video_finished(false), path(path),
+            segments(segments), free_queue(n_batches), ready(n_batches), in_flight(0) {
+        for (int i = 0; i < n_workers; i++)
+            part_workers[pool->part_of_worker(i)].push_back(i);
+        for (size_t i = 0; i < n_batches; i++) {
+            batches[i].frames.reserve(sizer->get_max_size());
+            batches[i].part = pool->part_of_worker(i % n_workers);
+            free_batches.push_back(&batches[i]);
+        }
+    }
 
-    Emitter(cv::VideoCapture cap) : cap(cap) {
-        rows = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-        cols = cap.get(cv::CAP_PROP_FRAME_WIDTH);
+    // sends a batch to the workers near its frames
+    void send(frame_batch *batch) {
+        if (pool->n_parts() == 1) {
+            ff_send_out(batch);
+            return;
+        }
+        const std::vector<int> &workers = part_workers[batch->part];
+        ff_send_out_to(batch, workers[next_worker[batch->part]++ % workers.size()]);
     }
 
-    FrameWithMotionFlag *svc(FrameWithMotionFlag *input) {
-        cv::Mat *frame = new cv::Mat(rows, cols, CV_8UC3);
-        cap >> *frame;
-        if (frame->empty()) {
-            cap.release();
-            cout << "Finished pushing frames" << endl;
+    int svc_init() {
+        placement::pin_self(thread_role::decoder, 0);
+        tracer::name_thread("emitter");
+        if (segments.size() == 1)
+            return 0;
+        cap.release();
+        for (frame_batch *batch : free_batches)
+            free_queue.push(batch);
+        free_batches.clear();
+        decoder.reset(new segmented_decoder(path, segments, pool, &free_queue, sizer,
+                [this](frame_batch *batch) { ready.push(batch); },
+                [this]() { ready.no_more_pushes(); }));
+        return 0;
+    }
+
+    frame_batch *svc(frame_batch *input) {
+        if (decoder)
+            return forward_decoded(input);
+
+        // a processed batch came back: recycle it and its frames
+        if (input != nullptr) {
+            for (cv::Mat *frame : input->frames)
+                pool->release(frame);
+            free_batches.push_back(input);
+        }
+
+        // send new batches while there are free ones
+        while (!video_finished && !free_batches.empty()) {
+            frame_batch *batch = free_batches.back();
+            batch->frames.clear();
+            batch->first_index = n_frame;
+            batch->stride = segments[0].stride;
+            size_t batch_size = sizer->next();
+            while (batch->frames.size() < batch_size) {
+                cv::Mat *frame = pool->acquire(batch->part);
+                {
+                    trace_span span(trace_stage::decode, n_frame);
+                    cap >> *frame;
+                }
+                if (frame->empty()) {
+                    pool->release(frame);
+                    cap.release();
+                    video_finished = true;
+                    cout << "Finished pushing frames" << endl;
+                    break;
+                }
+                batch->frames.push_back(frame);
+                n_frame++;
+                n_frame += skip_frames(cap, segments[0].stride - 1);
+            }
+            if (batch->frames.empty())
+                break;
+            free_batches.pop_back();
+            batch->segment = 0;
+            batch->seq = seq++;
+            send(batch);
+        }
+
+        if (video_finished && free_batches.size() == batches.size())
+            return EOS;
+        return GO_ON;
+    }
+
+    // sends the batches decoded by the segmented_decoder while there are
+    // less than batches.size() in flight
+    frame_batch *forward_decoded(frame_batch *input) {
+        if (input != nullptr) {
+            for (cv::Mat *frame : input->frames)
+                pool->release(frame);
+            free_queue.push(input);
+            in_flight--;
+        }
+
+        while (!video_finished && in_flight < batches.size()) {
+            frame_batch *batch = ready.pop();   // waits for the decoders
+            if (batch == nullptr) {
+                video_finished = true;
+                cout << "Finished pushing frames" << endl;
+                break;
+            }
+            in_flight++;
+            send(batch);
+        }
+
+        if (video_finished && in_flight == 0) {
+            decoder->join();
             return EOS;
         }
-        return new FrameWithMotionFlag{frame, false};
+        return GO_ON;
     }
 };
 
-struct Comp : ff_node_t<FrameWithMotionFlag> {
-    cv::Mat *background, *frame_gray, *frame_smooth;
-    int nw_rgb2gray, nw_smooth, nw_motion;
-    unsigned int min_diff;
-    float perc;
-
-    Comp(cv::Mat *background, int nw_rgb2gray, int nw_smooth, int nw_motion,
-         unsigned int min_diff, float perc) :
-            background(background), nw_rgb2gray(nw_rgb2gray),
-            nw_smooth(nw_smooth), nw_motion(nw_motion), min_diff(min_diff),
-            perc(perc) {
+/*
+ * With --batch=auto, every Comp reports to the batch_sizer read by the
+ * Emitter the time between the end of a task and the start of the next one
+ * as synchronization, and the time spent on the task as service (the
+ * queues of the farm can't be inspected, so the time spent waiting for the
+ * Emitter counts as synchronization too).
+ */
+struct Comp : ff_node_t<frame_batch> {
+    cv::Mat *background, *frame_smooth;
+    pipeline_params params;
+    batch_sizer *sizer;
+    std::chrono::steady_clock::time_point last_done;
+    bool has_done = false;      // whether last_done is set
+
+    Comp(cv::Mat *background, const pipeline_params &params, batch_sizer *sizer) :
+            background(background), params(params), sizer(sizer) {
                 int rows = background->rows;
                 int cols = background->cols;
                 frame_smooth = new cv::Mat(rows, cols, CV_8UC1);
             }
 
-    FrameWithMotionFlag *svc(FrameWithMotionFlag *frame_rgb) {
-        frame_gray = rgb2gray(frame_rgb->frame, nw_rgb2gray);
-        smooth(frame_gray, frame_smooth, nw_smooth);
-        if (motion_detect(background, frame_smooth, min_diff, perc, nw_motion))
-            frame_rgb->motion = true;
-        return frame_rgb;
+    ~Comp() { delete frame_smooth; }
+
+    int svc_init() {
+        placement::pin_self(thread_role::worker, get_my_id());
+        tracer::name_thread("worker " + std::to_string(get_my_id()));
+        return 0;
+    }
+
+    frame_batch *svc(frame_batch *batch) {
+        auto start = std::chrono::steady_clock::now();
+        batch->motion.resize(batch->frames.size());
+        if (params.cell_size > 0)
+            batch->maps.resize(batch->frames.size());
+        for (size_t k = 0; k < batch->frames.size(); k++) {
+            tracer::set_frame(batch->first_index + k * batch->stride);
+            batch->motion[k] = frame_has_motion(background, batch->frames[k],
+                                                frame_smooth, params,
+                                                params.cell_size > 0 ? &batch->maps[k] : nullptr);
+        }
+        auto done = std::chrono::steady_clock::now();
+
+        sizer->record(has_done ? std::chrono::nanoseconds(start - last_done).count() : 0,
+                      std::chrono::nanoseconds(done - start).count());
+        last_done = done;
+        has_done = true;
+        return batch;
     }
 };
 
-struct Collector : ff_minode_t<FrameWithMotionFlag> {
+/*
+ * The Collector puts the batches back in frame order with a reorder buffer
+ * per segment, as big as the max number of batches in flight, so it never
+ * has to wait for room. Batches are sent back to the Emitter once emitted.
+ * With --heatmap it also adds the maps of the frames to the heatmap, as the
+ * batches arrive.
+ */
+struct Collector : ff_minode_t<frame_batch> {
     int n_motion_frames;
+    bool print_frames;
+    temporal_sampler *sampler;  // with --sample, fills in the frames not sampled
+    motion_heatmap *heatmap;    // with --heatmap, where the motion is
+    segmented_results results;
 
-    Collector() : n_motion_frames(0) {}
+    Collector(const std::vector<video_segment> &segments, size_t max_in_flight,
+              bool print_frames) :
+        n_motion_frames(0), print_frames(print_frames), sampler(nullptr), heatmap(nullptr),
+        results(segments, max_in_flight, [this](size_t n_frame, bool motion) {
+            if (sampler != nullptr)
+                sampler->sample(n_frame, motion);
+            else
+                count(n_frame, motion);
+        }, [this](frame_batch *batch) { ff_send_out(batch); }) {}
 
-    FrameWithMotionFlag *svc(FrameWithMotionFlag *frame) {
-        if (frame->motion)
-            n_motion_frames++;
+    // counts (and prints) the frames with motion, in frame order
+    void count(size_t n_frame, bool motion) {
+        if (!motion)
+            return;
+        n_motion_frames++;
+        if (print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+    }
+
+    int svc_init() {
+        placement::pin_self(thread_role::collector, 0);
+        tracer::name_thread("collector");
+        return 0;
+    }
+
+    frame_batch *svc(frame_batch *batch) {
+        add_to_heatmap(heatmap, *batch);
+        results.insert(batch);
         return GO_ON;
     }
 };
 
 
 int main(int argc, char **argv) {
-    if (argc < 3 || argc > 6) {
+    cli_options args(argc, argv);
+    if (args.n_positional() < 3 || args.n_positional() > 6 || atoi(args[2].c_str()) <= 0) {
         print_usage_parallel_prog(argv[0]);
         return -1;
     }
-    int nw_rgb2gray = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1;
-    int nw_smooth = argc > 4 && atoi(argv[4]) > 0 ? atoi(argv[4]) : 1;
-    int nw_motion = argc > 5 && atoi(argv[5]) > 0 ? atoi(argv[5]) : 1;
+    pipeline_params params = parse_pipeline_params(args, 3);
 
+    // the workers of the farm call the kernels, the rest of the budget is
+    // for the intra-frame pool they share
+    int n_workers = atoi(args[2].c_str());
+    tile_pool::configure(args.get_int("budget", 0), args.has("autotune") ? 1 : n_workers);
+    // with --trace, where the time goes (written at the end)
+    trace_session trace(args.has("trace"), args.get("trace"));
     // timer for the overall completion time
     timer<chrono::milliseconds> tc("Overall completion time");
 
-    // process background
-    cv::VideoCapture cap(argv[1]);
-    int rows = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-    int cols = cap.get(cv::CAP_PROP_FRAME_WIDTH);
-    cv::Mat *background_rgb = new cv::Mat(rows, cols, CV_8UC3);
-    cap >> *background_rgb;
-    cv::Mat *background_gray = rgb2gray(background_rgb, nw_rgb2gray);
-    cv::Mat *background = new cv::Mat(rows, cols, CV_8UC1);
-    smooth(background_gray, background, nw_smooth);
-    delete background_rgb, background_gray;
-
-    // create workers
+    // read video (Y4M and raw YUV files are mapped in memory)
+    std::unique_ptr<cv::VideoCapture> cap = open_video(args[1], params);
+    int rows = cap->get(cv::CAP_PROP_FRAME_HEIGHT);
+    int cols = cap->get(cv::CAP_PROP_FRAME_WIDTH);
+    // take and process background image (i.e. first frame), with what the
+    // options ask for (the heatmap is filled by the collector; autotuning
+    // may pick more workers, but never more than the budget)
+    cv::Mat background_rgb(rows, cols, CV_8UC3);
+    *cap >> background_rgb;
+    video_state video(params, background_rgb, max(n_workers, tile_pool::budget()));
+    cv::Mat *background = video.background;
+
+    // with --autotune, the first frames are processed here while choosing
+    // the setup of the farm
+    bool print_frames = args.has("print-frames");
+    int n_tuned_motion_frames = 0;
+    size_t n_tuned = apply_autotune(args, *cap, background, n_workers, params,
+                                    [&](size_t n_frame, bool motion) {
+        if (motion)
+            n_tuned_motion_frames++;
+        if (motion && print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+    });
+
+    // frames left, split in segments decoded in parallel
+    std::vector<video_segment> segments = split_video(*cap, args.get_int("segments", 1),
+                                                      args.get_int("gop", 0), 1 + n_tuned);
+    for (auto &segment : segments)
+        segment.stride = params.stride;
+
+    // with --pin, the nodes of the farm pinned to cores (instead of the
+    // default mapping of FastFlow) and the frames allocated near the workers,
+    // planned once the number of workers is known (the intra-frame pool is
+    // already running)
+    if (args.has("pin") && placement::configure(args.get("pin"), segments.size(), n_workers,
+                                                1))
+        tile_pool::get().place();
+
+    // create workers (with --batch=auto, they choose the size of the batches)
+    bool adaptive_batch = args.get("batch") == "auto";
+    batch_sizer sizer(args.get_int("batch", 1), args.get_int("max-batch", 16),
+                      adaptive_batch);
     std::vector<std::unique_ptr<ff_node>> workers;
-    for (int i = 0; i < atoi(argv[2]); i++)
-        workers.push_back(make_unique<Comp>(
-            background, nw_rgb2gray, nw_smooth, nw_motion, 10, 0.05)
-        );
+    for (int i = 0; i < n_workers; i++)
+        workers.push_back(make_unique<Comp>(background, params, &sizer));
     
+    // batches (and their frames, as many as the largest batch) recycled
+    // through the feedback channel; with the workers on several NUMA nodes,
+    // the batches of a node take their frames from its part of the pool
+    // (see Emitter)
+    size_t n_batches = max(args.get_int("pool-size", 4 * n_workers), 1);
+    std::vector<int> node_workers = placement::workers_per_node();
+    std::vector<size_t> part_frames(max<size_t>(node_workers.size(), 1), 0);
+    for (size_t i = 0; i < n_batches; i++)
+        part_frames[node_workers.empty() ? 0 : placement::worker_part(i % n_workers)] +=
+            sizer.get_max_size();
+    frame_pool pool(rows, cols, params.gray_frames ? CV_8UC1 : CV_8UC3, part_frames,
+                    args.has("huge-pages"), params.gray_frames);
+    // with --trace, the frames in flight (the FastFlow queues can't be
+    // inspected, all the frames not free are in them or being processed)
+    trace_watch frames_watch("frames in flight", [&]() {
+        return pool.size() - pool.available();
+    });
+
     // create farm
-    ff_Farm<FrameWithMotionFlag> farm(std::move(workers));
-    Emitter emitter(cap);
-    Collector collector;    // will contain the result
+    ff_Farm<frame_batch> farm(std::move(workers));
+    Emitter emitter(*cap, &pool, n_batches, &sizer, n_workers, args[1], segments);
+    Collector collector(segments, n_batches, print_frames);  // will contain the result
     farm.add_emitter(emitter);
     farm.add_collector(collector);
+    collector.heatmap = video.heatmap.get();
+
+    // with --sample, the frames not sampled are filled in by the thread of
+    // the sampler, which counts them through the collector
+    std::unique_ptr<temporal_sampler> sampler;
+    if (params.stride > 1) {
+        sampler.reset(new temporal_sampler(args[1], background, params,
+                [&collector](size_t n_frame, bool motion) {
+            collector.count(n_frame, motion);
+        }));
+        collector.sampler = sampler.get();
+    }
+    farm.wrap_around();     // Collector -> Emitter feedback
+    if (placement::enabled())
+        farm.no_mapping();
 
     // run
     farm.run_and_wait_end();
+    collector.results.flush();
+    if (sampler) {
+        sampler->finish();
+        sampler->report();
+    }
+    if (segments.size() > 1)
+        cout << "Decoded in " << segments.size() << " segments" << endl;
+    if (adaptive_batch)
+        cout << "Final batch size: " << sizer.next() << endl;
+
+    video.report();
+    placement::report();
 
     // print results    
-    cout << "Total number of motion frames: " << collector.n_motion_frames << endl;
+    cout << "Total number of motion frames: "
+         << n_tuned_motion_frames + collector.n_motion_frames << endl;
 
     return 0;
 }
@@ -0,0 +1,266 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/parallel_funcs.hpp"
+#include "parallel/shared_queue.hpp"
+#include "parallel/multi_stream.hpp"
+#include "parallel/segmented_decoding.hpp"
+#include "parallel/batch_sizer.hpp"
+#include "auxiliary/timer.hpp"
+#include "auxiliary/cli.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/video_state.hpp"
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+
+
+using namespace std;
+
+/**
+ * @brief a video processed by the multi-stream program: everything but the
+ * workers is its own (reader, background, pool of frames, batches, results
+ * and counters)
+ */
+struct video_stream {
+    string path;
+    unique_ptr<cv::VideoCapture> cap;
+    int rows = 0, cols = 0;
+    bool opened = false;
+
+    pipeline_params params;     // own copy: the video state is attached to it
+    unique_ptr<video_state> video;
+
+    video_segment segment{1, 0};
+    unique_ptr<frame_pool> pool;
+    vector<frame_batch> batches;
+    unique_ptr<shared_queue<frame_batch>> free_batches;
+    unique_ptr<segmented_results> results;
+    unique_ptr<temporal_sampler> sampler;
+
+    // results, updated in frame order (see segmented_results)
+    size_t n_frames = 0;
+    size_t n_motion_frames = 0;
+    long finish_ms = 0;         // time of the last result since the start
+};
+
+
+// usage of the multi-stream program
+static void print_usage(const string prog_name) {
+    cout << "Usage: " << prog_name << " <number of threads> <video_path> "
+         << "[<video_path> ...]" << endl
+         << "All the videos are processed at the same time by a single pool of threads." << endl;
+    print_pipeline_options();
+    cout << "  --queue-capacity=<n>\tmax frames of each video waiting in the queue "
+         << "(default max(4, 2 * number of threads / number of videos))" << endl
+         << "  --batch=<n>|auto\tframes per task (default 1); auto grows it "
+         << "while the queue overhead is significant" << endl
+         << "  --max-batch=<n>\tmax frames per task with --batch=auto (default 16)" << endl
+         << "  --huge-pages\tback the frame buffers with transparent huge pages" << endl;
+}
+
+
+int main(int argc, char** argv) {
+    cli_options args(argc, argv);
+    if (args.n_positional() < 3 || atoi(args[1].c_str()) <= 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    // the workers for rgb2gray, smoothing and motion detection are always 1,
+    // all the positional arguments after the number of workers are videos
+    pipeline_params params = parse_pipeline_params(args, args.n_positional());
+    int n_workers = atoi(args[1].c_str());
+    size_t n_streams = args.n_positional() - 2;
+    tile_pool::configure(args.get_int("budget", 0), n_workers);
+    // with --trace, where the time goes (written at the end)
+    trace_session trace(args.has("trace"), args.get("trace"));
+    // with --pin, the readers and the workers pinned to cores and the frames
+    // allocated near the workers
+    if (args.has("pin"))
+        placement::configure(args.get("pin"), n_streams, n_workers, 0);
+
+    // timer for the overall completion time
+    timer<std::chrono::milliseconds> tc("Overall completion time");
+    auto start = std::chrono::steady_clock::now();
+
+    // each video gets a queue of its own in the scheduler: when the queue
+    // is full the reader of the video waits, so no video can fill the pool.
+    // With the workers on several NUMA nodes, the frame pools and the queues
+    // are split per node (see multi_stream_scheduler)
+    size_t queue_capacity = args.get_int("queue-capacity",
+                                         max<size_t>(4, 2 * n_workers / n_streams));
+    size_t n_parts = max<size_t>(placement::worker_nodes().size(), 1);
+    multi_stream_scheduler<frame_batch> scheduler(n_streams, queue_capacity, n_parts);
+    bool adaptive_batch = args.get("batch") == "auto";
+    batch_sizer sizer(args.get_int("batch", 1), args.get_int("max-batch", 16),
+                      adaptive_batch);
+    bool print_frames = args.has("print-frames");
+    std::mutex print_lock;
+
+    // open the videos and take their backgrounds (i.e. first frames)
+    vector<unique_ptr<video_stream>> streams;
+    for (size_t s = 0; s < n_streams; s++) {
+        streams.emplace_back(new video_stream());
+        video_stream &vs = *streams.back();
+        vs.path = args[2 + s];
+        vs.params = params;
+        vs.cap = open_video(vs.path, vs.params);
+        if (!vs.cap->isOpened()) {
+            cerr << "Cannot open " << vs.path << endl;
+            continue;
+        }
+        vs.rows = vs.cap->get(cv::CAP_PROP_FRAME_HEIGHT);
+        vs.cols = vs.cap->get(cv::CAP_PROP_FRAME_WIDTH);
+
+        cv::Mat background_rgb(vs.rows, vs.cols, CV_8UC3);
+        *vs.cap >> background_rgb;
+        if (background_rgb.empty()) {
+            cerr << "Cannot read the first frame of " << vs.path << endl;
+            continue;
+        }
+        vs.params.heatmap_prefix += "_" + to_string(s);
+        vs.video.reset(new video_state(vs.params, background_rgb,
+                                       max(n_workers, tile_pool::budget())));
+        vs.opened = true;
+
+        // batches recycled between the reader and the workers: enough for a
+        // full queue, one batch per worker and the one being filled
+        size_t n_batches = queue_capacity + n_workers + 1;
+        vs.batches.resize(n_batches);
+        vs.free_batches.reset(new shared_queue<frame_batch>(n_batches));
+        // frames for a full queue, the batch being filled and one being
+        // processed (in each part of the pool): when the workers take more
+        // batches of this video, the reader waits for them to release their
+        // frames (the frames of mapped videos are views of the file, with no
+        // buffers)
+        size_t part_capacity = (queue_capacity + n_parts - 1) / n_parts;
+        vs.pool.reset(new frame_pool(vs.rows, vs.cols,
+                                     vs.params.gray_frames ? CV_8UC1 : CV_8UC3,
+                                     vector<size_t>(n_parts, (part_capacity + 2) *
+                                                             sizer.get_max_size()),
+                                     args.has("huge-pages"), vs.params.gray_frames));
+        for (size_t i = 0; i < n_batches; i++) {
+            vs.batches[i].frames.reserve(sizer.get_max_size());
+            vs.batches[i].part = vs.pool->part_of_worker(i % n_workers);
+            vs.free_batches->push(&vs.batches[i]);
+        }
+
+        // per-frame results of the video, in frame order
+        vs.segment.stride = vs.params.stride;
+        auto emit = [&, s](size_t n_frame, bool motion) {
+            video_stream &v = *streams[s];
+            v.n_frames++;
+            if (motion)
+                v.n_motion_frames++;
+            v.finish_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (motion && print_frames) {
+                std::lock_guard<std::mutex> lk(print_lock);
+                cout << "Stream " << s << ": Motion detected in frame " << n_frame << endl;
+            }
+        };
+        if (vs.params.stride > 1)
+            vs.sampler.reset(new temporal_sampler(vs.path, vs.video->background, vs.params,
+                                                  emit));
+        vs.results.reset(new segmented_results({vs.segment}, n_batches,
+                                               [&, s, emit](size_t n_frame, bool motion) {
+            if (streams[s]->sampler)
+                streams[s]->sampler->sample(n_frame, motion);
+            else
+                emit(n_frame, motion);
+        }, [&, s](frame_batch *batch) {
+            add_to_heatmap(streams[s]->video->heatmap.get(), *batch);
+            streams[s]->free_batches->push(batch);
+        }));
+    }
+
+    // with --trace, the occupancy of the queue and the frames in flight of
+    // every video
+    vector<unique_ptr<trace_watch>> watches;
+    for (size_t s = 0; s < n_streams; s++) {
+        if (!streams[s]->opened)
+            continue;
+        watches.emplace_back(new trace_watch("queue " + to_string(s), [&, s]() {
+            return scheduler.size(s);
+        }));
+        watches.emplace_back(new trace_watch("frames in flight " + to_string(s), [&, s]() {
+            return streams[s]->pool->size() - streams[s]->pool->available();
+        }));
+    }
+
+    // workers: batches of all the videos, taken round-robin by the scheduler
+    // (the frames with motion are counted per video, as their results are
+    // emitted)
+    vector<video_context> videos(n_streams);
+    for (size_t s = 0; s < n_streams; s++)
+        if (streams[s]->opened)
+            videos[s] = {streams[s]->pool.get(), streams[s]->video->background,
+                         &streams[s]->params, streams[s]->results.get()};
+    std::atomic<int> n_counted(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_workers; i++)
+        threads.push_back(std::thread(pick_and_comp<multi_stream_scheduler<frame_batch>>,
+                                      &scheduler, std::cref(videos), i,
+                                      std::ref(n_counted), &sizer));
+
+    // readers: one thread per video
+    std::vector<std::thread> readers;
+    for (size_t s = 0; s < n_streams; s++)
+        readers.push_back(std::thread([&, s]() {
+            placement::pin_self(thread_role::decoder, s);
+            tracer::name_thread("reader " + to_string(s));
+            video_stream &vs = *streams[s];
+            if (vs.opened)
+                decode_segment(*vs.cap, 0, vs.segment, vs.pool.get(), vs.free_batches.get(),
+                               &sizer, [&](frame_batch *batch) {
+                    scheduler.push(s, batch, batch->part);
+                });
+            vs.cap->release();
+            scheduler.no_more_pushes(s);
+        }));
+
+    for (auto &t : readers)
+        t.join();
+    cout << "Finished pushing frames" << endl;
+    for (auto &t : threads)
+        t.join();
+
+    // frames after the last sample, and results per video
+    size_t total_frames = 0, total_motion_frames = 0;
+    for (size_t s = 0; s < n_streams; s++) {
+        video_stream &vs = *streams[s];
+        if (vs.sampler)
+            vs.sampler->finish();
+        total_frames += vs.n_frames;
+        total_motion_frames += vs.n_motion_frames;
+        double fps = vs.finish_ms > 0 ? 1000.0 * vs.n_frames / vs.finish_ms : 0;
+        cout << "Stream " << s << " (" << vs.path << "): " << vs.n_frames << " frames, "
+             << vs.n_motion_frames << " with detected motion, finished after "
+             << vs.finish_ms << " ms (" << fps << " frames/s)" << endl;
+        if (vs.sampler)
+            vs.sampler->report();
+        if (vs.video)
+            vs.video->report();
+    }
+    if (adaptive_batch)
+        cout << "Final batch size: " << sizer.next() << endl;
+    placement::report();
+
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    cout << "Total throughput: " << (elapsed_ms > 0 ? 1000.0 * total_frames / elapsed_ms : 0)
+         << " frames/s" << endl;
+
+    // print number of motion frames
+    cout << "Number of frames with detected motion: " << total_motion_frames << endl;
+    return 0;
+}
@@ -3,63 +3,228 @@
 #include <atomic>
 #include <chrono>
 #include <queue>
+#include <memory>
+#include <mutex>
 #include "opencv2/opencv.hpp"
 
 #include "parallel/parallel_funcs.hpp"
 #include "sequential/sequential_funcs.hpp"
 #include "parallel/shared_queue.hpp"
+#include "parallel/work_stealing.hpp"
+#include "parallel/multi_stream.hpp"
+#include "parallel/segmented_decoding.hpp"
+#include "parallel/batch_sizer.hpp"
 #include "auxiliary/timer.hpp"
+#include "auxiliary/cli.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/video_state.hpp"
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+#include "parallel/autotune.hpp"
 
 
 using namespace std;
 
 int main(int argc, char** argv) {
-    if (argc < 3 || argc > 6) {
+    cli_options args(argc, argv);
+    if (args.n_positional() < 3 || args.n_positional() > 6 || atoi(args[2].c_str()) <= 0) {
         print_usage_parallel_prog(argv[0]);
         return -1;
     }
-    int nw_rgb2gray = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1;
-    int nw_smooth = argc > 4 && atoi(argv[4]) > 0 ? atoi(argv[4]) : 1;
-    int nw_motion_detect = argc > 5 && atoi(argv[5]) > 0 ? atoi(argv[5]) : 1;
+    pipeline_params params = parse_pipeline_params(args, 3);
 
+    // the workers of the farm call the kernels, the rest of the budget is
+    // for the intra-frame pool they share (when autotuning the number of
+    // workers isn't known yet: the whole budget goes to the pool, the setup
+    // chosen never uses more than the budget anyway)
+    int n_workers = atoi(args[2].c_str());
+    tile_pool::configure(args.get_int("budget", 0), args.has("autotune") ? 1 : n_workers);
+    // with --trace, where the time goes (written at the end)
+    trace_session trace(args.has("trace"), args.get("trace"));
     // timer for the overall completion time
     timer<std::chrono::milliseconds> tc("Overall completion time");
 
-    // read video
-    cv::VideoCapture cap(argv[1]);
-    int rows = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-    int cols = cap.get(cv::CAP_PROP_FRAME_WIDTH);
+    // read video (Y4M and raw YUV files are mapped in memory)
+    std::unique_ptr<cv::VideoCapture> cap = open_video(args[1], params);
+    int rows = cap->get(cv::CAP_PROP_FRAME_HEIGHT);
+    int cols = cap->get(cv::CAP_PROP_FRAME_WIDTH);
 
-    // take and process background image (i.e. frist frame)
-    cv::Mat *background_rgb = new cv::Mat(rows, cols, CV_8UC3);
-    cap >> *background_rgb;
-    cv::Mat *background_gray = rgb2gray(background_rgb, nw_rgb2gray);
-    cv::Mat *background = new cv::Mat(rows, cols, CV_8UC1);
-    smooth(background_gray, background, nw_smooth);
-    delete background_rgb, background_gray;
-
-    // shared queue for frames
-    shared_queue<cv::Mat> q;
+    // take and process background image (i.e. frist frame), with what the
+    // options ask for (the heatmap is filled as the batches are recycled;
+    // autotuning may pick more workers, but never more than the budget)
+    cv::Mat background_rgb(rows, cols, CV_8UC3);
+    *cap >> background_rgb;
+    video_state video(params, background_rgb, max(n_workers, tile_pool::budget()));
+    cv::Mat *background = video.background;
 
     // atomic variable to store the result
     std::atomic<int> n_motion_frames(0);
+    bool print_frames = args.has("print-frames");
+
+    // with --autotune, the first frames are processed here while choosing
+    // the setup of the farm
+    size_t n_tuned = apply_autotune(args, *cap, background, n_workers, params,
+                                    [&](size_t n_frame, bool motion) {
+        if (motion)
+            n_motion_frames++;
+        if (motion && print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+    });
+
+    // frames left, split in segments decoded in parallel
+    std::vector<video_segment> segments = split_video(*cap, args.get_int("segments", 1),
+                                                      args.get_int("gop", 0), 1 + n_tuned);
+    for (auto &segment : segments)
+        segment.stride = params.stride;
+
+    // with --pin, the threads pinned to cores (the main thread is the first
+    // decoder) and the frames allocated near the workers, planned once the
+    // number of workers is known (the intra-frame pool is already running)
+    if (args.has("pin") && placement::configure(args.get("pin"), segments.size(), n_workers,
+                                                0)) {
+        placement::pin_self(thread_role::decoder, 0);
+        tile_pool::get().place();
+    }
+    bool adaptive_batch = args.get("batch") == "auto";
+    batch_sizer sizer(args.get_int("batch", 1), args.get_int("max-batch", 16),
+                      adaptive_batch);
+
+    // frames recycled between the decoders and the workers: enough for a
+    // batch per worker and the ones being filled (--pool-size batches); the
+    // decoders wait for the workers to release them, so the queue holds
+    // batches only while there are frames. With the workers on several NUMA
+    // nodes, each node has a part of the pool, for its workers. The frames of
+    // mapped videos are views of the file, with no buffers
+    std::vector<int> node_workers = placement::workers_per_node();
+    if (node_workers.empty())
+        node_workers = {n_workers};
+    std::vector<size_t> part_frames;
+    for (int w : node_workers) {
+        size_t pool_batches = args.has("pool-size") ?
+                              (args.get_int("pool-size", 1) * w + n_workers - 1) / n_workers :
+                              w + segments.size();
+        part_frames.push_back(max(pool_batches, segments.size()) * sizer.get_max_size());
+    }
+    frame_pool pool(rows, cols, params.gray_frames ? CV_8UC1 : CV_8UC3, part_frames,
+                    args.has("huge-pages"), params.gray_frames);
+
+    // batches of frames go either through a shared queue (a queue per node
+    // with the pool split per node, see multi_stream_scheduler) or through a
+    // work-stealing scheduler (one deque per worker); both are bounded, the
+    // producer waits when they're full
+    size_t queue_capacity = args.get_int("queue-capacity", 4 * n_workers);
+    bool stealing = args.get("scheduler", "queue") == "steal";
+    std::unique_ptr<shared_queue<frame_batch>> q;
+    std::unique_ptr<multi_stream_scheduler<frame_batch>> node_q;
+    std::unique_ptr<work_stealing_scheduler<frame_batch>> ws;
+    if (stealing) {
+        std::vector<size_t> worker_parts;
+        for (int i = 0; i < n_workers; i++)
+            worker_parts.push_back(pool.part_of_worker(i));
+        ws.reset(new work_stealing_scheduler<frame_batch>(n_workers, queue_capacity,
+                                                          worker_parts));
+    } else if (pool.n_parts() > 1)
+        node_q.reset(new multi_stream_scheduler<frame_batch>(1, queue_capacity,
+                                                             pool.n_parts()));
+    else
+        q.reset(new shared_queue<frame_batch>(queue_capacity));
+
+    // batches recycled as well: enough for a full queue, one batch per
+    // worker and the ones being filled; each takes its frames from the part
+    // of the pool of a worker, in turn
+    size_t n_batches = (stealing ? ws->get_capacity() :
+                        node_q ? node_q->get_capacity() : q->get_capacity()) +
+                       n_workers + segments.size();
+    std::vector<frame_batch> batches(n_batches);
+    shared_queue<frame_batch> free_batches(n_batches);
+    for (size_t i = 0; i < n_batches; i++) {
+        batches[i].frames.reserve(sizer.get_max_size());
+        batches[i].part = pool.part_of_worker(i % n_workers);
+        free_batches.push(&batches[i]);
+    }
+    // with --trace, the occupancy of the queue and the frames in flight
+    trace_watch queue_watch("queue", [&]() {
+        return stealing ? ws->size() : node_q ? node_q->size(0) : q->size();
+    });
+    trace_watch frames_watch("frames in flight", [&]() {
+        return pool.size() - pool.available();
+    });
+
+    // per-frame results, in frame order (frames are numbered from 1, after
+    // the background); batches in flight are at most n_batches, so the
+    // reorder buffers never have to wait
+    auto print_frame = [&](size_t n_frame, bool motion) {
+        if (motion && print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+    };
+    // with --sample, only the samples go through the farm (and are counted
+    // by the workers), the sampler fills in the other frames
+    std::unique_ptr<temporal_sampler> sampler;
+    if (params.stride > 1)
+        sampler.reset(new temporal_sampler(args[1], background, params, print_frame));
+    segmented_results results(segments, n_batches, [&](size_t n_frame, bool motion) {
+        if (sampler)
+            sampler->sample(n_frame, motion);
+        else
+            print_frame(n_frame, motion);
+    }, [&](frame_batch *batch) {
+        add_to_heatmap(video.heatmap.get(), *batch);
+        free_batches.push(batch);
+    });
 
     // start threads
+    std::vector<video_context> videos{{&pool, background, &params, &results}};
     std::vector<std::thread> threads;
-    for (int i = 0; i < atoi(argv[2]); i++)
-        threads.push_back(std::thread(pick_and_comp, &q, i, background,
-                                      nw_rgb2gray, nw_smooth, nw_motion_detect,
-                                      10, 0.05, std::ref(n_motion_frames)));
-
-    // put frames in the queue for elaboration
-    while (true) {
-        cv::Mat *frame_rgb = new cv::Mat(rows, cols, CV_8UC3);
-        cap >> *frame_rgb;
-        if (frame_rgb->empty())
-            break;
-        q.push(frame_rgb);
+    for (int i = 0; i < n_workers; i++) {
+        if (stealing)
+            threads.push_back(std::thread(pick_and_comp<work_stealing_scheduler<frame_batch>>,
+                                          ws.get(), std::cref(videos), i,
+                                          std::ref(n_motion_frames), &sizer));
+        else if (node_q)
+            threads.push_back(std::thread(pick_and_comp<multi_stream_scheduler<frame_batch>>,
+                                          node_q.get(), std::cref(videos), i,
+                                          std::ref(n_motion_frames), &sizer));
+        else
+            threads.push_back(std::thread(pick_and_comp<shared_queue<frame_batch>>,
+                                          q.get(), std::cref(videos), i,
+                                          std::ref(n_motion_frames), &sizer));
     }
-    q.no_more_pushes();
+
+    // put batches of frames in the queue for elaboration (the one of the
+    // node of their frames); the work-stealing deques have a single owner,
+    // so decoders of different segments take turns pushing
+    std::mutex push_lock;
+    auto push = [&](frame_batch *batch) {
+        if (node_q)
+            node_q->push(0, batch, batch->part);
+        else if (!stealing)
+            q->push(batch);
+        else if (segments.size() == 1)
+            ws->push(batch, batch->part);
+        else {
+            std::lock_guard<std::mutex> lk(push_lock);
+            ws->push(batch, batch->part);
+        }
+    };
+    if (segments.size() == 1) {
+        tracer::name_thread("decoder");
+        decode_segment(*cap, 0, segments[0], &pool, &free_batches, &sizer, push);
+    } else {
+        cap->release();
+        segmented_decoder decoder(args[1], segments, &pool, &free_batches, &sizer,
+                                  push, []() {});
+        decoder.join();
+    }
+    if (stealing)
+        ws->no_more_pushes();
+    else if (node_q)
+        node_q->no_more_pushes(0);
+    else
+        q->no_more_pushes();
     cout << "Finished pushing frames" << endl;
 
     // join threads
@@ -67,6 +232,27 @@ int main(int argc, char** argv) {
         if (t.joinable())
             t.join();
     
+    results.flush();
+    if (sampler) {
+        sampler->finish();
+        sampler->report();
+        n_motion_frames += sampler->filled_motion_frames();
+    }
+
+    if (segments.size() > 1)
+        cout << "Decoded in " << segments.size() << " segments" << endl;
+    if (adaptive_batch)
+        cout << "Final batch size: " << sizer.next() << endl;
+    if (stealing) {
+        size_t steals = 0;
+        for (int i = 0; i < n_workers; i++)
+            steals += ws->steals(i);
+        cout << "Stolen tasks: " << steals << endl;
+    }
+
+    video.report();
+    placement::report();
+
     // print number of motion frames
     cout << "Number of frames with detected motion: " << n_motion_frames << endl;
     return 0;
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/detector_engine.hpp"
+
+
+bool parse_detector_backend(const std::string &name, detector_backend &backend) {
+    if (name == "seq" || name == "sequential")
+        backend = detector_backend::sequential;
+    else if (name == "threads")
+        backend = detector_backend::threads;
+    else if (name == "ff" || name == "fastflow")
+        backend = detector_backend::fastflow;
+    else
+        return false;
+    return true;
+}
+
+
+const char * detector_backend_name(detector_backend backend) {
+    switch (backend) {
+        case detector_backend::threads:
+            return "threads";
+        case detector_backend::fastflow:
+            return "fastflow";
+        default:
+            return "sequential";
+    }
+}
+
+
+// frames processed by the thread calling submit
+struct sequential_engine : motion_detector::engine {
+    cv::Mat frame_smooth;
+
+    using engine::engine;
+
+    void dispatch(detect_task *t) override { process(t, frame_smooth); }
+};
+
+
+// engines of the backends, registered by the files implementing them
+static engine_factory *detector_factories() {
+    static engine_factory factories[3] = {};
+    return factories;
+}
+
+
+bool register_detector_backend(detector_backend backend, engine_factory factory) {
+    detector_factories()[int(backend)] = factory;
+    return true;
+}
+
+
+motion_detector::motion_detector(cv::Mat &background, const pipeline_params &params,
+                                 detector_backend backend, int n_workers,
+                                 result_callback on_result, size_t max_in_flight) {
+    n_workers = std::max(n_workers, 1);
+    engine_factory factory = detector_factories()[int(backend)];
+    if (backend != detector_backend::sequential && factory == nullptr) {
+        std::cerr << "The " << detector_backend_name(backend) << " backend is not linked "
+                  << "in this program (see parallel_engines.cpp), sequential used" << std::endl;
+        backend = detector_backend::sequential;
+    }
+    used_backend = backend;
+    if (max_in_flight == 0)
+        max_in_flight = backend == detector_backend::sequential ? 1 : 4 * n_workers;
+    if (backend == detector_backend::sequential)
+        impl.reset(new sequential_engine(background, params, n_workers, on_result,
+                                         max_in_flight));
+    else
+        impl.reset(factory(background, params, n_workers, on_result, max_in_flight));
+}
+
+
+motion_detector::~motion_detector() {
+    impl->flush();
+}
+
+
+size_t motion_detector::submit(cv::Mat *frame) {
+    return impl->submit(frame, nullptr);
+}
+
+
+std::future<bool> motion_detector::submit_with_future(cv::Mat *frame) {
+    std::future<bool> result;
+    impl->submit(frame, &result);
+    return result;
+}
+
+
+void motion_detector::flush() {
+    impl->flush();
+}
+
+
+size_t motion_detector::submitted() const {
+    std::lock_guard<std::mutex> lk(impl->m);
+    return impl->n_submitted;
+}
+
+
+size_t motion_detector::motion_frames() const {
+    std::lock_guard<std::mutex> lk(impl->m);
+    return impl->n_motion_frames;
+}
+
+
+size_t motion_detector::max_in_flight() const {
+    return impl->tasks.size();
+}
+
+
+detector_backend motion_detector::backend() const {
+    return used_backend;
+}
+
+
+cv::Mat * motion_detector::background() const {
+    return impl->video.background;
+}
+
+
+const pipeline_params &motion_detector::params() const {
+    return impl->params;
+}
+
+
+void motion_detector::report() const {
+    impl->video.report();
+}
@@ -0,0 +1,92 @@
+#include <thread>
+#include <vector>
+#include <memory>
+#include <string>
+#include <ff/ff.hpp>
+#include <ff/farm.hpp>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/detector_engine.hpp"
+#include "parallel/shared_queue.hpp"
+#include "auxiliary/trace.hpp"
+
+
+// frames processed by native threads taking them from a shared queue
+struct threads_engine : motion_detector::engine {
+    shared_queue<detect_task> q;
+    std::vector<std::thread> workers;
+
+    threads_engine(cv::Mat &background_frame, const pipeline_params &p, int n_workers,
+                   motion_detector::result_callback on_result, size_t max_in_flight) :
+            engine(background_frame, p, n_workers, on_result, max_in_flight),
+            q(max_in_flight) {
+        for (int i = 0; i < n_workers; i++)
+            workers.emplace_back([this, i]() {
+                tracer::name_thread("detector worker " + std::to_string(i));
+                cv::Mat frame_smooth;
+                for (detect_task *t = q.pop(); t != nullptr; t = q.pop())
+                    process(t, frame_smooth);
+            });
+    }
+
+    ~threads_engine() {
+        q.no_more_pushes();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    void dispatch(detect_task *t) override { q.push(t); }
+};
+
+
+// frames processed by a FastFlow farm run as an accelerator: the tasks
+// are offloaded to it and the workers deliver the results themselves
+struct fastflow_engine : motion_detector::engine {
+    struct worker : ff::ff_node_t<detect_task> {
+        fastflow_engine *e;
+        cv::Mat frame_smooth;
+
+        explicit worker(fastflow_engine *e) : e(e) {}
+
+        detect_task *svc(detect_task *t) {
+            e->process(t, frame_smooth);
+            return GO_ON;
+        }
+    };
+
+    std::unique_ptr<ff::ff_Farm<detect_task>> farm;
+
+    fastflow_engine(cv::Mat &background_frame, const pipeline_params &p, int n_workers,
+                    motion_detector::result_callback on_result, size_t max_in_flight) :
+            engine(background_frame, p, n_workers, on_result, max_in_flight) {
+        std::vector<std::unique_ptr<ff::ff_node>> nodes;
+        for (int i = 0; i < n_workers; i++)
+            nodes.push_back(std::unique_ptr<ff::ff_node>(new worker(this)));
+        farm.reset(new ff::ff_Farm<detect_task>(std::move(nodes), true));
+        farm->remove_collector();
+        farm->run_then_freeze();
+    }
+
+    ~fastflow_engine() {
+        farm->offload(FF_EOS);
+        farm->wait();
+    }
+
+    void dispatch(detect_task *t) override { farm->offload(t); }
+};
+
+
+
+template<typename E>
+static motion_detector::engine *make_engine(cv::Mat &background_frame, const pipeline_params &p,
+                                            int n_workers,
+                                            motion_detector::result_callback on_result,
+                                            size_t max_in_flight) {
+    return new E(background_frame, p, n_workers, on_result, max_in_flight);
+}
+
+
+// the backends are available to the programs linking this file
+static bool registered =
+        register_detector_backend(detector_backend::threads, make_engine<threads_engine>) &&
+        register_detector_backend(detector_backend::fastflow, make_engine<fastflow_engine>);
@@ -1,79 +1,151 @@
 #include <iostream>
 #include <atomic>
+#include <chrono>
 #include <queue>
 #include "opencv2/opencv.hpp"
 
 #include "parallel/parallel_funcs.hpp"
 #include "sequential/sequential_funcs.hpp"
+#include "sequential/frame_pipeline.hpp"
 #include "parallel/shared_queue.hpp"
+#include "parallel/work_stealing.hpp"
+#include "parallel/multi_stream.hpp"
+#include "parallel/segmented_decoding.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
+
+
+// pop from the central queue (the same for all the threads)
+static frame_batch * pop_batch(shared_queue<frame_batch> *q, const int th_num,
+                               size_t &video) {
+    video = 0;
+    return q->pop();
+}
+
+// take from the thread's own deque, or steal from another one
+static frame_batch * pop_batch(work_stealing_scheduler<frame_batch> *q, const int th_num,
+                               size_t &video) {
+    video = 0;
+    return q->pop(th_num);
+}
+
+// take from the queues of the streams in turn (a video per stream), those
+// of the node of the thread first
+static frame_batch * pop_batch(multi_stream_scheduler<frame_batch> *q, const int th_num,
+                               size_t &video) {
+    return q->pop(video, placement::worker_part(th_num));
+}
 
 
 /**
- * @brief base function executed by threads. Pops frames and runs the
- * "main_comp" on them.
+ * @brief base function executed by threads. Pops batches of frames, runs
+ * the "main_comp" on their frames, gives the frames back to the pool and
+ * puts the batches (with the results) in the reorder buffer of their segment.
  * 
- * @param q pointer to the shared queue
+ * @param q pointer to the shared queue, to the work-stealing scheduler or
+ * to the multi-stream scheduler
+ * @param videos the videos whose batches are in the queue (one, except for
+ * the multi-stream scheduler, where video i is stream i)
  * @param th_num number of the current thread (for logging purposes)
- * @param background the background image to be passed to "main_comp"
- * @param nw_rgb2gray number of threads to use for the rgb2gray oepration
- * @param nw_smooth number of threads to use for the smoothing operation
- * @param nw_motion_detect number of threads to use for the motion detection
- * @param min_diff minimum difference between 2 pixels to be considered different
- * @param perc percentage of different pixels to consider a frame different from background
  * @param n_motion_frames variable where to save the number of motion frames
+ * @param sizer where to report the times measured for each batch
  */
-void pick_and_comp(shared_queue<cv::Mat> *q, const int th_num,
-                   cv::Mat *background, int nw_rgb2gray, int nw_smooth,
-                   int nw_motion_detect, int min_diff, float perc,
-                   std::atomic<int>& n_motion_frames) {
+template<typename Queue>
+void pick_and_comp(Queue *q, const std::vector<video_context> &videos, const int th_num,
+                   std::atomic<int>& n_motion_frames, batch_sizer *sizer) {
+    
+    // Mats for the smoothed frames, reused for all the frames of this thread
+    // (one per video, since the sizes may differ)
+    std::vector<cv::Mat> frames_smooth(videos.size());
+    placement::pin_self(thread_role::worker, th_num);
+    tracer::name_thread("worker " + std::to_string(th_num));
     
     // continue looping until the queue is empty and the video is finished
     while (!(q->empty() && q->get_finished())) {
-        // pop frame from the queue (synchronization included in pop())
-        cv::Mat *frame_rgb = q->pop();
+        // pop batch from the queue (synchronization included in pop()); the
+        // time of the pop counts as overhead only if there was no need to
+        // wait for the producer
+        bool queue_had_batches = !q->empty();
+        auto start = std::chrono::steady_clock::now();
+        frame_batch *batch;
+        size_t v;
+        {
+            trace_span span(trace_stage::queue_wait);
+            batch = pop_batch(q, th_num, v);
+        }
+        auto popped = std::chrono::steady_clock::now();
 
         // when the video is finished and the queue is empty, threads waiting
-        // to pop a frame will return nullptr
-        if (frame_rgb == nullptr)
+        // to pop a batch will return nullptr
+        if (batch == nullptr)
             break;
         
-        // run the main comp on the frame just popped
-        main_comp(background, frame_rgb, nw_rgb2gray, nw_smooth,
-                  nw_motion_detect, min_diff, perc, n_motion_frames);
+        // run the main comp on the frames of the batch just popped
+        const video_context &video = videos[v];
+        const pipeline_params &params = *video.params;
+        frames_smooth[v].create(video.background->rows, video.background->cols, CV_8UC1);
+        batch->motion.resize(batch->frames.size());
+        if (params.cell_size > 0)
+            batch->maps.resize(batch->frames.size());
+        for (size_t k = 0; k < batch->frames.size(); k++) {
+            tracer::set_frame(batch->first_index + k * batch->stride);
+            batch->motion[k] = main_comp(video.background, batch->frames[k], &frames_smooth[v],
+                                         params, n_motion_frames,
+                                         params.cell_size > 0 ? &batch->maps[k] : nullptr);
+            video.pool->release(batch->frames[k]);
+        }
+        auto done = std::chrono::steady_clock::now();
+
+        sizer->record(queue_had_batches ?
+                      std::chrono::nanoseconds(popped - start).count() : 0,
+                      std::chrono::nanoseconds(done - popped).count());
+        video.results->insert(batch);
     }
     std::cout << "Thread " << th_num << " finished" << std::endl;
 }
 
+template void pick_and_comp(shared_queue<frame_batch> *q,
+                            const std::vector<video_context> &videos, const int th_num,
+                            std::atomic<int>& n_motion_frames, batch_sizer *sizer);
+template void pick_and_comp(work_stealing_scheduler<frame_batch> *q,
+                            const std::vector<video_context> &videos, const int th_num,
+                            std::atomic<int>& n_motion_frames, batch_sizer *sizer);
+template void pick_and_comp(multi_stream_scheduler<frame_batch> *q,
+                            const std::vector<video_context> &videos, const int th_num,
+                            std::atomic<int>& n_motion_frames, batch_sizer *sizer);
+
 
 /**
  * @brief main composition of sequential stages to run on frames.
  * 
  * For each frame, it turns it into grayscale, runs smoothing and check
- * if some motion is detected in the frame w.r.t. the background.
+ * if some motion is detected in the frame w.r.t. the background (either
+ * stage by stage or with the fused kernel, see frame_has_motion).
  * 
  * @param background pointer to the background image
  * @param frame_rgb pointer to the frame to be processed
- * @param nw_rgb2gray number of threads to use for the rgb2gray oepration
- * @param nw_smooth number of threads to use for the smoothing operation
- * @param nw_motion_detect number of threads to use for the motion detection
- * @param min_diff minimum difference between 2 pixels to be considered different
- * @param perc percentage of different pixels to consider a frame different from background
+ * @param frame_smooth Mat where to put the smoothed frame
+ * @param params parameters of the per-frame computation
  * @param n_motion_frames variable where to save the number of motion frames
+ * @param map where to put the map of the different pixels, with --heatmap
+ * @return true if motion is detected in the frame
  */
-void main_comp(cv::Mat *background, cv::Mat *frame_rgb, int nw_rgb2gray,
-               int nw_smooth, int nw_motion_detect, int min_diff, float perc,
-               std::atomic<int>& n_motion_frames) {
-    
-    // convert frame to grayscale
-    cv::Mat *frame_gray = rgb2gray(frame_rgb, nw_rgb2gray);
-    
-    // smooth frame
-    cv::Mat *frame = new cv::Mat(frame_gray->rows, frame_gray->cols, CV_8UC1);
-    smooth(frame_gray, frame, nw_smooth);
+bool main_comp(cv::Mat *background, cv::Mat *frame_rgb, cv::Mat *frame_smooth,
+               const pipeline_params &params,
+               std::atomic<int>& n_motion_frames, motion_map *map) {
     
-    // check if motion is detected
-    if (motion_detect(background, frame, min_diff, perc, nw_motion_detect))
+    // grayscale, smoothing and check if motion is detected
+    bool motion = frame_has_motion(background, frame_rgb, frame_smooth, params, map);
+    if (motion)
         n_motion_frames++;
-    
-    delete frame_rgb, frame_gray, frame;
+    return motion;
+}
+
+
+void add_to_heatmap(motion_heatmap *heatmap, const frame_batch &batch) {
+    if (heatmap == nullptr)
+        return;
+    for (size_t k = 0; k < batch.maps.size() && k < batch.frames.size(); k++)
+        heatmap->add(batch.first_index + k * batch.stride, batch.motion[k], batch.maps[k]);
 }
\ No newline at end of file
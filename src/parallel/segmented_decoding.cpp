@@ -0,0 +1,163 @@
+#include <iostream>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "parallel/segmented_decoding.hpp"
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
+
+
+std::vector<video_segment> split_video(cv::VideoCapture &cap, size_t n_segments,
+                                       size_t gop, size_t first_frame) {
+    long n_frames = cap.get(cv::CAP_PROP_FRAME_COUNT);
+    if (n_frames <= (long)first_frame + 1 || n_segments <= 1)
+        return {{first_frame, 0}};
+
+    size_t to_split = n_frames - first_frame;
+    n_segments = std::min(n_segments, to_split);
+    std::vector<size_t> starts{first_frame};
+    for (size_t s = 1; s < n_segments; s++) {
+        size_t start = first_frame + s * to_split / n_segments;
+        if (gop > 0)
+            start = start / gop * gop;
+        if (start > starts.back())
+            starts.push_back(start);
+    }
+
+    std::vector<video_segment> segments;
+    for (size_t s = 0; s < starts.size(); s++) {
+        size_t n = s + 1 < starts.size() ? starts[s + 1] - starts[s] : 0;
+        segments.push_back({starts[s], n});
+    }
+    return segments;
+}
+
+
+bool open_segment(cv::VideoCapture &cap, const std::string &path,
+                  const video_segment &segment) {
+    return cap.open(path) && seek_frame(cap, path, segment.first);
+}
+
+
+size_t decode_segment(cv::VideoCapture &cap, size_t segment_id,
+                      const video_segment &segment, frame_pool *pool,
+                      shared_queue<frame_batch> *free_batches, batch_sizer *sizer,
+                      const std::function<void(frame_batch *)> &push) {
+    size_t n_read = 0;
+    for (size_t seq = 0; ; seq++) {
+        frame_batch *batch = free_batches->pop();  // waits for a free batch
+        batch->frames.clear();
+        batch->segment = segment_id;
+        batch->seq = seq;
+        batch->first_index = segment.first + n_read;
+        batch->stride = segment.stride;
+
+        size_t batch_size = sizer->next();
+        bool segment_finished = false;
+        while (batch->frames.size() < batch_size) {
+            if (segment.n_frames > 0 && n_read == segment.n_frames) {
+                segment_finished = true;
+                break;
+            }
+            cv::Mat *frame_rgb = pool->acquire(batch->part);
+            {
+                trace_span span(trace_stage::decode, segment.first + n_read);
+                cap >> *frame_rgb;
+            }
+            if (frame_rgb->empty()) {
+                pool->release(frame_rgb);
+                segment_finished = true;
+                break;
+            }
+            batch->frames.push_back(frame_rgb);
+            n_read++;
+
+            size_t to_skip = segment.stride - 1;
+            if (segment.n_frames > 0)
+                to_skip = std::min(to_skip, segment.n_frames - n_read);
+            n_read += skip_frames(cap, to_skip);
+        }
+
+        if (batch->frames.empty()) {
+            free_batches->push(batch);
+            break;
+        }
+        {
+            trace_span span(trace_stage::push_wait, batch->first_index);
+            push(batch);
+        }
+        if (segment_finished)
+            break;
+    }
+    return n_read;
+}
+
+
+segmented_decoder::segmented_decoder(const std::string &path,
+                                     const std::vector<video_segment> &segments,
+                                     frame_pool *pool,
+                                     shared_queue<frame_batch> *free_batches,
+                                     batch_sizer *sizer,
+                                     std::function<void(frame_batch *)> push,
+                                     std::function<void()> on_finished) :
+        running(segments.size()) {
+    for (size_t s = 0; s < segments.size(); s++)
+        threads.push_back(std::thread([=]() {
+            placement::pin_self(thread_role::decoder, s);
+            tracer::name_thread("decoder " + std::to_string(s));
+            std::unique_ptr<cv::VideoCapture> cap = make_capture(path);
+            if (open_segment(*cap, path, segments[s]))
+                decode_segment(*cap, s, segments[s], pool, free_batches, sizer, push);
+            else
+                std::cerr << "Cannot open segment " << s << " of " << path << std::endl;
+            cap->release();
+            if (--running == 0)
+                on_finished();
+        }));
+}
+
+
+void segmented_decoder::join() {
+    for (auto &t : threads)
+        if (t.joinable())
+            t.join();
+}
+
+
+segmented_results::segmented_results(const std::vector<video_segment> &segments,
+                                     size_t capacity,
+                                     std::function<void(size_t, bool)> emit_frame,
+                                     std::function<void(frame_batch *)> recycle) :
+        pending(segments.size()), emit_frame(emit_frame), recycle(recycle) {
+    for (size_t s = 0; s < segments.size(); s++) {
+        pending_first.push_back(segments[s].first);
+        pending_stride.push_back(segments[s].stride);
+        buffers.emplace_back(new reorder_buffer<frame_batch *>(capacity, 0,
+                [this, s](size_t seq, frame_batch * const &batch) {
+            for (size_t k = 0; k < batch->frames.size(); k++) {
+                if (s == 0)
+                    this->emit_frame(batch->first_index + k * batch->stride,
+                                     batch->motion[k]);
+                else
+                    pending[s].push_back(batch->motion[k]);
+            }
+            this->recycle(batch);
+        }));
+    }
+}
+
+
+void segmented_results::insert(frame_batch *batch) {
+    buffers[batch->segment]->insert(batch->seq, batch);
+}
+
+
+void segmented_results::flush() {
+    for (size_t s = 1; s < pending.size(); s++) {
+        for (size_t i = 0; i < pending[s].size(); i++)
+            emit_frame(pending_first[s] + i * pending_stride[s], pending[s][i]);
+        pending[s].clear();
+    }
+}
@@ -0,0 +1,357 @@
+#include <iostream>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/sequential_funcs.hpp"
+#include "sequential/simd_funcs.hpp"
+#include "sequential/running_background.hpp"
+#include "sequential/pyramid.hpp"
+#include "sequential/roi_mask.hpp"
+#include "sequential/incremental.hpp"
+#include "sequential/motion_map.hpp"
+#include "auxiliary/timer.hpp"
+#include "auxiliary/trace.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief reads the parameters of the per-frame computation from the
+ * command line.
+ *
+ * The numbers of workers for rgb2gray, smoothing and motion detection are
+ * the optional positional arguments starting at position 'nw_pos'; the
+ * other parameters are given as "--option" arguments.
+ *
+ * @param args the parsed command line
+ * @param nw_pos position of the number of workers for rgb2gray
+ * @return the parameters (defaults for the missing ones)
+ */
+pipeline_params parse_pipeline_params(const cli_options &args, size_t nw_pos) {
+    pipeline_params params;
+    params.nw_rgb2gray = args.positive_int(nw_pos, 1);
+    params.nw_smooth = args.positive_int(nw_pos + 1, 1);
+    params.nw_motion_detect = args.positive_int(nw_pos + 2, 1);
+    params.min_diff = max(args.get_int("min-diff", params.min_diff), 0);
+    params.perc = args.get_double("perc", params.perc);
+    params.fused = args.has("fused");
+    params.simd = args.has("simd");
+    params.radius = max(args.get_int("radius", 1), 1);
+    params.early_exit = args.has("early-exit");
+    params.specialize = args.has("specialize");
+    params.stride = max(args.get_int("sample", 1), 1);
+    if (args.has("adaptive-bg"))
+        params.bg_shift = min(max(args.get_int("adaptive-bg", 5), 1), 8);
+    if (params.fused && params.radius != 1) {
+        cout << "The fused kernel only supports radius 1, --fused ignored" << endl;
+        params.fused = false;
+    }
+    // the background is updated with the smoothed frame, which the fused
+    // kernel doesn't keep, and from every pixel, which early exit skips
+    if (params.bg_shift > 0 && (params.fused || params.early_exit)) {
+        cout << "The adaptive background needs the whole smoothed frame, "
+             << "--fused and --early-exit ignored" << endl;
+        params.fused = params.early_exit = false;
+    }
+    if (args.has("pyramid")) {
+        params.pyramid_factor = args.get_int("pyramid", 2);
+        params.pyramid_margin = args.get_double("pyramid-margin", 0.02);
+        if (params.pyramid_factor != 2 && params.pyramid_factor != 4) {
+            cout << "The pyramid factor must be 2 or 4, using 2" << endl;
+            params.pyramid_factor = 2;
+        }
+        // frames decided at low resolution would never update the background
+        if (params.bg_shift > 0) {
+            cout << "The pyramid doesn't support the adaptive background, "
+                 << "--pyramid ignored" << endl;
+            params.pyramid_factor = 1;
+        }
+    }
+    // the region has its own single-pass kernel, with a 3x3 neighborhood
+    params.roi_path = args.get("roi");
+    if (!params.roi_path.empty() && (params.radius != 1 || params.fused || params.early_exit ||
+                                     params.bg_shift > 0 || params.pyramid_factor > 1)) {
+        cout << "The region of interest supports none of --radius, --fused, --early-exit, "
+             << "--adaptive-bg and --pyramid, ignored" << endl;
+        params.radius = 1;
+        params.fused = params.early_exit = false;
+        params.bg_shift = 0;
+        params.pyramid_factor = 1;
+    }
+    // the blocks keep the counts of their pixels w.r.t. a fixed background,
+    // over the whole frame
+    if (args.has("incremental")) {
+        params.block_size = max(args.get_int("incremental", 64), 8);
+        if (params.fused || params.early_exit || params.bg_shift > 0 || !params.roi_path.empty()) {
+            cout << "Incremental detection supports none of --fused, --early-exit, "
+                 << "--adaptive-bg and --roi, --incremental ignored" << endl;
+            params.block_size = 0;
+        }
+    }
+    // the map needs the comparison of every pixel at full resolution, of
+    // every frame (the frames filled in by the sampler and the ones measured
+    // by the autotuner have none)
+    if (args.has("heatmap")) {
+        // at most 4096, so the count of a cell fits in its unsigned
+        params.cell_size = min(max(args.get_int("heatmap", 32), 1), 4096);
+        params.motion_box = args.has("motion-box");
+        params.heatmap_prefix = args.get("heatmap-out", "heatmap");
+        if (params.fused || params.early_exit || params.bg_shift > 0 ||
+            params.pyramid_factor > 1 || !params.roi_path.empty() || params.block_size > 0 ||
+            params.stride > 1 || args.has("autotune")) {
+            cout << "The motion heatmap supports none of --fused, --early-exit, --adaptive-bg, "
+                 << "--pyramid, --roi, --incremental, --sample and --autotune, --heatmap ignored"
+                 << endl;
+            params.cell_size = 0;
+        }
+    }
+    if (params.simd) {
+        string isa = args.get("simd");
+        if (!isa.empty() && !limit_simd_isa(isa))
+            cout << "Unknown instruction set '" << isa << "', ignored" << endl;
+        cout << "Using " << simd_isa_name(active_simd_isa()) << " kernels" << endl;
+    }
+    return params;
+}
+
+
+void print_pipeline_options() {
+    cout << "Options:" << endl
+         << "  --min-diff=<d>\tmin difference between 2 pixels to be considered "
+         << "different (default 10)" << endl
+         << "  --perc=<p>\tfraction of different pixels above which there is motion "
+         << "(default 0.05)" << endl
+         << "  --fused\tsingle pass gray/smooth/motion detection "
+         << "(uses the max of the 3 numbers of workers)" << endl
+         << "  --simd[=<isa>]\tvectorized kernels, with the best instruction set "
+         << "of the CPU or at most <isa> (scalar, sse4, avx2, avx512)" << endl
+         << "  --radius=<r>\tsmoothing over a (2r+1)x(2r+1) neighborhood "
+         << "(default 1, i.e. 3x3)" << endl
+         << "  --early-exit\tstop motion detection as soon as the result "
+         << "is known (not with --fused)" << endl
+         << "  --adaptive-bg[=<k>]\tblend the frames without motion into the "
+         << "background with weight 2^-k (default 5, from 1 to 8)" << endl
+         << "  --pyramid[=<f>]\tdecide at 1/f of the resolution (f = 2 or 4, "
+         << "default 2) unless the result is close to the threshold" << endl
+         << "  --pyramid-margin=<m>\tdistance from the threshold under which the "
+         << "full resolution is used (default 0.02)" << endl
+         << "  --sample=<k>\tprocess one frame every k, and the frames between 2 "
+         << "samples only if their results differ" << endl
+         << "  --roi=<mask>\tonly look for motion where the mask image is not black "
+         << "(perc is relative to that area)" << endl
+         << "  --incremental[=<b>]\tsplit the frames in b x b blocks (default 64) and "
+         << "recompute only the ones changed since the previous frame" << endl
+         << "  --heatmap[=<c>]\tcount the different pixels of the frames with motion in "
+         << "cells of c x c pixels (default 32), written to <prefix>.csv" << endl
+         << "  --motion-box\twith --heatmap, also the rectangle containing the motion "
+         << "of every frame, written to <prefix>_boxes.csv" << endl
+         << "  --heatmap-out=<prefix>\tprefix of the files of --heatmap (default heatmap)" << endl
+         << "  --specialize\tsmoothing and motion detection instantiated for the "
+         << "width of the frames, the radius and the threshold, where available" << endl
+         << "  --print-frames\tprint the frames with motion, in order" << endl
+         << "  --trace[=<prefix>]\trecord the time spent by the threads in each stage, "
+         << "written to <prefix>.json and <prefix>_hist.txt (default prefix trace)" << endl
+         << "  --budget=<n>\tmax threads working on frames, the ones of the "
+         << "intra-frame pool included (default: number of cores)" << endl
+         << "  --pin[=compact|scatter|<cores>]\tpin the decoders, the workers, the "
+         << "collector and the intra-frame pool to the cores (e.g. 0-7,16-23), in this "
+         << "order, and allocate the frames on the NUMA nodes of the workers" << endl;
+}
+
+
+void use_gray_frames(pipeline_params &params) {
+    params.gray_frames = true;
+    // the fused kernel, the pyramid and the region of interest convert the
+    // color frame themselves
+    if (params.fused || params.pyramid_factor > 1 || !params.roi_path.empty()) {
+        cout << "The frames of YUV videos are already grayscale: --fused, --pyramid "
+             << "and --roi are not supported, ignored" << endl;
+        params.fused = false;
+        params.pyramid_factor = 1;
+        params.roi_path.clear();
+    }
+}
+
+
+// rgb2gray stage, with the kernel selected by the parameters (none if the
+// frames are already grayscale)
+static cv::Mat * gray_stage(cv::Mat *frame_rgb, const pipeline_params &params) {
+    if (params.gray_frames)
+        return frame_rgb;
+    if (params.simd)
+        return rgb2gray_simd(frame_rgb, params.nw_rgb2gray);
+    return rgb2gray(frame_rgb, params.nw_rgb2gray);
+}
+
+
+// smoothing stage, with the kernel selected by the parameters
+static void smooth_stage(cv::Mat *frame_gray, cv::Mat *frame_smooth,
+                         const pipeline_params &params) {
+    if (params.specialized_smooth != nullptr)
+        params.specialized_smooth(frame_gray, frame_smooth, params.nw_smooth);
+    else if (params.radius != 1)
+        smooth_radius(frame_gray, frame_smooth, params.radius, params.nw_smooth);
+    else if (params.simd)
+        smooth_simd(frame_gray, frame_smooth, params.nw_smooth);
+    else
+        smooth(frame_gray, frame_smooth, params.nw_smooth);
+}
+
+
+// motion detection stage, with the kernel selected by the parameters (with
+// a map, the one that also fills it)
+static bool detect_stage(cv::Mat *background, cv::Mat *frame_smooth,
+                         const pipeline_params &params, motion_map *map = nullptr) {
+    if (map != nullptr && params.cell_size > 0) {
+        map->reset(frame_smooth->rows, frame_smooth->cols, params.cell_size);
+        return motion_detect_map(background, frame_smooth, params.min_diff, params.perc,
+                                 params.nw_motion_detect, *map, params.motion_box);
+    }
+    if (params.running_bg != nullptr)
+        return params.running_bg->detect(frame_smooth, params);
+    if (params.specialized_detect != nullptr)
+        return params.specialized_detect(background, frame_smooth, params.perc,
+                                         params.nw_motion_detect);
+    if (params.early_exit && params.simd)
+        return motion_detect_early_exit_simd(background, frame_smooth, params.min_diff,
+                                             params.perc, params.nw_motion_detect);
+    if (params.early_exit)
+        return motion_detect_early_exit(background, frame_smooth, params.min_diff,
+                                        params.perc, params.nw_motion_detect);
+    if (params.simd)
+        return motion_detect_simd(background, frame_smooth, params.min_diff,
+                                  params.perc, params.nw_motion_detect);
+    return motion_detect(background, frame_smooth, params.min_diff,
+                         params.perc, params.nw_motion_detect);
+}
+
+
+/**
+ * @brief turns the first frame of the video into the background, i.e.
+ * converts it to grayscale and smooths it.
+ *
+ * @param background_rgb the first frame of the video (modified in place)
+ * @param params parameters of the computation
+ * @return pointer to the (newly allocated) background
+ */
+cv::Mat * make_background(cv::Mat *background_rgb, const pipeline_params &params) {
+    cv::Mat *background = new cv::Mat(background_rgb->rows, background_rgb->cols, CV_8UC1);
+    smooth_stage(gray_stage(background_rgb, params), background, params);
+    return background;
+}
+
+
+// frame_has_motion at full resolution, without the pyramid
+static bool full_res_motion(cv::Mat *background, cv::Mat *frame_rgb,
+                            cv::Mat *frame_smooth, const pipeline_params &params,
+                            motion_map *map) {
+    if (params.roi != nullptr) {
+        trace_span span(trace_stage::single_pass);
+        return roi_motion_detect(background, frame_rgb, *params.roi, params.min_diff,
+                                 params.perc, max({params.nw_rgb2gray, params.nw_smooth,
+                                                   params.nw_motion_detect}),
+                                 params.simd);
+    }
+    if (params.incremental != nullptr) {
+        trace_span span(trace_stage::single_pass);
+        return params.incremental->detect(background, frame_rgb, params);
+    }
+    if (params.fused) {
+        trace_span span(trace_stage::single_pass);
+        int nw = max({params.nw_rgb2gray, params.nw_smooth, params.nw_motion_detect});
+        if (params.simd)
+            return fused_motion_detect_simd(background, frame_rgb, params.min_diff,
+                                            params.perc, nw);
+        return fused_motion_detect(background, frame_rgb, params.min_diff,
+                                   params.perc, nw);
+    }
+
+    cv::Mat *frame_gray;
+    {
+        trace_span span(trace_stage::gray);
+        frame_gray = gray_stage(frame_rgb, params);
+    }
+    {
+        trace_span span(trace_stage::smooth);
+        smooth_stage(frame_gray, frame_smooth, params);
+    }
+    trace_span span(trace_stage::detect);
+    return detect_stage(background, frame_smooth, params, map);
+}
+
+
+/**
+ * @brief checks whether a frame contains motion w.r.t. the background.
+ *
+ * Runs either the 3 stages (rgb2gray, smooth, motion_detect) one after the
+ * other or the fused single-pass kernel, depending on 'params.fused', with
+ * the scalar or the vectorized kernels, depending on 'params.simd'. With a
+ * radius other than 1 the smoothing is done by smooth_radius. With the
+ * adaptive background the frame is compared with it (and possibly blended
+ * into it) instead of with 'background'. With the pyramid the frame is
+ * first compared with the background at low resolution, see
+ * pyramid_detector. With a region of interest only the pixels inside it
+ * are visited, see roi_motion_detect. With the incremental detection only
+ * the blocks changed since the previous frame are recomputed, see
+ * incremental_detector. With the heatmap, the motion detection also
+ * fills 'map', see motion_detect_map.
+ *
+ * @param background pointer to the background image
+ * @param frame_rgb pointer to the frame to be processed (the 3-stage path
+ * converts it to grayscale in place)
+ * @param frame_smooth Mat where to put the smoothed frame (unused, and can
+ * be nullptr, with the fused kernel and the incremental detection)
+ * @param params parameters of the computation
+ * @param map where to put the map of the different pixels, with --heatmap
+ * (may be nullptr)
+ * @return true if motion is detected in the frame
+ */
+bool frame_has_motion(cv::Mat *background, cv::Mat *frame_rgb,
+                      cv::Mat *frame_smooth, const pipeline_params &params,
+                      motion_map *map) {
+    if (params.pyramid != nullptr) {
+        // the escalations to full resolution are nested in the span
+        trace_span span(trace_stage::single_pass);
+        return params.pyramid->detect(frame_rgb, params, [&]() {
+            return full_res_motion(background, frame_rgb, frame_smooth, params, map);
+        });
+    }
+    return full_res_motion(background, frame_rgb, frame_smooth, params, map);
+}
+
+
+/**
+ * @brief same as frame_has_motion, but measures the time spent in each
+ * stage (with the fused kernel, the pyramid, a region of interest or the
+ * incremental detection, the whole time goes to motion detection).
+ *
+ * @param background pointer to the background image
+ * @param frame_rgb pointer to the frame to be processed
+ * @param frame_smooth Mat where to put the smoothed frame
+ * @param params parameters of the computation
+ * @param times where to put the times of the stages
+ * @return true if motion is detected in the frame
+ */
+bool frame_has_motion_timed(cv::Mat *background, cv::Mat *frame_rgb,
+                            cv::Mat *frame_smooth, const pipeline_params &params,
+                            stage_times &times) {
+    bool motion = false;
+    if (params.fused || params.pyramid != nullptr || params.roi != nullptr ||
+        params.incremental != nullptr) {
+        times.rgb2gray = times.smooth = 0;
+        times.motion_detect = measure_us([&]() {
+            motion = frame_has_motion(background, frame_rgb, frame_smooth, params);
+        });
+        return motion;
+    }
+
+    cv::Mat *frame_gray = nullptr;
+    times.rgb2gray = measure_us([&]() { frame_gray = gray_stage(frame_rgb, params); });
+    times.smooth = measure_us([&]() { smooth_stage(frame_gray, frame_smooth, params); });
+    times.motion_detect = measure_us([&]() {
+        motion = detect_stage(background, frame_smooth, params);
+    });
+    return motion;
+}
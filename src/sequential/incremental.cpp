@@ -0,0 +1,252 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/incremental.hpp"
+#include "sequential/row_kernels.hpp"
+#include "auxiliary/tile_pool.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief smooths the pixels of a block (3x3 neighborhood) and counts the
+ * ones that differ from the background, in a single pass. Same arithmetic
+ * as smooth, on the borders of the frame too.
+ *
+ * @return the number of pixels of the block differing from the background
+ * by more than 'min_diff'
+ */
+static unsigned smooth_count_block(const Mat &gray, const Mat &background,
+                                   int x0, int x1, int y0, int y1, unsigned min_diff) {
+    int rows = gray.rows;
+    int cols = gray.cols;
+    unsigned n = 0;
+    for (int i = y0; i < y1; i++) {
+        const uchar *up = i > 0 ? gray.ptr<uchar>(i - 1) : nullptr;
+        const uchar *mid = gray.ptr<uchar>(i);
+        const uchar *down = i < rows - 1 ? gray.ptr<uchar>(i + 1) : nullptr;
+        const uchar *bg = background.ptr<uchar>(i);
+        auto border_pixel = [&](int j) {
+            n += unsigned(abs(bg[j] - border_smooth_pixel(up, mid, down, j, cols))) > min_diff;
+        };
+        if (up == nullptr || down == nullptr) {
+            for (int j = x0; j < x1; j++)
+                border_pixel(j);
+            continue;
+        }
+        if (x0 == 0)
+            border_pixel(0);
+        for (int j = max(x0, 1); j < min(x1, cols - 1); j++) {
+            int smoothed = (up[j-1] + up[j] + up[j+1] +
+                            mid[j-1] + mid[j] + mid[j+1] +
+                            down[j-1] + down[j] + down[j+1]) / 9;
+            n += unsigned(abs(bg[j] - smoothed)) > min_diff;
+        }
+        if (x1 == cols && cols > 1)
+            border_pixel(cols - 1);
+    }
+    return n;
+}
+
+
+/**
+ * @brief same as smooth_count_block for a (2 * radius + 1) x (2 * radius + 1)
+ * neighborhood, with the running sums of smooth_radius restricted to the
+ * columns of the block and of its halo.
+ */
+static unsigned smooth_count_block_radius(const Mat &gray, const Mat &background,
+                                          int x0, int x1, int y0, int y1,
+                                          int radius, unsigned min_diff) {
+    thread_local vector<int> col_sums;
+    int rows = gray.rows;
+    int cols = gray.cols;
+    int hx0 = max(x0 - radius, 0), hx1 = min(x1 + radius, cols);
+    col_sums.assign(hx1 - hx0, 0);
+    int *sums = col_sums.data() - hx0;      // indexed by the column of the frame
+
+    for (int r = max(y0 - radius - 1, 0); r < min(y0 + radius, rows); r++) {
+        const uchar *row = gray.ptr<uchar>(r);
+        for (int j = hx0; j < hx1; j++)
+            sums[j] += row[j];
+    }
+    unsigned n = 0;
+    for (int i = y0; i < y1; i++) {
+        if (i + radius < rows) {
+            const uchar *in = gray.ptr<uchar>(i + radius);
+            for (int j = hx0; j < hx1; j++)
+                sums[j] += in[j];
+        }
+        if (i - radius - 1 >= 0) {
+            const uchar *out = gray.ptr<uchar>(i - radius - 1);
+            for (int j = hx0; j < hx1; j++)
+                sums[j] -= out[j];
+        }
+        int n_rows = min(i + radius, rows - 1) - max(i - radius, 0) + 1;
+
+        const uchar *bg = background.ptr<uchar>(i);
+        int sum = 0;
+        for (int j = hx0; j <= min(x0 + radius, cols - 1); j++)
+            sum += sums[j];
+        for (int j = x0; j < x1; j++) {
+            if (j > x0) {
+                if (j + radius < cols)
+                    sum += sums[j + radius];
+                if (j - radius - 1 >= 0)
+                    sum -= sums[j - radius - 1];
+            }
+            int n_cols = min(j + radius, cols - 1) - max(j - radius, 0) + 1;
+            n += unsigned(abs(bg[j] - sum / (n_rows * n_cols))) > min_diff;
+        }
+    }
+    return n;
+}
+
+
+incremental_detector::incremental_detector(int rows, int cols, int block) :
+        rows(rows), cols(cols), block(block),
+        blocks_x((cols + block - 1) / block), blocks_y((rows + block - 1) / block) {}
+
+
+std::unique_ptr<incremental_detector::cache> incremental_detector::acquire() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        if (!free_caches.empty()) {
+            std::unique_ptr<cache> c = std::move(free_caches.back());
+            free_caches.pop_back();
+            return c;
+        }
+    }
+    std::unique_ptr<cache> c(new cache);
+    c->gray.create(rows, cols, CV_8UC1);
+    c->counts.resize(blocks_x * blocks_y);
+    c->changed.resize(blocks_x * blocks_y);
+    c->dirty.resize(blocks_x * blocks_y);
+    return c;
+}
+
+
+void incremental_detector::release(std::unique_ptr<cache> c) {
+    std::lock_guard<std::mutex> lk(m);
+    free_caches.push_back(std::move(c));
+}
+
+
+void incremental_detector::block_bounds(int b, int &x0, int &x1, int &y0, int &y1) const {
+    x0 = b % blocks_x * block;
+    x1 = min(x0 + block, cols);
+    y0 = b / blocks_x * block;
+    y1 = min(y0 + block, rows);
+}
+
+
+bool incremental_detector::detect(Mat *background, Mat *frame_rgb,
+                                  const pipeline_params &params) {
+    std::unique_ptr<cache> c = acquire();
+    int nw = max({params.nw_rgb2gray, params.nw_smooth, params.nw_motion_detect});
+    int n_blocks = blocks_x * blocks_y;
+    int halo = params.radius;
+    bool gray_frames = params.gray_frames;
+    if (!gray_frames)
+        c->input.create(rows, cols, frame_rgb->type());
+    // the previous frame as read, to be compared with this one
+    Mat &previous = gray_frames ? c->gray : c->input;
+    size_t pixel_bytes = frame_rgb->elemSize();
+
+    // 1. blocks whose pixels changed, and blocks whose halo changed
+    if (!c->valid) {
+        fill(c->changed.begin(), c->changed.end(), 1);
+        fill(c->dirty.begin(), c->dirty.end(), 1);
+    } else
+        tile_pool::get().parallel_for(n_blocks, nw, [&](int b) {
+            int x0, x1, y0, y1;
+            block_bounds(b, x0, x1, y0, y1);
+            auto differs = [&](int i, int first, int last) {
+                return memcmp(frame_rgb->ptr<uchar>(i) + first * pixel_bytes,
+                              previous.ptr<uchar>(i) + first * pixel_bytes,
+                              (last - first) * pixel_bytes) != 0;
+            };
+            bool changed = false;
+            for (int i = y0; i < y1 && !changed; i++)
+                changed = differs(i, x0, x1);
+            bool dirty = changed;
+            int hx0 = max(x0 - halo, 0), hx1 = min(x1 + halo, cols);
+            for (int i = max(y0 - halo, 0); i < min(y1 + halo, rows) && !dirty; i++)
+                dirty = i < y0 || i >= y1 ? differs(i, hx0, hx1)
+                                          : differs(i, hx0, x0) || differs(i, x1, hx1);
+            c->changed[b] = changed;
+            c->dirty[b] = dirty;
+        });
+
+    // 2. grayscale values of the changed blocks (a pixel only depends on
+    // itself), and the frame kept for the next comparison
+    c->to_do.clear();
+    for (int b = 0; b < n_blocks; b++)
+        if (c->changed[b])
+            c->to_do.push_back(b);
+    tile_pool::get().parallel_for(c->to_do.size(), nw, [&](int k) {
+        int x0, x1, y0, y1;
+        block_bounds(c->to_do[k], x0, x1, y0, y1);
+        for (int i = y0; i < y1; i++) {
+            const uchar *in = frame_rgb->ptr<uchar>(i) + x0 * pixel_bytes;
+            if (gray_frames)
+                memcpy(c->gray.ptr<uchar>(i) + x0, in, x1 - x0);
+            else {
+                rgb2gray_row(in, c->gray.ptr<uchar>(i) + x0, x1 - x0);
+                memcpy(c->input.ptr<uchar>(i) + x0 * pixel_bytes, in, (x1 - x0) * pixel_bytes);
+            }
+        }
+    });
+
+    // 3. smoothing and comparison of the blocks whose neighborhood changed
+    // (after step 2, since the halo is read from the neighboring blocks)
+    c->to_do.clear();
+    for (int b = 0; b < n_blocks; b++)
+        if (c->dirty[b])
+            c->to_do.push_back(b);
+    tile_pool::get().parallel_for(c->to_do.size(), nw, [&](int k) {
+        int b = c->to_do[k];
+        int x0, x1, y0, y1;
+        block_bounds(b, x0, x1, y0, y1);
+        if (halo == 1)
+            c->counts[b] = smooth_count_block(c->gray, *background, x0, x1, y0, y1,
+                                              params.min_diff);
+        else
+            c->counts[b] = smooth_count_block_radius(c->gray, *background, x0, x1, y0, y1,
+                                                     halo, params.min_diff);
+    });
+    c->valid = true;
+
+    unsigned n_different_pixels = 0;
+    for (unsigned n : c->counts)
+        n_different_pixels += n;
+    n_frames++;
+    n_recomputed += c->to_do.size();
+    release(std::move(c));
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > params.perc;
+}
+
+
+void incremental_detector::report() const {
+    if (n_frames == 0)
+        return;
+    double n_blocks = double(n_frames) * blocks_x * blocks_y;
+    cout << "Blocks recomputed by the incremental detection: " << n_recomputed << " / "
+         << size_t(n_blocks) << " (" << 100.0 * n_recomputed / n_blocks << "%)" << endl;
+}
+
+
+std::unique_ptr<incremental_detector> incremental_detector::attach(pipeline_params &params,
+                                                                   int rows, int cols) {
+    if (params.block_size <= 0)
+        return nullptr;
+    std::unique_ptr<incremental_detector> incremental(
+        new incremental_detector(rows, cols, params.block_size));
+    params.incremental = incremental.get();
+    return incremental;
+}
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <numeric>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <memory>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "auxiliary/cli.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/synthetic_frames.hpp"
+#include "sequential/sequential_funcs.hpp"
+#include "sequential/simd_funcs.hpp"
+#include "sequential/specialized_funcs.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+// parameters of motion detection, the same defaults as the executables
+static constexpr unsigned MIN_DIFF = 10;
+static constexpr float PERC = 0.05;
+// radius of the smoothing with a larger neighborhood
+static constexpr int RADIUS = 3;
+// side of the cells of the heatmap, the default of the executables
+static constexpr int CELL = 32;
+
+// reference cycles (TSC, at the nominal frequency) where available
+#if defined(__x86_64__) || defined(__i386__)
+static constexpr bool HAS_CYCLES = true;
+static inline uint64_t read_cycles() { return __rdtsc(); }
+#else
+static constexpr bool HAS_CYCLES = false;
+static inline uint64_t read_cycles() { return 0; }
+#endif
+
+
+// inputs of the kernels for a resolution and a motion density
+struct bench_frames {
+    Mat frame_rgb;      // frame as generated
+    Mat work_rgb;       // copy of frame_rgb for the kernels working in place
+    Mat frame_gray;     // frame_rgb in grayscale (continuous)
+    Mat frame_smooth;   // frame_gray smoothed
+    Mat background;     // background in grayscale, smoothed
+    Mat out;            // output of the smoothing kernels
+};
+
+/**
+ * @brief a kernel to be measured
+ *
+ * 'prepare' runs before every repetition and isn't timed (e.g. to restore
+ * the input of the kernels working in place); 'bytes' is the traffic of a
+ * call, i.e. the bytes read plus the bytes written. A kernel specialized
+ * at compile time is measured only for the widths it 'supports'. The gain
+ * of a kernel over its 'baseline' (the generic kernel, or the one without
+ * the heatmap) is reported.
+ */
+struct bench_kernel {
+    string name;
+    bool parallel;      // whether it takes a number of workers
+    function<size_t(int rows, int cols)> bytes;
+    function<void(bench_frames &)> prepare;
+    function<void(bench_frames &, int nw)> run;
+    string baseline = "";
+    function<bool(int cols)> supports = nullptr;     // nullptr: all the widths
+};
+
+// measures of a kernel on an input with a number of workers
+struct bench_result {
+    string kernel;
+    int rows, cols;
+    double density;
+    int nw;
+    size_t reps;
+    double median_us, p99_us, mean_us;
+    size_t bytes;
+    double bytes_per_cycle;     // 0 if cycles aren't available
+    string baseline;            // generic kernel, for the specialized ones and the heatmap
+    double gain;                // median of the baseline / median (0 if unknown)
+};
+
+
+// prints the usage of the program
+void print_usage(string prog_name) {
+    cout << "Usage: " << prog_name << " [options]" << endl
+         << "Measures the kernels on synthetic frames, for every resolution, "
+         << "motion density and number of workers." << endl
+         << "Options:" << endl
+         << "  --sizes=<WxH,...>\tresolutions (default 640x360,1280x720,1920x1080)" << endl
+         << "  --density=<d,...>\tfraction of the pixels changed by the motion "
+         << "(default 0,0.05,0.5)" << endl
+         << "  --nw=<n,...>\tnumbers of workers of the parallel kernels "
+         << "(default powers of 2 up to the budget, and the budget)" << endl
+         << "  --reps=<n>\ttimed repetitions of every measure (default 50)" << endl
+         << "  --warmup=<n>\trepetitions before the timed ones (default 5)" << endl
+         << "  --kernels=<name,...>\tkernels to be measured (default all)" << endl
+         << "  --simd=<isa>\tmax instruction set of the vectorized kernels "
+         << "(scalar, sse4, avx2, avx512)" << endl
+         << "  --budget=<n>\tmax threads working on a frame (default: number of cores)" << endl
+         << "  --json=<path>\tfile of the results (default kernel_bench.json)" << endl
+         << "  --tag=<text>\tlabel saved with the results, e.g. the commit" << endl;
+}
+
+
+// splits "a,b,c"
+static vector<string> split_list(const string &list) {
+    vector<string> items;
+    stringstream in(list);
+    string item;
+    while (getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+
+// all the variants of the kernels
+static vector<bench_kernel> all_kernels() {
+    auto gray_bytes = [](int rows, int cols) { return size_t(rows) * cols * 4; };
+    auto smooth_bytes = [](int rows, int cols) { return size_t(rows) * cols * 2; };
+    auto detect_bytes = [](int rows, int cols) { return size_t(rows) * cols * 2; };
+    auto fused_bytes = [](int rows, int cols) { return size_t(rows) * cols * 4; };
+    auto restore = [](bench_frames &f) { f.frame_rgb.copyTo(f.work_rgb); };
+    auto nothing = [](bench_frames &) {};
+    // filled by the heatmap kernels (measured one at a time)
+    auto map = make_shared<motion_map>();
+
+    return {
+        {"rgb2gray", true, gray_bytes, restore,
+         [](bench_frames &f, int nw) { rgb2gray(&f.work_rgb, nw); }},
+        {"rgb2gray_simd", true, gray_bytes, restore,
+         [](bench_frames &f, int nw) { rgb2gray_simd(&f.work_rgb, nw); }},
+        {"smooth_clean_code", false, smooth_bytes, nothing,
+         [](bench_frames &f, int) { smooth_clean_code(&f.frame_gray, &f.out); }},
+        {"smooth", true, smooth_bytes, nothing,
+         [](bench_frames &f, int nw) { smooth(&f.frame_gray, &f.out, nw); }},
+        {"smooth_simd", true, smooth_bytes, nothing,
+         [](bench_frames &f, int nw) { smooth_simd(&f.frame_gray, &f.out, nw); }},
+        {"smooth_specialized", true, smooth_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             specialized_smooth(f.out.cols, 1)(&f.frame_gray, &f.out, nw); },
+         "smooth", [](int cols) { return specialized_smooth(cols, 1) != nullptr; }},
+        {"smooth_radius", true, smooth_bytes, nothing,
+         [](bench_frames &f, int nw) { smooth_radius(&f.frame_gray, &f.out, RADIUS, nw); }},
+        {"smooth_radius_specialized", true, smooth_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             specialized_smooth(f.out.cols, RADIUS)(&f.frame_gray, &f.out, nw); },
+         "smooth_radius", [](int cols) { return specialized_smooth(cols, RADIUS) != nullptr; }},
+        {"motion_detect", true, detect_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             motion_detect(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw); }},
+        {"motion_detect_simd", true, detect_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             motion_detect_simd(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw); }},
+        {"motion_detect_specialized", true, detect_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             specialized_motion_detect(f.background.cols, MIN_DIFF)(&f.background,
+                                                                    &f.frame_smooth, PERC, nw); },
+         "motion_detect",
+         [](int cols) { return specialized_motion_detect(cols, MIN_DIFF) != nullptr; }},
+        {"motion_detect_map", true, detect_bytes, nothing,
+         [map](bench_frames &f, int nw) {
+             map->reset(f.background.rows, f.background.cols, CELL);
+             motion_detect_map(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw, *map, false); },
+         "motion_detect"},
+        {"motion_detect_map_box", true, detect_bytes, nothing,
+         [map](bench_frames &f, int nw) {
+             map->reset(f.background.rows, f.background.cols, CELL);
+             motion_detect_map(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw, *map, true); },
+         "motion_detect"},
+        {"motion_detect_early_exit", true, detect_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             motion_detect_early_exit(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw); }},
+        {"fused_motion_detect", true, fused_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             fused_motion_detect(&f.background, &f.frame_rgb, MIN_DIFF, PERC, nw); }},
+        {"fused_motion_detect_simd", true, fused_bytes, nothing,
+         [](bench_frames &f, int nw) {
+             fused_motion_detect_simd(&f.background, &f.frame_rgb, MIN_DIFF, PERC, nw); }},
+    };
+}
+
+
+// builds the inputs of the kernels for a resolution and a motion density
+static void make_frames(bench_frames &f, int rows, int cols, double density) {
+    synthetic_frames generator(rows, cols, density);
+
+    Mat background_rgb = generator.background().clone();
+    Mat *background_gray = rgb2gray(&background_rgb, 1);
+    f.background.create(rows, cols, CV_8UC1);
+    smooth(background_gray, &f.background, 1);
+
+    generator.frame(1, f.frame_rgb);
+    f.frame_rgb.copyTo(f.work_rgb);
+    Mat *gray = rgb2gray(&f.work_rgb, 1);
+    f.frame_gray.create(rows, cols, CV_8UC1);
+    for (int i = 0; i < rows; i++)
+        std::copy(gray->ptr<uchar>(i), gray->ptr<uchar>(i) + cols, f.frame_gray.ptr<uchar>(i));
+    f.frame_smooth.create(rows, cols, CV_8UC1);
+    smooth(&f.frame_gray, &f.frame_smooth, 1);
+    f.out.create(rows, cols, CV_8UC1);
+}
+
+
+/**
+ * @brief compares the counts of motion_detect_map with the ones of the
+ * cells counted a pixel at a time
+ *
+ * @param f frames of the benchmark (background and frame_smooth are compared)
+ * @param cell side of the cells
+ * @param nw number of threads used by motion_detect_map
+ * @return number of cells whose count differs
+ */
+static int check_motion_map(bench_frames &f, int cell, int nw) {
+    int rows = f.background.rows, cols = f.background.cols;
+    motion_map map;
+    map.reset(rows, cols, cell);
+    motion_detect_map(&f.background, &f.frame_smooth, MIN_DIFF, PERC, nw, map, true);
+    vector<unsigned> expected(map.counts.size(), 0);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            expected[size_t(i / cell) * map.cells_x + j / cell] +=
+                unsigned(abs(f.background.at<uchar>(i, j) - f.frame_smooth.at<uchar>(i, j))) >
+                MIN_DIFF;
+    int wrong = 0;
+    for (size_t c = 0; c < expected.size(); c++)
+        wrong += expected[c] != map.counts[c];
+    return wrong;
+}
+
+
+// value at quantile q (0 .. 1) of sorted samples
+static double quantile(const vector<double> &sorted, double q) {
+    size_t i = std::min(sorted.size() - 1, size_t(std::ceil(q * sorted.size())) - 1);
+    return sorted[i];
+}
+
+
+// runs a kernel 'warmup' times, then measures 'reps' runs
+static bench_result measure(const bench_kernel &kernel, bench_frames &f, int rows, int cols,
+                            double density, int nw, size_t warmup, size_t reps) {
+    for (size_t r = 0; r < warmup; r++) {
+        kernel.prepare(f);
+        kernel.run(f, nw);
+    }
+
+    vector<double> times_us(reps);
+    vector<double> cycles(reps);
+    for (size_t r = 0; r < reps; r++) {
+        kernel.prepare(f);
+        auto start = chrono::steady_clock::now();
+        uint64_t start_cycles = read_cycles();
+        kernel.run(f, nw);
+        uint64_t stop_cycles = read_cycles();
+        auto stop = chrono::steady_clock::now();
+        times_us[r] = chrono::duration<double, micro>(stop - start).count();
+        cycles[r] = double(stop_cycles - start_cycles);
+    }
+    double mean_us = std::accumulate(times_us.begin(), times_us.end(), 0.0) / reps;
+    std::sort(times_us.begin(), times_us.end());
+    std::sort(cycles.begin(), cycles.end());
+
+    bench_result result;
+    result.kernel = kernel.name;
+    result.rows = rows;
+    result.cols = cols;
+    result.density = density;
+    result.nw = nw;
+    result.reps = reps;
+    result.median_us = quantile(times_us, 0.5);
+    result.p99_us = quantile(times_us, 0.99);
+    result.mean_us = mean_us;
+    result.bytes = kernel.bytes(rows, cols);
+    double median_cycles = quantile(cycles, 0.5);
+    result.bytes_per_cycle = median_cycles > 0 ? result.bytes / median_cycles : 0;
+    result.baseline = kernel.baseline;
+    result.gain = 0;
+    return result;
+}
+
+
+// string quoted for JSON
+static string json_string(const string &s) {
+    string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        if (c >= 0 && c < 0x20)
+            continue;
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+
+// writes the results as a JSON object, with the setup of the run
+static void write_json(const string &path, const string &tag,
+                       const vector<bench_result> &results) {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    ofstream out(path);
+    out << "{" << endl
+        << "  \"tag\": " << json_string(tag) << "," << endl
+        << "  \"host\": " << json_string(host) << "," << endl
+        << "  \"date\": " << json_string(date) << "," << endl
+        << "  \"compiler\": " << json_string(__VERSION__) << "," << endl
+        << "  \"simd\": " << json_string(simd_isa_name(active_simd_isa())) << "," << endl
+        << "  \"cores\": " << std::thread::hardware_concurrency() << "," << endl
+        << "  \"budget\": " << tile_pool::budget() << "," << endl
+        << "  \"cycles\": " << json_string(HAS_CYCLES ? "tsc" : "none") << "," << endl
+        << "  \"min_diff\": " << MIN_DIFF << "," << endl
+        << "  \"perc\": " << PERC << "," << endl
+        << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result &r = results[i];
+        out << "    {\"kernel\": " << json_string(r.kernel)
+            << ", \"rows\": " << r.rows << ", \"cols\": " << r.cols
+            << ", \"density\": " << r.density << ", \"nw\": " << r.nw
+            << ", \"reps\": " << r.reps
+            << ", \"median_us\": " << r.median_us << ", \"p99_us\": " << r.p99_us
+            << ", \"mean_us\": " << r.mean_us << ", \"bytes\": " << r.bytes
+            << ", \"bytes_per_cycle\": " << r.bytes_per_cycle;
+        if (!r.baseline.empty())
+            out << ", \"baseline\": " << json_string(r.baseline) << ", \"gain\": " << r.gain;
+        out << "}"
+            << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+}
+
+
+int main(int argc, char** argv) {
+    cli_options args(argc, argv);
+    if (args.n_positional() > 1 || args.has("help")) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    // the main thread calls the kernels, the rest of the budget is for the
+    // intra-frame pool
+    tile_pool::configure(args.get_int("budget", 0), 1);
+    if (args.has("simd") && !args.get("simd").empty() && !limit_simd_isa(args.get("simd")))
+        cout << "Unknown instruction set '" << args.get("simd") << "', ignored" << endl;
+
+    vector<pair<int, int>> sizes;     // (rows, cols)
+    for (const string &size : split_list(args.get("sizes", "640x360,1280x720,1920x1080"))) {
+        int cols = 0, rows = 0;
+        if (sscanf(size.c_str(), "%dx%d", &cols, &rows) == 2 && rows >= 3 && cols >= 3)
+            sizes.push_back({rows, cols});
+        else
+            cout << "Invalid size '" << size << "', ignored" << endl;
+    }
+    vector<double> densities;
+    for (const string &d : split_list(args.get("density", "0,0.05,0.5")))
+        densities.push_back(atof(d.c_str()));
+    vector<int> nws;
+    for (const string &n : split_list(args.get("nw", "")))
+        if (atoi(n.c_str()) > 0)
+            nws.push_back(atoi(n.c_str()));
+    if (nws.empty()) {
+        for (int n = 1; n <= tile_pool::budget(); n *= 2)
+            nws.push_back(n);
+        if (nws.back() != tile_pool::budget())
+            nws.push_back(tile_pool::budget());
+    }
+    size_t reps = max(args.get_int("reps", 50), 1);
+    size_t warmup = max(args.get_int("warmup", 5), 0);
+
+    vector<bench_kernel> kernels = all_kernels();
+    if (args.has("kernels")) {
+        vector<string> names = split_list(args.get("kernels"));
+        kernels.erase(std::remove_if(kernels.begin(), kernels.end(), [&](const bench_kernel &k) {
+            return std::find(names.begin(), names.end(), k.name) == names.end();
+        }), kernels.end());
+    }
+
+    cout << "Kernels with the " << simd_isa_name(active_simd_isa())
+         << " instruction set, budget of " << tile_pool::budget() << " threads" << endl;
+    cout << "kernel\tsize\tdensity\tnw\tmedian (us)\tp99 (us)\tbytes/cycle\tgain" << endl;
+    vector<bench_result> results;
+    bench_frames frames;
+    for (auto &size : sizes)
+        for (double density : densities) {
+            make_frames(frames, size.first, size.second, density);
+            // the map is checked on every run, also with several threads
+            // handing out the rows of cells
+            for (int cell : {CELL, 2 * CELL})
+                for (int nw : {1, max(tile_pool::budget(), 2)}) {
+                    int wrong = check_motion_map(frames, cell, nw);
+                    if (wrong > 0) {
+                        cout << "motion_detect_map: " << wrong << " wrong cells on "
+                             << size.second << "x" << size.first << " with cells of " << cell
+                             << " and " << nw << " threads" << endl;
+                        return -1;
+                    }
+                }
+            for (const bench_kernel &kernel : kernels) {
+                if (kernel.supports && !kernel.supports(size.second))
+                    continue;
+                for (int nw : kernel.parallel ? nws : vector<int>{1}) {
+                    bench_result r = measure(kernel, frames, size.first, size.second,
+                                             density, nw, warmup, reps);
+                    // the gain of a specialized kernel over the generic one
+                    // measured on the same input
+                    for (const bench_result &b : results)
+                        if (b.kernel == r.baseline && b.rows == r.rows && b.cols == r.cols &&
+                            b.density == r.density && b.nw == r.nw && r.median_us > 0)
+                            r.gain = b.median_us / r.median_us;
+                    cout << r.kernel << "\t" << r.cols << "x" << r.rows << "\t" << r.density
+                         << "\t" << r.nw << "\t" << r.median_us << "\t" << r.p99_us
+                         << "\t" << r.bytes_per_cycle << "\t";
+                    if (r.gain > 0)
+                        cout << r.gain << "x";
+                    else
+                        cout << "-";
+                    cout << endl;
+                    results.push_back(r);
+                }
+            }
+        }
+
+    string json = args.get("json", "kernel_bench.json");
+    write_json(json, args.get("tag"), results);
+    cout << "Results written to " << json << endl;
+    return 0;
+}
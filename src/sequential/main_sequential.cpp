@@ -1,10 +1,20 @@
 #include <iostream>
 #include <chrono>
+#include <memory>
 
 #include "opencv2/opencv.hpp"
 
 #include "auxiliary/timer.hpp"
+#include "auxiliary/cli.hpp"
+#include "auxiliary/frame_pool.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/trace.hpp"
+#include "auxiliary/placement.hpp"
 #include "sequential/sequential_funcs.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+#include "parallel/motion_detector.hpp"
 
 
 using namespace std;
@@ -17,66 +27,99 @@ void print_usage(string prog_name) {
          << "[<n workers motion_detect>]" << endl;
     cout << "Arguments in square brackets are optional." << endl;
     cout << "Default values are 1 for each argument." << endl;
+    print_pipeline_options();
+    cout << "  --huge-pages\tback the frame buffer with transparent huge pages" << endl;
 }
 
 int main(int argc, char** argv) {
     // check CLI arguments
-    if (argc < 2 || argc > 5) {
+    cli_options args(argc, argv);
+    if (args.n_positional() < 2 || args.n_positional() > 5) {
         print_usage(argv[0]);
         return -1;
     }
-    int nw_rgb2gray = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 1;
-    int nw_smooth = argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1;
-    int nw_motion_detect = argc > 4 && atoi(argv[4]) > 0 ? atoi(argv[4]) : 1;
+    pipeline_params params = parse_pipeline_params(args, 2);
+
+    // the main thread calls the kernels, the rest of the budget is for the
+    // intra-frame pool
+    tile_pool::configure(args.get_int("budget", 0), 1);
+    // with --trace, where the time goes (written at the end)
+    trace_session trace(args.has("trace"), args.get("trace"));
+    // with --pin, the main thread and the intra-frame pool pinned to cores
+    if (args.has("pin") && placement::configure(args.get("pin"), 0, 1, 0))
+        placement::pin_self(thread_role::worker, 0);
 
     // timer for the overall completion time
     timer<std::chrono::milliseconds> t("Overall completion time");
 
-    // read video
-    VideoCapture cap(argv[1]);
+    // read video (Y4M and raw YUV files are mapped in memory)
+    unique_ptr<VideoCapture> cap = open_video(args[1], params);
 
     // take background image (i.e. frist frame)
-    int rows = cap.get(CAP_PROP_FRAME_HEIGHT);
-    int cols = cap.get(CAP_PROP_FRAME_WIDTH);
-    Mat *background_rgb = new Mat(rows, cols, CV_8UC3);
-    cap >> *background_rgb;
-    
-    // convert background image to gray scale and smooth it
-    Mat *background_gray = rgb2gray(background_rgb, nw_rgb2gray);
-    Mat *background = new Mat(rows, cols, CV_8UC1);
-    smooth(background_gray, background, nw_smooth);
-    delete background_rgb, background_gray;
-
-    Mat *frame_rgb = new Mat(rows, cols, CV_8UC3);
-    Mat *frame_gray;
-    Mat *frame = new Mat(rows, cols, CV_8UC1);
-    bool motion_detected = false;
-    int n_frame = 1, n_motion_frames = 0;
+    int rows = cap->get(CAP_PROP_FRAME_HEIGHT);
+    int cols = cap->get(CAP_PROP_FRAME_WIDTH);
+    Mat background_rgb(rows, cols, CV_8UC3);
+    *cap >> background_rgb;
+
+    bool print_frames = args.has("print-frames");
+    size_t n_frame = 1;         // position in the video of the frame read
+    int n_motion_frames = 0;
+    auto emit = [&](size_t n_frame, bool motion) {
+        if (!motion)
+            return;
+        n_motion_frames++;
+        if (print_frames)
+            cout << "Motion detected in frame " << n_frame << endl;
+    };
+    // with --sample, the results of the frames skipped come from the sampler
+    unique_ptr<temporal_sampler> sampler;
+
+    // the frames are processed on this thread by the sequential backend of
+    // the engine, which turns the first frame into the background (with what
+    // the options ask for) and delivers the result of a frame before submit
+    // returns, so n_frame is still the position of that frame in the video
+    motion_detector detector(background_rgb, params, detector_backend::sequential, 1,
+                             [&](size_t, bool motion, Mat *) {
+        if (sampler)
+            sampler->sample(n_frame, motion);
+        else
+            emit(n_frame, motion);
+    });
+    if (params.stride > 1)
+        sampler.reset(new temporal_sampler(args[1], detector.background(), detector.params(),
+                                           emit));
+
+    // the frames are read always in the same (pooled) buffer (the frames
+    // of mapped videos are views of the file, with no buffer)
+    frame_pool pool(rows, cols, params.gray_frames ? CV_8UC1 : CV_8UC3, 1,
+                    args.has("huge-pages"), params.gray_frames);
+    Mat *frame_rgb = pool.acquire();
     
-    // process all frames one by one
+    // process all frames one by one (one every params.stride with --sample)
     while (true) {
-        cap >> *frame_rgb;
+        {
+            trace_span span(trace_stage::decode, n_frame);
+            *cap >> *frame_rgb;
+        }
         if (frame_rgb->empty())
             break;
-        
-        // frame to grayscale
-        frame_gray = rgb2gray(frame_rgb, nw_rgb2gray);
-
-        // smooth the grayscale frame
-        smooth(frame_gray, frame, nw_smooth);
 
-        // motion detection
-        if (motion_detect(background, frame, 10, 0.05, nw_motion_detect)) {
-            n_motion_frames++;
-            // cout << "Motion detected in frame " << n_frame << endl;
-        }
+        // grayscale, smoothing and motion detection
+        detector.submit(frame_rgb);
         n_frame++;
+        n_frame += skip_frames(*cap, params.stride - 1);
+    }
+    if (sampler) {
+        sampler->finish();
+        sampler->report();
     }
 
     // free the memory
-    delete background, frame_rgb, frame_gray, frame;
-    cap.release();
+    pool.release(frame_rgb);
+    cap->release();
 
+    detector.report();
+    placement::report();
     cout << "Number of frames with detected motion: " << n_motion_frames << endl;
 
     return n_motion_frames;
@@ -0,0 +1,331 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/mapped_video.hpp"
+
+
+/**
+ * @brief a YUV file mapped in memory, with the position of the Y plane of
+ * every frame
+ */
+struct yuv_file {
+    const uchar *data = nullptr;
+    size_t bytes = 0;
+    int width = 0, height = 0;
+    double fps = 0;                 // 0 if unknown
+    std::vector<size_t> y_offsets;  // Y plane of frame i: data + y_offsets[i]
+
+    yuv_file() {}
+    yuv_file(const yuv_file &) = delete;
+    yuv_file &operator=(const yuv_file &) = delete;
+
+    // destructor
+    ~yuv_file() {
+        if (data != nullptr)
+            munmap(const_cast<uchar *>(data), bytes);
+    }
+
+    // bytes of a Y plane
+    size_t plane_bytes() const { return size_t(width) * height; }
+};
+
+
+// lowercase extension of a path ("" if none)
+static std::string extension(const std::string &path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+
+// bytes of a 4:2:0 frame (the layout of both .yuv and .nv12 files)
+static size_t yuv420_frame_bytes(int width, int height) {
+    return size_t(width) * height + 2 * size_t((width + 1) / 2) * ((height + 1) / 2);
+}
+
+
+/**
+ * @brief reads the header of a Y4M file and finds its frames
+ *
+ * @return false if the file is not a Y4M file with 8 bits per sample
+ */
+static bool index_y4m(yuv_file &file, const std::string &path) {
+    const char *text = reinterpret_cast<const char *>(file.data);
+    const char *end = text + file.bytes;
+    const char *eol = static_cast<const char *>(std::memchr(text, '\n', file.bytes));
+    if (eol == nullptr || file.bytes < 10 || std::strncmp(text, "YUV4MPEG2 ", 10) != 0) {
+        std::cerr << path << " is not a Y4M file" << std::endl;
+        return false;
+    }
+
+    std::string colorspace = "420jpeg";
+    std::string header(text + 10, eol);
+    size_t start = 0;
+    while (start < header.size()) {
+        size_t space = header.find(' ', start);
+        std::string token = header.substr(start, space == std::string::npos ?
+                                                 std::string::npos : space - start);
+        if (!token.empty()) {
+            if (token[0] == 'W')
+                file.width = std::atoi(token.c_str() + 1);
+            else if (token[0] == 'H')
+                file.height = std::atoi(token.c_str() + 1);
+            else if (token[0] == 'C')
+                colorspace = token.substr(1);
+            else if (token[0] == 'F') {
+                int num = 0, den = 0;
+                if (std::sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && den > 0)
+                    file.fps = double(num) / den;
+            }
+        }
+        start = space == std::string::npos ? header.size() : space + 1;
+    }
+
+    size_t w = file.width, h = file.height;
+    size_t frame_bytes;
+    if (colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2" ||
+        colorspace == "420")
+        frame_bytes = yuv420_frame_bytes(w, h);
+    else if (colorspace == "422")
+        frame_bytes = w * h + 2 * ((w + 1) / 2) * h;
+    else if (colorspace == "444")
+        frame_bytes = 3 * w * h;
+    else if (colorspace == "444alpha")
+        frame_bytes = 4 * w * h;
+    else if (colorspace == "411")
+        frame_bytes = w * h + 2 * ((w + 3) / 4) * h;
+    else if (colorspace == "mono")
+        frame_bytes = w * h;
+    else {
+        std::cerr << "Unsupported Y4M colorspace " << colorspace << " in " << path << std::endl;
+        return false;
+    }
+    if (w == 0 || h == 0) {
+        std::cerr << "No frame size in the header of " << path << std::endl;
+        return false;
+    }
+
+    // every frame is "FRAME[ <parameters>]\n" followed by the planes (a
+    // truncated last frame is ignored)
+    const char *p = eol + 1;
+    while (end - p > 5 && std::strncmp(p, "FRAME", 5) == 0) {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (nl == nullptr || size_t(end - (nl + 1)) < frame_bytes)
+            break;
+        file.y_offsets.push_back(nl + 1 - text);
+        p = nl + 1 + frame_bytes;
+    }
+    return true;
+}
+
+
+/**
+ * @brief finds the frames of a raw 4:2:0 file (.yuv or .nv12), whose size
+ * is the last "<width>x<height>" in the file name
+ *
+ * @return false if the size is not in the file name
+ */
+static bool index_raw(yuv_file &file, const std::string &path) {
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    static const std::regex size_pattern("([0-9]+)x([0-9]+)");
+    for (auto it = std::sregex_iterator(name.begin(), name.end(), size_pattern);
+         it != std::sregex_iterator(); ++it) {
+        file.width = std::stoi((*it)[1]);
+        file.height = std::stoi((*it)[2]);
+    }
+    if (file.width == 0 || file.height == 0) {
+        std::cerr << "The size of the frames of " << path << " must be in its name "
+                  << "(e.g. video_1920x1080." << extension(path) << ")" << std::endl;
+        return false;
+    }
+
+    // the Y plane comes first in both layouts, the chroma planes (U and V
+    // planes, or interleaved UV plane) follow
+    size_t frame_bytes = yuv420_frame_bytes(file.width, file.height);
+    for (size_t offset = 0; offset + frame_bytes <= file.bytes; offset += frame_bytes)
+        file.y_offsets.push_back(offset);
+    return true;
+}
+
+
+/**
+ * @brief maps a file and finds its frames, once per path
+ *
+ * @return the file (nullptr if it can't be mapped or isn't supported)
+ */
+static std::shared_ptr<const yuv_file> map_file(const std::string &path) {
+    static std::mutex m;
+    static std::map<std::string, std::shared_ptr<const yuv_file>> mapped;
+    std::lock_guard<std::mutex> lk(m);
+    auto it = mapped.find(path);
+    if (it != mapped.end())
+        return it->second;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << "Cannot open " << path << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+    std::shared_ptr<yuv_file> file(new yuv_file());
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map " << path << std::endl;
+        return nullptr;
+    }
+    file->data = static_cast<const uchar *>(p);
+    file->bytes = st.st_size;
+    // no readahead: it would bring in the chroma planes too, the Y planes
+    // are prefetched explicitly
+    madvise(p, file->bytes, MADV_RANDOM);
+
+    bool indexed = extension(path) == "y4m" ? index_y4m(*file, path) : index_raw(*file, path);
+    if (!indexed)
+        return nullptr;
+    mapped[path] = file;
+    return file;
+}
+
+
+bool mapped_video::supports(const std::string &path) {
+    std::string ext = extension(path);
+    return ext == "y4m" || ext == "yuv" || ext == "nv12";
+}
+
+
+void mapped_video::prefetch(size_t i) const {
+    if (i >= file->y_offsets.size())
+        return;
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = file->y_offsets[i] / page * page;
+    size_t last = file->y_offsets[i] + file->plane_bytes();
+    madvise(const_cast<uchar *>(file->data) + first, last - first, MADV_WILLNEED);
+}
+
+
+bool mapped_video::open(const cv::String &filename, int api_preference) {
+    release();
+    file = map_file(filename);
+    if (!file)
+        return false;
+    for (size_t i = 0; i < PREFETCH_FRAMES; i++)
+        prefetch(i);
+    return true;
+}
+
+
+bool mapped_video::isOpened() const {
+    return file != nullptr;
+}
+
+
+void mapped_video::release() {
+    file.reset();
+    pos = 0;
+    grabbed = false;
+}
+
+
+bool mapped_video::grab() {
+    grabbed = file && pos < file->y_offsets.size();
+    if (!grabbed)
+        return false;
+    prefetch(pos + PREFETCH_FRAMES);
+    pos++;
+    return true;
+}
+
+
+bool mapped_video::retrieve(cv::OutputArray image, int flag) {
+    if (!grabbed) {
+        if (image.kind() == cv::_InputArray::MAT)
+            image.getMatRef() = cv::Mat();
+        return false;
+    }
+    // the mapping is read-only, the kernels never write to the frames
+    cv::Mat view(file->height, file->width, CV_8UC1,
+                 const_cast<uchar *>(file->data) + file->y_offsets[pos - 1]);
+    if (image.kind() == cv::_InputArray::MAT)
+        image.getMatRef() = view;
+    else
+        view.copyTo(image);
+    return true;
+}
+
+
+bool mapped_video::read(cv::OutputArray image) {
+    grab();
+    return retrieve(image);
+}
+
+
+cv::VideoCapture &mapped_video::operator>>(cv::Mat &image) {
+    read(image);
+    return *this;
+}
+
+
+bool mapped_video::set(int prop_id, double value) {
+    if (!file || prop_id != cv::CAP_PROP_POS_FRAMES)
+        return false;
+    pos = std::min<size_t>(std::max(value, 0.0), file->y_offsets.size());
+    grabbed = false;
+    for (size_t i = 0; i < PREFETCH_FRAMES; i++)
+        prefetch(pos + i);
+    return true;
+}
+
+
+double mapped_video::get(int prop_id) const {
+    if (!file)
+        return 0;
+    switch (prop_id) {
+        case cv::CAP_PROP_POS_FRAMES:
+            return pos;
+        case cv::CAP_PROP_FRAME_COUNT:
+            return file->y_offsets.size();
+        case cv::CAP_PROP_FRAME_WIDTH:
+            return file->width;
+        case cv::CAP_PROP_FRAME_HEIGHT:
+            return file->height;
+        case cv::CAP_PROP_FPS:
+            return file->fps;
+        default:
+            return 0;
+    }
+}
+
+
+std::unique_ptr<cv::VideoCapture> make_capture(const std::string &path) {
+    if (mapped_video::supports(path))
+        return std::unique_ptr<cv::VideoCapture>(new mapped_video());
+    return std::unique_ptr<cv::VideoCapture>(new cv::VideoCapture());
+}
+
+
+std::unique_ptr<cv::VideoCapture> open_video(const std::string &path, pipeline_params &params) {
+    std::unique_ptr<cv::VideoCapture> cap = make_capture(path);
+    cap->open(path);
+    if (mapped_video::supports(path))
+        use_gray_frames(params);
+    return cap;
+}
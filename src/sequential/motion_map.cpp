@@ -0,0 +1,64 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "sequential/motion_map.hpp"
+
+
+using namespace std;
+
+motion_heatmap::motion_heatmap(int rows, int cols, int cell, bool with_boxes,
+                               const string &prefix) :
+        rows(rows), cols(cols), cell(cell), with_boxes(with_boxes), prefix(prefix),
+        counts(size_t((cols + cell - 1) / cell) * ((rows + cell - 1) / cell), 0) {}
+
+
+void motion_heatmap::add(size_t n_frame, bool motion, const motion_map &map) {
+    if (!motion || map.counts.size() != counts.size())
+        return;
+    lock_guard<mutex> lk(m);
+    for (size_t c = 0; c < counts.size(); c++)
+        counts[c] += map.counts[c];
+    if (with_boxes) {
+        boxes.emplace_back(n_frame, map.box);
+        overall.merge(map.box);
+    }
+    n_frames++;
+}
+
+
+void motion_heatmap::write() {
+    lock_guard<mutex> lk(m);
+    int cells_x = (cols + cell - 1) / cell;
+    ofstream out(prefix + ".csv");
+    for (size_t c = 0; c < counts.size(); c++)
+        out << counts[c] << ((c + 1) % cells_x == 0 ? "\n" : ",");
+    cout << "Motion heatmap of " << n_frames << " frames (cells of " << cell << "x" << cell
+         << " pixels) written to " << prefix << ".csv" << endl;
+    if (!with_boxes)
+        return;
+
+    sort(boxes.begin(), boxes.end(),
+         [](const pair<size_t, motion_box> &a, const pair<size_t, motion_box> &b) {
+        return a.first < b.first;
+    });
+    ofstream out_boxes(prefix + "_boxes.csv");
+    out_boxes << "frame,x0,y0,x1,y1" << endl;
+    for (auto &b : boxes)
+        out_boxes << b.first << "," << b.second.x0 << "," << b.second.y0 << ","
+                  << b.second.x1 << "," << b.second.y1 << "\n";
+    cout << "Rectangles of the motion written to " << prefix << "_boxes.csv";
+    if (!overall.empty())
+        cout << ", all within (" << overall.x0 << ", " << overall.y0 << ") - ("
+             << overall.x1 << ", " << overall.y1 << ")";
+    cout << endl;
+}
+
+
+std::unique_ptr<motion_heatmap> motion_heatmap::attach(const pipeline_params &params,
+                                                       int rows, int cols) {
+    if (params.cell_size <= 0)
+        return nullptr;
+    return std::unique_ptr<motion_heatmap>(new motion_heatmap(
+        rows, cols, params.cell_size, params.motion_box, params.heatmap_prefix));
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/pyramid.hpp"
+#include "sequential/sequential_funcs.hpp"
+#include "sequential/simd_funcs.hpp"
+#include "auxiliary/tile_pool.hpp"
+#include "auxiliary/timer.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+void rgb2gray_downsample(const Mat &rgb_img, Mat &small, int factor, int nw) {
+    int cols = small.cols;
+    const int block_bytes = 3 * factor;     // bytes of a block in a RGB row
+    const unsigned div = 3 * factor * factor;
+    tile_pool::get().for_row_tiles(small.rows, factor * rgb_img.cols * 3, nw,
+                                   [&](int first_row, int last_row) {
+        vector<unsigned> sums(cols);
+        for (int i = first_row; i < last_row; i++) {
+            fill(sums.begin(), sums.end(), 0);
+            for (int r = 0; r < factor; r++) {
+                const uchar *row = rgb_img.ptr<uchar>(i * factor + r);
+                for (int j = 0; j < cols; j++) {
+                    const uchar *block = row + j * block_bytes;
+                    unsigned s = 0;
+                    for (int k = 0; k < block_bytes; k++)
+                        s += block[k];
+                    sums[j] += s;
+                }
+            }
+            uchar *out = small.ptr<uchar>(i);
+            for (int j = 0; j < cols; j++)
+                out[j] = sums[j] / div;
+        }
+    });
+}
+
+
+pyramid_detector::pyramid_detector(const Mat &background_rgb, const pipeline_params &params) :
+        factor(params.pyramid_factor), margin(params.pyramid_margin),
+        radius(max(params.radius / params.pyramid_factor, 1)),
+        background(background_rgb.rows / params.pyramid_factor,
+                   background_rgb.cols / params.pyramid_factor, CV_8UC1) {
+    Mat small_gray(background.rows, background.cols, CV_8UC1);
+    coarse_frame(background_rgb, small_gray, background, params);
+}
+
+
+void pyramid_detector::coarse_frame(const Mat &rgb_img, Mat &small_gray, Mat &small_smooth,
+                                    const pipeline_params &params) const {
+    rgb2gray_downsample(rgb_img, small_gray, factor, params.nw_rgb2gray);
+    if (radius != 1)
+        smooth_radius(&small_gray, &small_smooth, radius, params.nw_smooth);
+    else if (params.simd)
+        smooth_simd(&small_gray, &small_smooth, params.nw_smooth);
+    else
+        smooth(&small_gray, &small_smooth, params.nw_smooth);
+}
+
+
+bool pyramid_detector::detect(Mat *frame_rgb, const pipeline_params &params,
+                              const function<bool()> &full_res) {
+    // buffers for the small frames, reused by each thread
+    thread_local Mat small_gray, small_smooth;
+    int rows = background.rows;
+    int cols = background.cols;
+
+    float perc_different_pixels = 0;
+    coarse_us += measure_us([&]() {
+        small_gray.create(rows, cols, CV_8UC1);
+        small_smooth.create(rows, cols, CV_8UC1);
+        coarse_frame(*frame_rgb, small_gray, small_smooth, params);
+
+        std::atomic<unsigned> n_different_pixels(0);
+        tile_pool::get().for_row_tiles(rows, 2 * cols, params.nw_motion_detect,
+                                       [&](int first_row, int last_row) {
+            unsigned n = 0;
+            for (int i = first_row; i < last_row; i++) {
+                const uchar *bg = background.ptr<uchar>(i);
+                const uchar *f = small_smooth.ptr<uchar>(i);
+                for (int j = 0; j < cols; j++)
+                    if (abs(bg[j] - f[j]) > params.min_diff)
+                        n++;
+            }
+            n_different_pixels += n;
+        });
+        perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    });
+    // one frame every SAMPLE_PERIOD goes to full resolution anyway, to
+    // estimate the speedup
+    bool sample = n_frames++ % SAMPLE_PERIOD == 0;
+    bool escalate = abs(perc_different_pixels - params.perc) <= margin;
+    if (!escalate && !sample)
+        return perc_different_pixels > params.perc;
+
+    bool motion = false;
+    full_us += measure_us([&]() { motion = full_res(); });
+    n_full++;
+    if (escalate)
+        n_escalated++;
+    return motion;
+}
+
+
+void pyramid_detector::report() const {
+    if (n_frames == 0)
+        return;
+    cout << "Frames escalated to full resolution: " << n_escalated << " / " << n_frames
+         << " (" << 100.0 * n_escalated / n_frames << "%)" << endl;
+    // time of all the frames at full resolution, from the ones computed
+    double all_full_us = double(full_us) / n_full * n_frames;
+    cout << "Speedup of the pyramid (estimated): "
+         << all_full_us / max<long>(coarse_us + full_us, 1) << endl;
+}
+
+
+std::unique_ptr<pyramid_detector> pyramid_detector::attach(pipeline_params &params,
+                                                           const Mat &background_rgb) {
+    if (params.pyramid_factor <= 1)
+        return nullptr;
+    if (background_rgb.rows / params.pyramid_factor < 3 ||
+        background_rgb.cols / params.pyramid_factor < 3) {
+        cout << "The video is too small for the pyramid, --pyramid ignored" << endl;
+        params.pyramid_factor = 1;
+        return nullptr;
+    }
+    std::unique_ptr<pyramid_detector> pyramid(new pyramid_detector(background_rgb, params));
+    params.pyramid = pyramid.get();
+    return pyramid;
+}
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/roi_mask.hpp"
+
+
+void roi_mask::compile_row(const uchar *row, int cols, std::vector<pixel_span> &out) {
+    int j = 0;
+    while (j < cols) {
+        for (; j < cols && row[j] == 0; j++);
+        int first = j;
+        for (; j < cols && row[j] != 0; j++);
+        if (j > first)
+            out.push_back({first, j});
+    }
+}
+
+
+roi_mask::roi_mask(const cv::Mat &mask) :
+        rows(mask.rows), cols(mask.cols), n_pixels(0) {
+    // the halo of row i is the region of rows i-1 .. i+1, grown by 1 column
+    std::vector<uchar> grown(cols);
+    for (int i = 0; i < rows; i++) {
+        row_first.push_back(spans.size());
+        compile_row(mask.ptr<uchar>(i), cols, spans);
+
+        std::fill(grown.begin(), grown.end(), 0);
+        for (int r = std::max(i - 1, 0); r <= std::min(i + 1, rows - 1); r++) {
+            const uchar *row = mask.ptr<uchar>(r);
+            for (int j = 0; j < cols; j++)
+                if (row[j] != 0)
+                    for (int c = std::max(j - 1, 0); c <= std::min(j + 1, cols - 1); c++)
+                        grown[c] = 1;
+        }
+        halo_row_first.push_back(halo_spans.size());
+        compile_row(grown.data(), cols, halo_spans);
+    }
+    row_first.push_back(spans.size());
+    halo_row_first.push_back(halo_spans.size());
+
+    for (auto &span : spans)
+        n_pixels += span.last - span.first;
+}
+
+
+std::unique_ptr<roi_mask> roi_mask::attach(pipeline_params &params, int rows, int cols) {
+    if (params.roi_path.empty())
+        return nullptr;
+    cv::Mat mask = cv::imread(params.roi_path, cv::IMREAD_GRAYSCALE);
+    if (mask.empty()) {
+        std::cout << "Cannot read the mask " << params.roi_path << ", --roi ignored" << std::endl;
+        return nullptr;
+    }
+    if (mask.rows != rows || mask.cols != cols) {
+        cv::Mat resized;
+        cv::resize(mask, resized, cv::Size(cols, rows), 0, 0, cv::INTER_NEAREST);
+        mask = resized;
+    }
+
+    std::unique_ptr<roi_mask> roi(new roi_mask(mask));
+    if (roi->area() == 0) {
+        std::cout << "The mask " << params.roi_path << " is empty, --roi ignored" << std::endl;
+        return nullptr;
+    }
+    std::cout << "Region of interest: " << roi->area() << " pixels ("
+              << 100.0 * roi->area() / (double(rows) * cols) << "% of the frame)" << std::endl;
+    params.roi = roi.get();
+    return roi;
+}
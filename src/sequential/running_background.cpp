@@ -0,0 +1,99 @@
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/running_background.hpp"
+#include "sequential/row_kernels.hpp"
+#include "sequential/simd_funcs.hpp"
+#include "auxiliary/tile_pool.hpp"
+
+
+running_background::running_background(const cv::Mat &background, int shift,
+                                       int max_threads) :
+        shift(std::min(std::max(shift, 1), 8)) {
+    int n_versions = 2 * std::max(max_threads, 1) + 1;
+    for (int v = 0; v < n_versions; v++) {
+        versions.emplace_back(new version);
+        versions[v]->acc.create(background.rows, background.cols, CV_16UC1);
+    }
+    background.convertTo(versions[0]->acc, CV_16UC1, 256);
+}
+
+
+int running_background::acquire() {
+    while (true) {
+        int v = current;
+        versions[v]->readers++;
+        // if it's still the current one, it can't be claimed until release
+        if (current == v)
+            return v;
+        versions[v]->readers--;
+    }
+}
+
+
+int running_background::claim() {
+    // with at most max_threads threads there's always a free version, but a
+    // reader may hold one for a moment while finding out it's not current
+    while (true) {
+        for (int v = 0; v < (int)versions.size(); v++) {
+            if (v == current || versions[v]->readers > 0 || versions[v]->claimed)
+                continue;
+            if (versions[v]->claimed.exchange(true))
+                continue;
+            // a version not current can become current only once claimed
+            if (v != current && versions[v]->readers == 0)
+                return v;
+            versions[v]->claimed = false;
+        }
+    }
+}
+
+
+bool running_background::detect(cv::Mat *frame_smooth, const pipeline_params &params) {
+    int rows = frame_smooth->rows;
+    int cols = frame_smooth->cols;
+    int read = acquire();
+    int write = claim();
+    const cv::Mat &acc = versions[read]->acc;
+    cv::Mat &acc_out = versions[write]->acc;
+
+    std::atomic<unsigned> n_different_pixels(0);
+    tile_pool::get().for_row_tiles(rows, 5 * cols, params.nw_motion_detect,
+                                   [&](int first_row, int last_row) {
+        unsigned n = 0;
+        for (int i = first_row; i < last_row; i++) {
+            const uint16_t *a = acc.ptr<uint16_t>(i);
+            const uchar *f = frame_smooth->ptr<uchar>(i);
+            uint16_t *out = acc_out.ptr<uint16_t>(i);
+            n += params.simd ?
+                detect_update_row_simd(a, f, out, cols, params.min_diff, shift) :
+                detect_update_row(a, f, out, cols, params.min_diff, shift);
+        }
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    bool motion = perc_different_pixels > params.perc;
+
+    // publish the updated background, unless another thread did it first
+    int expected = read;
+    if (!motion && current.compare_exchange_strong(expected, write))
+        n_updates++;
+    versions[write]->claimed = false;
+    release(read);
+    return motion;
+}
+
+
+std::unique_ptr<running_background> running_background::attach(pipeline_params &params,
+                                                               const cv::Mat &background,
+                                                               int max_threads) {
+    if (params.bg_shift == 0)
+        return nullptr;
+    std::unique_ptr<running_background> bg(
+        new running_background(background, params.bg_shift, max_threads));
+    params.running_bg = bg.get();
+    return bg;
+}
@@ -53,8 +53,6 @@ int main(int argc, char** argv) {
         delete background_rgb, gray_background;
 
         // variables for performance evaluation
-        chrono::system_clock::time_point start, stop;
-        long elapsed_musecs;
         vector<long> t_rgb2gray, t_smooth_clean_code, t_smooth_efficient, t_motion_detect;
 
         // allocate matrices for storing the results
@@ -70,51 +68,44 @@ int main(int argc, char** argv) {
                 break;
 
             // measure latency of conversion from RGB to grayscale
-            start = chrono::system_clock::now();
-            frame_gray = rgb2gray(frame_rgb, nw_rgb2gray);
-            stop = chrono::system_clock::now();
-            elapsed_musecs = chrono::duration_cast<chrono::microseconds>(stop - start).count();
-            t_rgb2gray.push_back(elapsed_musecs);
+            t_rgb2gray.push_back(measure_us([&]() {
+                frame_gray = rgb2gray(frame_rgb, nw_rgb2gray);
+            }));
             
             // measure latency of smoothing with function with cleaner code
-            start = chrono::system_clock::now();
-            smooth_clean_code(frame_gray, frame);
-            stop = chrono::system_clock::now();
-            elapsed_musecs = chrono::duration_cast<chrono::microseconds>(stop - start).count();
-            t_smooth_clean_code.push_back(elapsed_musecs);
+            t_smooth_clean_code.push_back(measure_us([&]() {
+                smooth_clean_code(frame_gray, frame);
+            }));
 
             // measure latency of smoothing with function with more efficient code
-            start = chrono::system_clock::now();
-            smooth(frame_gray, frame, nw_smooth);
-            stop = chrono::system_clock::now();
-            elapsed_musecs = chrono::duration_cast<chrono::microseconds>(stop - start).count();
-            t_smooth_efficient.push_back(elapsed_musecs);
+            t_smooth_efficient.push_back(measure_us([&]() {
+                smooth(frame_gray, frame, nw_smooth);
+            }));
 
             // measure latency of motion detection
-            start = chrono::system_clock::now();
-            if (motion_detect(background, frame, 10, 0.05, nw_motion_detect))
-                n_motion_frames++;
-            stop = chrono::system_clock::now();
-            elapsed_musecs = chrono::duration_cast<chrono::microseconds>(stop - start).count();
-            t_motion_detect.push_back(elapsed_musecs);
+            t_motion_detect.push_back(measure_us([&]() {
+                if (motion_detect(background, frame, 10, 0.05, nw_motion_detect))
+                    n_motion_frames++;
+            }));
         }
         // free the memory
         delete background, frame_rgb, frame_gray, frame;
 
-        // compute average time for each stage for the current attempt
+        // compute average time for each stage for the current attempt (the
+        // initial values set the type of the sums: long and double, not int)
         double size = double(t_rgb2gray.size());    // all vectors have the same size
         
         double cur_avg_rgb2gray = std::accumulate(
-            t_rgb2gray.begin(), t_rgb2gray.end(), 0) / size;
+            t_rgb2gray.begin(), t_rgb2gray.end(), 0L) / size;
         
         double cur_avg_smooth_clean_code = std::accumulate(
-            t_smooth_clean_code.begin(), t_smooth_clean_code.end(), 0) / size;
+            t_smooth_clean_code.begin(), t_smooth_clean_code.end(), 0L) / size;
         
         double cur_avg_smooth_efficient = std::accumulate(
-            t_smooth_efficient.begin(), t_smooth_efficient.end(), 0) / size;
+            t_smooth_efficient.begin(), t_smooth_efficient.end(), 0L) / size;
         
         double cur_avg_motion_detect = std::accumulate(
-            t_motion_detect.begin(), t_motion_detect.end(), 0) / size;
+            t_motion_detect.begin(), t_motion_detect.end(), 0L) / size;
         
         rgb2gray_attempts[t] = cur_avg_rgb2gray;
         smooth_clean_attempts[t] = cur_avg_smooth_clean_code;
@@ -136,16 +127,16 @@ int main(int argc, char** argv) {
     double size = double(n_attempts);
     
     double avg_rgb2gray = std::accumulate(
-        rgb2gray_attempts.begin(), rgb2gray_attempts.end(), 0) / size;
+        rgb2gray_attempts.begin(), rgb2gray_attempts.end(), 0.0) / size;
     
     double avg_smooth_clean_code = std::accumulate(
-        smooth_clean_attempts.begin(), smooth_clean_attempts.end(), 0) / size;
+        smooth_clean_attempts.begin(), smooth_clean_attempts.end(), 0.0) / size;
     
     double avg_smooth_efficient = std::accumulate(
-        smooth_efficient_attempts.begin(), smooth_efficient_attempts.end(), 0) / size;
+        smooth_efficient_attempts.begin(), smooth_efficient_attempts.end(), 0.0) / size;
     
     double avg_motion_detect = std::accumulate(
-        motion_detect_attempts.begin(), motion_detect_attempts.end(), 0) / size;
+        motion_detect_attempts.begin(), motion_detect_attempts.end(), 0.0) / size;
     
     // print results
     cout << "Average performance:" << endl;
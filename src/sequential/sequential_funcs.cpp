@@ -1,7 +1,14 @@
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include "opencv2/opencv.hpp"
 #include "sequential/sequential_funcs.hpp"
+#include "sequential/frame_pipeline.hpp"
+#include "sequential/row_kernels.hpp"
+#include "sequential/early_exit.hpp"
+#include "auxiliary/tile_pool.hpp"
 
 
 using namespace std;
@@ -22,13 +29,14 @@ cv::Mat * rgb2gray(Mat *rgb_img, int nw) {
     cv::Mat *gray_img = &(rgb_img[0]);  // points to channel 0 of rgb_img
     int rows = gray_img->rows;
     int cols = gray_img->cols;
-    #pragma omp parallel for num_threads(nw)
-    for (int i = 0; i < rows; i++)
-        for (int j = 0; j < cols; j++)
-            // note: gray_image->at(i,j) points to the same pixel as rgb_img->at(i,j)[0]
-            gray_img->at<uchar>(i, j) = (rgb_img->at<Vec3b>(i, j)[0] + 
-                                         rgb_img->at<Vec3b>(i, j)[1] +
-                                         rgb_img->at<Vec3b>(i, j)[2]) / 3;
+    tile_pool::get().for_row_tiles(rows, 3 * cols, nw, [&](int first_row, int last_row) {
+        for (int i = first_row; i < last_row; i++)
+            for (int j = 0; j < cols; j++)
+                // note: gray_image->at(i,j) points to the same pixel as rgb_img->at(i,j)[0]
+                gray_img->at<uchar>(i, j) = (rgb_img->at<Vec3b>(i, j)[0] + 
+                                             rgb_img->at<Vec3b>(i, j)[1] +
+                                             rgb_img->at<Vec3b>(i, j)[2]) / 3;
+    });
     return gray_img;
 }
 
@@ -86,22 +94,23 @@ void smooth(Mat *gray_img, Mat *smooth_img, int nw) {
     uint8_t n_neighbors;    // number of neighboring pixels (including central one)
 
     // for each pixel NOT on the border of the image
-    #pragma omp parallel for num_threads(nw)
-    for (int i = 1; i < rows-1; i++) {
-        for (int j = 1; j < cols-1; j++) {
-            smooth_img->at<uchar>(i, j) = (
-                gray_img->at<uchar>(i-1, j-1) +
-                gray_img->at<uchar>(i-1, j) +
-                gray_img->at<uchar>(i-1, j+1) +
-                gray_img->at<uchar>(i, j-1) +
-                gray_img->at<uchar>(i, j) +
-                gray_img->at<uchar>(i, j+1) +
-                gray_img->at<uchar>(i+1, j-1) +
-                gray_img->at<uchar>(i+1, j) +
-                gray_img->at<uchar>(i+1, j+1)
-            ) / 9;
+    tile_pool::get().for_row_tiles(rows - 2, 2 * cols, nw, [&](int first_row, int last_row) {
+        for (int i = first_row + 1; i < last_row + 1; i++) {
+            for (int j = 1; j < cols-1; j++) {
+                smooth_img->at<uchar>(i, j) = (
+                    gray_img->at<uchar>(i-1, j-1) +
+                    gray_img->at<uchar>(i-1, j) +
+                    gray_img->at<uchar>(i-1, j+1) +
+                    gray_img->at<uchar>(i, j-1) +
+                    gray_img->at<uchar>(i, j) +
+                    gray_img->at<uchar>(i, j+1) +
+                    gray_img->at<uchar>(i+1, j-1) +
+                    gray_img->at<uchar>(i+1, j) +
+                    gray_img->at<uchar>(i+1, j+1)
+                ) / 9;
+            }
         }
-    }
+    });
 
     vector<int> row_borders_idxs = {0, rows - 1};
     vector<int> col_borders_idxs = {0, cols - 1};
@@ -147,6 +156,72 @@ void smooth(Mat *gray_img, Mat *smooth_img, int nw) {
 }
 
 
+/**
+ * @brief smooths a grayscale image averaging each pixel with the ones in a
+ * (2 * radius + 1) x (2 * radius + 1) neighborhood.
+ * 
+ * Separable running sums: for each row, the sums of the columns of the
+ * window are updated adding the row entering the window and subtracting the
+ * one leaving it, then a running sum along the row gives the sum of the
+ * window, so the cost per pixel doesn't depend on the radius.
+ * On the borders only the valid neighbors are averaged (like smooth).
+ * The rows are split in 'nw' contiguous chunks, each with its own sums.
+ * 
+ * @param gray_img: grayscale image to be smoothed
+ * @param smooth_img: Mat where to put the result
+ * @param radius: radius of the neighborhood (1 is the 3x3 one of smooth)
+ * @param nw number of threads to use (if 1, sequential version)
+ */
+void smooth_radius(Mat *gray_img, Mat *smooth_img, int radius, int nw) {
+    int rows = gray_img->rows;
+    int cols = gray_img->cols;
+
+    int n_chunks = max(nw, 1);
+    tile_pool::get().parallel_for(n_chunks, nw, [&](int chunk) {
+        int first_row = (long)rows * chunk / n_chunks;
+        int last_row = (long)rows * (chunk + 1) / n_chunks;
+
+        // sums of the columns over the rows of the window of the current row
+        vector<int> col_sums(cols, 0);
+        if (first_row < last_row)
+            for (int r = max(first_row - radius - 1, 0); r < min(first_row + radius, rows); r++) {
+                const uchar *row = gray_img->ptr<uchar>(r);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] += row[j];
+            }
+
+        for (int i = first_row; i < last_row; i++) {
+            // slide the window down: add row i+radius, remove row i-radius-1
+            if (i + radius < rows) {
+                const uchar *in = gray_img->ptr<uchar>(i + radius);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] += in[j];
+            }
+            if (i - radius - 1 >= 0) {
+                const uchar *out = gray_img->ptr<uchar>(i - radius - 1);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] -= out[j];
+            }
+            int n_rows = min(i + radius, rows - 1) - max(i - radius, 0) + 1;
+
+            // running sum of the column sums along the row
+            uchar *smoothed = smooth_img->ptr<uchar>(i);
+            int sum = 0;
+            for (int j = 0; j < min(radius, cols); j++)
+                sum += col_sums[j];
+            for (int j = 0; j < cols; j++) {
+                if (j + radius < cols)
+                    sum += col_sums[j + radius];
+                if (j - radius - 1 >= 0)
+                    sum -= col_sums[j - radius - 1];
+                int n_cols = min(j + radius, cols - 1) - max(j - radius, 0) + 1;
+                smoothed[j] = sum / (n_rows * n_cols);
+            }
+        }
+    });
+}
+
+
 /**
  * @brief checks whether 2 grayscale images differ for more than a certain
  * percentage of the pixels.
@@ -165,12 +240,15 @@ bool motion_detect(Mat *img1, Mat *img2, unsigned int min_detect_diff,
 
     // count number of pixels that differ from the corresponding one in the other image
     // for more than a certain amount (min_detect_diff) (because of smoothing)
-    unsigned n_different_pixels = 0;
-    #pragma omp parallel for reduction(+:n_different_pixels) num_threads(nw)
-    for (int i = 0; i < rows; i++)
-        for (int j = 0; j < cols; j++)
-            if (abs(img1->at<uchar>(i, j) - img2->at<uchar>(i, j)) > min_detect_diff)
-                n_different_pixels++;
+    std::atomic<unsigned> n_different_pixels(0);
+    tile_pool::get().for_row_tiles(rows, 2 * cols, nw, [&](int first_row, int last_row) {
+        unsigned n = 0;
+        for (int i = first_row; i < last_row; i++)
+            for (int j = 0; j < cols; j++)
+                if (abs(img1->at<uchar>(i, j) - img2->at<uchar>(i, j)) > min_detect_diff)
+                    n++;
+        n_different_pixels += n;
+    });
     
     
     // if more than a certain percentage of the pixels are different, then there is motion
@@ -186,10 +264,241 @@ bool motion_detect(Mat *img1, Mat *img2, unsigned int min_detect_diff,
 }
 
 
+/**
+ * @brief adds to 'cells' the number of different pixels of a row in each
+ * cell: the pixels of a cell are counted in a register, in a loop like the
+ * one of motion_detect, and the count is added to the cell at the end.
+ * With CELL != 0 the side of the cells is fixed at compile time, so the
+ * loop over a whole cell has a constant number of iterations.
+ */
+template<int CELL>
+static void count_row_cells(const uchar *a, const uchar *b, int cols, int cell,
+                            unsigned min_detect_diff, unsigned *cells) {
+    if (CELL != 0)
+        cell = CELL;
+    int x0 = 0;
+    for (; x0 + cell <= cols; x0 += cell) {
+        unsigned n = 0;
+        for (int j = x0; j < x0 + cell; j++)
+            n += unsigned(abs(a[j] - b[j])) > min_detect_diff;
+        *cells++ += n;
+    }
+    // last cell of the row, narrower; none if the cells cover the row exactly
+    if (x0 < cols) {
+        unsigned n = 0;
+        for (int j = x0; j < cols; j++)
+            n += unsigned(abs(a[j] - b[j])) > min_detect_diff;
+        *cells += n;
+    }
+}
+
+
+/**
+ * @brief same result as motion_detect, and where the different pixels are:
+ * their number in each cell of 'map' and, if asked, the rectangle that
+ * contains them, counted in the same pass.
+ * 
+ * The rows of cells are the tasks handed out to the workers, so each task
+ * owns a row of the grid and fills it without synchronization; the totals
+ * and the rectangles of the rows of cells are added up at the end. Each
+ * row of pixels is counted a cell at a time (see count_row_cells), so the
+ * loop over the pixels is the one of motion_detect and the counts of the
+ * cells are only touched once per cell per row. The rectangle only costs a
+ * scan of the rows of cells with motion, up to their first and last
+ * different pixel.
+ * 
+ * @param img1: grayscale image
+ * @param img2: another grayscale image
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @param map where to put the counts of the cells (its grid already set, see motion_map::reset)
+ * @param with_box whether to compute the rectangle of the different pixels
+ * @return true if the images differ for more than 'perc'% of their pixels, false otherwise
+ */
+bool motion_detect_map(Mat *img1, Mat *img2, unsigned int min_detect_diff,
+                       float perc, int nw, motion_map &map, bool with_box) {
+    int rows = img1->rows;
+    int cols = img1->cols;
+    int cell = map.cell;
+
+    // rectangle of the different pixels of each row of cells
+    vector<motion_box> row_boxes(with_box ? map.cells_y : 0);
+    std::atomic<unsigned> n_different_pixels(0);
+    auto count_row = cell == 32 ? count_row_cells<32> :
+                     cell == 64 ? count_row_cells<64> : count_row_cells<0>;
+    tile_pool::get().parallel_for(map.cells_y, nw, [&](int cy) {
+        unsigned *cells = map.counts.data() + size_t(cy) * map.cells_x;
+        int first_row = cy * cell, last_row = min(first_row + cell, rows);
+        fill(cells, cells + map.cells_x, 0u);
+        for (int i = first_row; i < last_row; i++)
+            count_row(img1->ptr<uchar>(i), img2->ptr<uchar>(i), cols, cell,
+                      min_detect_diff, cells);
+
+        unsigned n = 0;
+        for (int cx = 0; cx < map.cells_x; cx++)
+            n += cells[cx];
+        n_different_pixels += n;
+        if (!with_box || n == 0)
+            return;
+
+        // the columns are looked for in the first and in the last cell with
+        // different pixels, the rows from the top and from the bottom
+        auto differs = [&](int i, int j) {
+            return unsigned(abs(img1->at<uchar>(i, j) - img2->at<uchar>(i, j))) > min_detect_diff;
+        };
+        auto col_differs = [&](int j) {
+            for (int i = first_row; i < last_row; i++)
+                if (differs(i, j))
+                    return true;
+            return false;
+        };
+        auto row_differs = [&](int i) {
+            const uchar *a = img1->ptr<uchar>(i);
+            const uchar *b = img2->ptr<uchar>(i);
+            for (int j = 0; j < cols; j++)
+                if (unsigned(abs(a[j] - b[j])) > min_detect_diff)
+                    return true;
+            return false;
+        };
+        int first_cell = 0, last_cell = map.cells_x - 1;
+        while (cells[first_cell] == 0)
+            first_cell++;
+        while (cells[last_cell] == 0)
+            last_cell--;
+        motion_box box{first_cell * cell, first_row, min((last_cell + 1) * cell, cols), last_row};
+        while (!col_differs(box.x0))
+            box.x0++;
+        while (!col_differs(box.x1 - 1))
+            box.x1--;
+        while (!row_differs(box.y0))
+            box.y0++;
+        while (!row_differs(box.y1 - 1))
+            box.y1--;
+        row_boxes[cy] = box;
+    });
+    for (auto &box : row_boxes)
+        map.box.merge(box);
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > perc;
+}
+
+
+/**
+ * @brief same result as motion_detect, but the scan of the images stops as
+ * soon as the result is known (see early_exit_motion_detect).
+ * 
+ * @param img1: grayscale image
+ * @param img2: another grayscale image
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return true if the images differ for more than 'perc'% of their pixels, false otherwise
+ */
+bool motion_detect_early_exit(Mat *img1, Mat *img2, unsigned int min_detect_diff,
+                              float perc, int nw) {
+    int cols = img1->cols;
+    return early_exit_motion_detect(img1->rows, cols, perc, nw, [&](int i) {
+        const uchar *a = img1->ptr<uchar>(i);
+        const uchar *b = img2->ptr<uchar>(i);
+        unsigned n = 0;
+        for (int j = 0; j < cols; j++)
+            if (abs(a[j] - b[j]) > min_detect_diff)
+                n++;
+        return n;
+    });
+}
+
+
+/**
+ * @brief fused version of rgb2gray + smooth + motion_detect.
+ * 
+ * Streams the RGB frame row by row keeping only a ring of 3 grayscale rows:
+ * as soon as the row below is available, the central row is smoothed and
+ * compared with the background, so no full intermediate frame is ever
+ * materialized. The rows are split in 'nw' contiguous chunks, each with its
+ * own ring (the rows at the edges of a chunk are converted twice).
+ * The frame is not modified.
+ * 
+ * @param background: smoothed grayscale background
+ * @param rgb_img: cv::Mat with 3 channels (R-G-B) to be compared with the background
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return the same result of motion_detect on the grayscale smoothed frame
+ */
+bool fused_motion_detect(Mat *background, Mat *rgb_img,
+                         unsigned int min_detect_diff, float perc, int nw) {
+    int rows = rgb_img->rows;
+    int cols = rgb_img->cols;
+
+    std::atomic<unsigned> n_different_pixels(0);
+    int n_chunks = max(nw, 1);
+    tile_pool::get().parallel_for(n_chunks, nw, [&](int chunk) {
+        int first_row = (long)rows * chunk / n_chunks;
+        unsigned n = 0;
+        int last_row = (long)rows * (chunk + 1) / n_chunks;
+
+        // ring of 3 grayscale rows: row r is stored in slot r % 3
+        vector<uchar> ring(3 * cols);
+        auto gray = [&](int r) { return ring.data() + (r % 3) * cols; };
+        int next_gray = first_row > 0 ? first_row - 1 : 0;
+
+        for (int i = first_row; i < last_row; i++) {
+            // convert the rows needed to smooth row i that aren't in the ring yet
+            for (; next_gray <= i + 1 && next_gray < rows; next_gray++)
+                rgb2gray_row(rgb_img->ptr<uchar>(next_gray), gray(next_gray), cols);
+
+            const uchar *up = i > 0 ? gray(i - 1) : nullptr;
+            const uchar *mid = gray(i);
+            const uchar *down = i < rows - 1 ? gray(i + 1) : nullptr;
+            const uchar *bg = background->ptr<uchar>(i);
+
+            // smooth each pixel of the row and compare it with the background
+            for (int j = 0; j < cols; j++) {
+                uchar smoothed;
+                if (up == nullptr || down == nullptr || j == 0 || j == cols - 1)
+                    smoothed = border_smooth_pixel(up, mid, down, j, cols);
+                else
+                    smoothed = (up[j-1] + up[j] + up[j+1] +
+                                mid[j-1] + mid[j] + mid[j+1] +
+                                down[j-1] + down[j] + down[j+1]) / 9;
+                if (abs(bg[j] - smoothed) > min_detect_diff)
+                    n++;
+            }
+        }
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > perc;
+}
+
+
 void print_usage_parallel_prog(const std::string prog_name) {
     cout << "Usage: " << prog_name << " <video_path> <number of threads> "
          << "[<n workers rgb2gray>] [<n workers smoothing] "
          << "[<n workers motion_detect>]" << endl
          << "Arguments in square brackets are optional." << endl
          << "Default values are 1 for each argument." << endl;
+    print_pipeline_options();
+    cout << "  --queue-capacity=<n>\tmax frames waiting in the queue "
+         << "(native threads only, default 4 * number of threads)" << endl
+         << "  --scheduler=queue|steal\tshared queue or work stealing with one "
+         << "deque per thread (native threads only, default queue)" << endl
+         << "  --pool-size=<n>\tmax tasks in flight (FastFlow, default 4 * number of "
+         << "threads) or batches of frames in the pool (native threads, default number "
+         << "of threads + segments)" << endl
+         << "  --batch=<n>|auto\tframes per task (default 1); auto grows it "
+         << "while the queue overhead is significant" << endl
+         << "  --max-batch=<n>\tmax frames per task with --batch=auto (default 16)" << endl
+         << "  --huge-pages\tback the frame buffers with transparent huge pages" << endl
+         << "  --segments=<n>\tdecode the video in n segments in parallel, each with "
+         << "its own reader (default 1)" << endl
+         << "  --gop=<n>\tGOP length of the video, to start the segments on keyframes" << endl
+         << "  --autotune[=<n>]\tchoose the number of threads and of workers per stage "
+         << "measuring the first n frames (default 200), or use the saved profile" << endl
+         << "  --profiles=<path>\tfile of the saved profiles "
+         << "(default autotune_profiles.txt)" << endl;
 }
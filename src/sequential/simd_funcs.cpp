@@ -0,0 +1,643 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+#include "opencv2/opencv.hpp"
+
+#include "sequential/simd_funcs.hpp"
+#include "sequential/row_kernels.hpp"
+#include "sequential/early_exit.hpp"
+#include "sequential/roi_mask.hpp"
+#include "auxiliary/tile_pool.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+/*
+ * All the kernels work on single rows and are selected at runtime through
+ * a table of function pointers. Every vectorized row kernel processes as
+ * many pixels as possible with vectors and leaves the remaining ones to the
+ * scalar kernel.
+ *
+ * Divisions are replaced by multiply-shift with constants that are exact
+ * in the range of the dividends:
+ *  x / 3 == ((x * 0xAAAB) >> 16) >> 1   for x <= 765  (sum of 3 channels)
+ *  x / 9 == (x * 7282) >> 16            for x <= 2295 (sum of 9 pixels)
+ */
+
+// ---------------------------------------------------------------- scalar
+
+// smooths the pixels 1 .. cols-2 of a row not on the border of the image
+static void smooth_row_scalar(const uchar *up, const uchar *mid,
+                              const uchar *down, uchar *out, int cols,
+                              int from = 1) {
+    for (int j = from; j < cols - 1; j++)
+        out[j] = (up[j-1] + up[j] + up[j+1] +
+                  mid[j-1] + mid[j] + mid[j+1] +
+                  down[j-1] + down[j] + down[j+1]) / 9;
+}
+
+static void gray_row_scalar(const uchar *rgb, uchar *gray, int cols) {
+    rgb2gray_row(rgb, gray, cols);
+}
+
+// number of pixels of the 2 rows whose absolute difference is > min_diff
+static unsigned count_diff_row_scalar(const uchar *a, const uchar *b,
+                                      int cols, unsigned min_diff) {
+    unsigned n = 0;
+    for (int j = 0; j < cols; j++)
+        if (abs(a[j] - b[j]) > min_diff)
+            n++;
+    return n;
+}
+
+#ifdef SIMD_X86
+// ------------------------------------------------------------------ SSE4
+
+/*
+ * pshufb masks to deinterleave 16 BGR pixels (48 bytes in 3 registers):
+ * masks[reg][channel][k] is the byte of register 'reg' holding 'channel'
+ * of pixel k, or -128 (i.e. zero) if that byte is in another register.
+ */
+struct deinterleave_masks {
+    alignas(16) int8_t m[3][3][16];
+
+    deinterleave_masks() {
+        for (int reg = 0; reg < 3; reg++)
+            for (int ch = 0; ch < 3; ch++)
+                for (int k = 0; k < 16; k++) {
+                    int byte = 3 * k + ch - 16 * reg;
+                    m[reg][ch][k] = byte >= 0 && byte < 16 ? byte : -128;
+                }
+    }
+};
+static const deinterleave_masks bgr_masks;
+
+// sum of the 3 channels of 16 BGR pixels, as 2 vectors of 8 uint16
+__attribute__((target("sse4.1")))
+static inline void sum_bgr_16(const uchar *rgb, __m128i &lo, __m128i &hi) {
+    __m128i reg[3];
+    for (int r = 0; r < 3; r++)
+        reg[r] = _mm_loadu_si128((const __m128i *)(rgb + 16 * r));
+
+    const __m128i zero = _mm_setzero_si128();
+    lo = hi = zero;
+    for (int ch = 0; ch < 3; ch++) {
+        __m128i c = zero;
+        for (int r = 0; r < 3; r++)
+            c = _mm_or_si128(c, _mm_shuffle_epi8(reg[r],
+                    _mm_load_si128((const __m128i *)bgr_masks.m[r][ch])));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(c, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(c, zero));
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void gray_row_sse41(const uchar *rgb, uchar *gray, int cols) {
+    const __m128i div3 = _mm_set1_epi16((short)0xAAAB);
+    int j = 0;
+    for (; j + 16 <= cols; j += 16) {
+        __m128i lo, hi;
+        sum_bgr_16(rgb + 3 * j, lo, hi);
+        lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div3), 1);
+        hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div3), 1);
+        _mm_storeu_si128((__m128i *)(gray + j), _mm_packus_epi16(lo, hi));
+    }
+    rgb2gray_row(rgb + 3 * j, gray + j, cols - j);
+}
+
+// sum of 16 consecutive pixels of 3 rows, at columns j-1, j and j+1
+__attribute__((target("sse4.1")))
+static inline void sum_3x3_16(const uchar *up, const uchar *mid,
+                              const uchar *down, int j,
+                              __m128i &lo, __m128i &hi) {
+    const __m128i zero = _mm_setzero_si128();
+    lo = hi = zero;
+    for (const uchar *row : {up, mid, down})
+        for (int c = -1; c <= 1; c++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(row + j + c));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+}
+
+__attribute__((target("sse4.1")))
+static void smooth_row_sse41(const uchar *up, const uchar *mid,
+                             const uchar *down, uchar *out, int cols) {
+    const __m128i div9 = _mm_set1_epi16(7282);
+    int j = 1;
+    for (; j + 17 <= cols; j += 16) {
+        __m128i lo, hi;
+        sum_3x3_16(up, mid, down, j, lo, hi);
+        lo = _mm_mulhi_epu16(lo, div9);
+        hi = _mm_mulhi_epu16(hi, div9);
+        _mm_storeu_si128((__m128i *)(out + j), _mm_packus_epi16(lo, hi));
+    }
+    smooth_row_scalar(up, mid, down, out, cols, j);
+}
+
+__attribute__((target("sse4.1,popcnt")))
+static unsigned count_diff_row_sse41(const uchar *a, const uchar *b,
+                                     int cols, unsigned min_diff) {
+    const __m128i thr = _mm_set1_epi8((char)min_diff);
+    const __m128i zero = _mm_setzero_si128();
+    unsigned n = 0;
+    int j = 0;
+    for (; j + 16 <= cols; j += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + j));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        // diff > thr <=> saturated diff - thr != 0
+        __m128i not_greater = _mm_cmpeq_epi8(_mm_subs_epu8(diff, thr), zero);
+        n += 16 - __builtin_popcount(_mm_movemask_epi8(not_greater));
+    }
+    return n + count_diff_row_scalar(a + j, b + j, cols - j, min_diff);
+}
+
+// ------------------------------------------------------------------ AVX2
+
+// packs 2 vectors of 16 uint16 into 32 uint8, in order
+__attribute__((target("avx2")))
+static inline __m256i pack_u16_256(__m256i lo, __m256i hi) {
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+__attribute__((target("avx2")))
+static void gray_row_avx2(const uchar *rgb, uchar *gray, int cols) {
+    const __m256i div3 = _mm256_set1_epi16((short)0xAAAB);
+    int j = 0;
+    for (; j + 32 <= cols; j += 32) {
+        __m128i lo0, hi0, lo1, hi1;
+        sum_bgr_16(rgb + 3 * j, lo0, hi0);
+        sum_bgr_16(rgb + 3 * (j + 16), lo1, hi1);
+        __m256i s0 = _mm256_set_m128i(hi0, lo0);
+        __m256i s1 = _mm256_set_m128i(hi1, lo1);
+        s0 = _mm256_srli_epi16(_mm256_mulhi_epu16(s0, div3), 1);
+        s1 = _mm256_srli_epi16(_mm256_mulhi_epu16(s1, div3), 1);
+        _mm256_storeu_si256((__m256i *)(gray + j), pack_u16_256(s0, s1));
+    }
+    gray_row_sse41(rgb + 3 * j, gray + j, cols - j);
+}
+
+__attribute__((target("avx2")))
+static void smooth_row_avx2(const uchar *up, const uchar *mid,
+                            const uchar *down, uchar *out, int cols) {
+    const __m256i div9 = _mm256_set1_epi16(7282);
+    int j = 1;
+    for (; j + 33 <= cols; j += 32) {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for (const uchar *row : {up, mid, down})
+            for (int c = -1; c <= 1; c++) {
+                const uchar *p = row + j + c;
+                lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((const __m128i *)p)));
+                hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((const __m128i *)(p + 16))));
+            }
+        lo = _mm256_mulhi_epu16(lo, div9);
+        hi = _mm256_mulhi_epu16(hi, div9);
+        _mm256_storeu_si256((__m256i *)(out + j), pack_u16_256(lo, hi));
+    }
+    smooth_row_scalar(up, mid, down, out, cols, j);
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned count_diff_row_avx2(const uchar *a, const uchar *b,
+                                    int cols, unsigned min_diff) {
+    const __m256i thr = _mm256_set1_epi8((char)min_diff);
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned n = 0;
+    int j = 0;
+    for (; j + 32 <= cols; j += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + j));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb),
+                                       _mm256_subs_epu8(vb, va));
+        __m256i not_greater = _mm256_cmpeq_epi8(_mm256_subs_epu8(diff, thr), zero);
+        n += 32 - __builtin_popcount((unsigned)_mm256_movemask_epi8(not_greater));
+    }
+    return n + count_diff_row_sse41(a + j, b + j, cols - j, min_diff);
+}
+
+// --------------------------------------------------------------- AVX-512
+
+__attribute__((target("avx512f,avx512bw")))
+static void gray_row_avx512(const uchar *rgb, uchar *gray, int cols) {
+    const __m512i div3 = _mm512_set1_epi16((short)0xAAAB);
+    int j = 0;
+    for (; j + 32 <= cols; j += 32) {
+        __m128i lo0, hi0, lo1, hi1;
+        sum_bgr_16(rgb + 3 * j, lo0, hi0);
+        sum_bgr_16(rgb + 3 * (j + 16), lo1, hi1);
+        __m512i s = _mm512_inserti64x4(_mm512_castsi256_si512(
+            _mm256_set_m128i(hi0, lo0)), _mm256_set_m128i(hi1, lo1), 1);
+        s = _mm512_srli_epi16(_mm512_mulhi_epu16(s, div3), 1);
+        _mm256_storeu_si256((__m256i *)(gray + j), _mm512_cvtepi16_epi8(s));
+    }
+    gray_row_sse41(rgb + 3 * j, gray + j, cols - j);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void smooth_row_avx512(const uchar *up, const uchar *mid,
+                              const uchar *down, uchar *out, int cols) {
+    const __m512i div9 = _mm512_set1_epi16(7282);
+    int j = 1;
+    for (; j + 33 <= cols; j += 32) {
+        __m512i s = _mm512_setzero_si512();
+        for (const uchar *row : {up, mid, down})
+            for (int c = -1; c <= 1; c++)
+                s = _mm512_add_epi16(s, _mm512_cvtepu8_epi16(
+                    _mm256_loadu_si256((const __m256i *)(row + j + c))));
+        s = _mm512_mulhi_epu16(s, div9);
+        _mm256_storeu_si256((__m256i *)(out + j), _mm512_cvtepi16_epi8(s));
+    }
+    smooth_row_scalar(up, mid, down, out, cols, j);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static unsigned count_diff_row_avx512(const uchar *a, const uchar *b,
+                                      int cols, unsigned min_diff) {
+    const __m512i thr = _mm512_set1_epi8((char)min_diff);
+    unsigned n = 0;
+    int j = 0;
+    for (; j + 64 <= cols; j += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + j));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + j));
+        __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb),
+                                       _mm512_subs_epu8(vb, va));
+        n += __builtin_popcountll(_mm512_cmpgt_epu8_mask(diff, thr));
+    }
+    return n + count_diff_row_sse41(a + j, b + j, cols - j, min_diff);
+}
+
+// ---------------------------------------------------- running background
+
+// the generic detect_update_row, vectorized by the compiler for each ISA
+__attribute__((target("sse4.1")))
+static unsigned detect_update_row_sse41(const uint16_t *acc, const uchar *frame,
+                                        uint16_t *acc_out, int cols,
+                                        unsigned min_diff, int shift) {
+    return detect_update_row(acc, frame, acc_out, cols, min_diff, shift);
+}
+
+__attribute__((target("avx2")))
+static unsigned detect_update_row_avx2(const uint16_t *acc, const uchar *frame,
+                                       uint16_t *acc_out, int cols,
+                                       unsigned min_diff, int shift) {
+    return detect_update_row(acc, frame, acc_out, cols, min_diff, shift);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static unsigned detect_update_row_avx512(const uint16_t *acc, const uchar *frame,
+                                         uint16_t *acc_out, int cols,
+                                         unsigned min_diff, int shift) {
+    return detect_update_row(acc, frame, acc_out, cols, min_diff, shift);
+}
+#endif  // SIMD_X86
+
+// ------------------------------------------------------------- dispatch
+
+struct row_kernels {
+    void (*gray)(const uchar *rgb, uchar *gray, int cols);
+    void (*smooth)(const uchar *up, const uchar *mid, const uchar *down,
+                   uchar *out, int cols);
+    unsigned (*count_diff)(const uchar *a, const uchar *b, int cols,
+                           unsigned min_diff);
+    unsigned (*detect_update)(const uint16_t *acc, const uchar *frame,
+                              uint16_t *acc_out, int cols, unsigned min_diff,
+                              int shift);
+};
+
+static void smooth_row_scalar_full(const uchar *up, const uchar *mid,
+                                const uchar *down, uchar *out, int cols) {
+    smooth_row_scalar(up, mid, down, out, cols);
+}
+
+static row_kernels kernels_for(simd_isa isa) {
+    switch (isa) {
+    #ifdef SIMD_X86
+    case simd_isa::avx512:
+        return {gray_row_avx512, smooth_row_avx512, count_diff_row_avx512,
+                detect_update_row_avx512};
+    case simd_isa::avx2:
+        return {gray_row_avx2, smooth_row_avx2, count_diff_row_avx2,
+                detect_update_row_avx2};
+    case simd_isa::sse41:
+        return {gray_row_sse41, smooth_row_sse41, count_diff_row_sse41,
+                detect_update_row_sse41};
+    #endif
+    default:
+        return {gray_row_scalar, smooth_row_scalar_full, count_diff_row_scalar,
+                detect_update_row};
+    }
+}
+
+simd_isa detected_simd_isa() {
+    static const simd_isa isa = []() {
+        #ifdef SIMD_X86
+        __builtin_cpu_init();
+        // every vectorized kernel counts the different pixels with popcnt
+        if (!__builtin_cpu_supports("popcnt"))
+            return simd_isa::scalar;
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            return simd_isa::avx512;
+        if (__builtin_cpu_supports("avx2"))
+            return simd_isa::avx2;
+        if (__builtin_cpu_supports("sse4.1"))
+            return simd_isa::sse41;
+        #endif
+        return simd_isa::scalar;
+    }();
+    return isa;
+}
+
+// instruction set (and kernels) in use, chosen at startup
+static simd_isa current_isa = detected_simd_isa();
+static row_kernels kernels = kernels_for(current_isa);
+
+simd_isa active_simd_isa() { return current_isa; }
+
+const char * simd_isa_name(simd_isa isa) {
+    switch (isa) {
+    case simd_isa::sse41: return "sse4";
+    case simd_isa::avx2: return "avx2";
+    case simd_isa::avx512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+/**
+ * @brief limits the instruction set used by the kernels (e.g. to compare
+ * them). The instruction set is never raised above the detected one.
+ *
+ * @param name one of "scalar", "sse4", "avx2", "avx512"
+ * @return false if the name is not valid
+ */
+bool limit_simd_isa(const std::string &name) {
+    for (simd_isa isa : {simd_isa::scalar, simd_isa::sse41, simd_isa::avx2,
+                         simd_isa::avx512}) {
+        if (name == simd_isa_name(isa)) {
+            current_isa = min(isa, detected_simd_isa());
+            kernels = kernels_for(current_isa);
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------------------------------------------- frames
+
+/**
+ * @brief vectorized rgb2gray (the grayscale image is put in place of the
+ * RGB one, like rgb2gray does).
+ *
+ * @param rgb_img cv::Mat with 3 channels (R-G-B)
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return pointer to a grayscale version of 'rgb_img'
+ */
+cv::Mat * rgb2gray_simd(Mat *rgb_img, int nw) {
+    int rows = rgb_img->rows;
+    int cols = rgb_img->cols;
+    // in place: the store of a block never reaches bytes not yet loaded
+    tile_pool::get().for_row_tiles(rows, 3 * cols, nw, [&](int first_row, int last_row) {
+        for (int i = first_row; i < last_row; i++)
+            kernels.gray(rgb_img->ptr<uchar>(i), rgb_img->ptr<uchar>(i), cols);
+    });
+    return rgb_img;
+}
+
+
+/**
+ * @brief vectorized smooth: the inner pixels of each row are computed with
+ * vectors, the pixels on the border with the scalar code.
+ *
+ * @param gray_img: grayscale image to be smoothed
+ * @param smooth_img: Mat where to put the result
+ * @param nw number of threads to use (if 1, sequential version)
+ */
+void smooth_simd(Mat *gray_img, Mat *smooth_img, int nw) {
+    int rows = gray_img->rows;
+    int cols = gray_img->cols;
+    tile_pool::get().for_row_tiles(rows, 2 * cols, nw, [&](int first_row, int last_row) {
+        for (int i = first_row; i < last_row; i++) {
+            const uchar *up = i > 0 ? gray_img->ptr<uchar>(i - 1) : nullptr;
+            const uchar *mid = gray_img->ptr<uchar>(i);
+            const uchar *down = i < rows - 1 ? gray_img->ptr<uchar>(i + 1) : nullptr;
+            uchar *out = smooth_img->ptr<uchar>(i);
+
+            if (up == nullptr || down == nullptr) {
+                for (int j = 0; j < cols; j++)
+                    out[j] = border_smooth_pixel(up, mid, down, j, cols);
+                continue;
+            }
+            out[0] = border_smooth_pixel(up, mid, down, 0, cols);
+            kernels.smooth(up, mid, down, out, cols);
+            out[cols - 1] = border_smooth_pixel(up, mid, down, cols - 1, cols);
+        }
+    });
+}
+
+
+// number of pixels whose abs difference is > min_detect_diff (none if >= 255)
+static inline unsigned count_diff_row(const uchar *a, const uchar *b, int cols,
+                                      unsigned min_detect_diff) {
+    return min_detect_diff >= 255 ? 0 : kernels.count_diff(a, b, cols, min_detect_diff);
+}
+
+
+/**
+ * @brief vectorized motion_detect: absolute differences with saturating
+ * subtractions, counted with a vector compare and popcount.
+ *
+ * @param img1: grayscale image
+ * @param img2: another grayscale image
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return true if the images differ for more than 'perc'% of their pixels, false otherwise
+ */
+bool motion_detect_simd(Mat *img1, Mat *img2, unsigned int min_detect_diff,
+                        float perc, int nw) {
+    int rows = img1->rows;
+    int cols = img1->cols;
+    std::atomic<unsigned> n_different_pixels(0);
+    tile_pool::get().for_row_tiles(rows, 2 * cols, nw, [&](int first_row, int last_row) {
+        unsigned n = 0;
+        for (int i = first_row; i < last_row; i++)
+            n += count_diff_row(img1->ptr<uchar>(i), img2->ptr<uchar>(i),
+                                cols, min_detect_diff);
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > perc;
+}
+
+
+/**
+ * @brief vectorized motion_detect_early_exit.
+ *
+ * @param img1: grayscale image
+ * @param img2: another grayscale image
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return true if the images differ for more than 'perc'% of their pixels, false otherwise
+ */
+bool motion_detect_early_exit_simd(Mat *img1, Mat *img2, unsigned int min_detect_diff,
+                                   float perc, int nw) {
+    int cols = img1->cols;
+    return early_exit_motion_detect(img1->rows, cols, perc, nw, [&](int i) {
+        return count_diff_row(img1->ptr<uchar>(i), img2->ptr<uchar>(i),
+                              cols, min_detect_diff);
+    });
+}
+
+
+/**
+ * @brief vectorized fused_motion_detect: same 3-row ring of grayscale rows,
+ * but each smoothed row is put in a row buffer and compared with the
+ * background with the vector kernels.
+ *
+ * @param background: smoothed grayscale background
+ * @param rgb_img: cv::Mat with 3 channels (R-G-B) to be compared with the background
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels to consider the images as differing from each other
+ * @param nw number of threads to use (if 1, sequential version)
+ * @return the same result of motion_detect on the grayscale smoothed frame
+ */
+bool fused_motion_detect_simd(Mat *background, Mat *rgb_img,
+                              unsigned int min_detect_diff, float perc, int nw) {
+    int rows = rgb_img->rows;
+    int cols = rgb_img->cols;
+
+    std::atomic<unsigned> n_different_pixels(0);
+    int n_chunks = max(nw, 1);
+    tile_pool::get().parallel_for(n_chunks, nw, [&](int chunk) {
+        int first_row = (long)rows * chunk / n_chunks;
+        unsigned n = 0;
+        int last_row = (long)rows * (chunk + 1) / n_chunks;
+
+        // ring of 3 grayscale rows (row r in slot r % 3) and smoothed row
+        vector<uchar> ring(3 * cols), smoothed(cols);
+        auto gray = [&](int r) { return ring.data() + (r % 3) * cols; };
+        int next_gray = first_row > 0 ? first_row - 1 : 0;
+
+        for (int i = first_row; i < last_row; i++) {
+            for (; next_gray <= i + 1 && next_gray < rows; next_gray++)
+                kernels.gray(rgb_img->ptr<uchar>(next_gray), gray(next_gray), cols);
+
+            const uchar *up = i > 0 ? gray(i - 1) : nullptr;
+            const uchar *mid = gray(i);
+            const uchar *down = i < rows - 1 ? gray(i + 1) : nullptr;
+            if (up == nullptr || down == nullptr) {
+                for (int j = 0; j < cols; j++)
+                    smoothed[j] = border_smooth_pixel(up, mid, down, j, cols);
+            }
+            else {
+                smoothed[0] = border_smooth_pixel(up, mid, down, 0, cols);
+                kernels.smooth(up, mid, down, smoothed.data(), cols);
+                smoothed[cols - 1] = border_smooth_pixel(up, mid, down, cols - 1, cols);
+            }
+            n += count_diff_row(background->ptr<uchar>(i), smoothed.data(), cols,
+                                min_detect_diff);
+        }
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > perc;
+}
+
+
+/**
+ * @brief vectorized detect_update_row (see row_kernels.hpp), with the
+ * instruction set in use.
+ */
+unsigned detect_update_row_simd(const uint16_t *acc, const uchar *frame,
+                                uint16_t *acc_out, int cols, unsigned min_diff,
+                                int shift) {
+    return kernels.detect_update(acc, frame, acc_out, cols, min_diff, shift);
+}
+
+
+/**
+ * @brief rgb2gray + smooth + motion_detect restricted to a region of
+ * interest, with the scalar or the vectorized row kernels applied to its
+ * spans: the cost depends on the size of the region, not of the frame.
+ *
+ * First the halo of the region is converted to grayscale in place (like
+ * rgb2gray does), then each span of the region is smoothed into a row
+ * buffer and compared with the background. Inside the region, the smoothed
+ * values are the same as smoothing the whole frame.
+ *
+ * @param background: smoothed grayscale background
+ * @param rgb_img: cv::Mat with 3 channels (R-G-B) to be compared with the background
+ * @param roi: the region of interest
+ * @param min_detect_diff: minimum absolute difference between 2 pixels to be counted as different
+ * @param perc: percentage of different pixels of the region to detect motion
+ * @param nw number of threads to use (if 1, sequential version)
+ * @param simd whether to use the vectorized kernels
+ * @return true if the frame differs for more than 'perc'% of the pixels of the region
+ */
+bool roi_motion_detect(Mat *background, Mat *rgb_img, const roi_mask &roi,
+                       unsigned int min_detect_diff, float perc, int nw, bool simd) {
+    static const row_kernels scalar_kernels = kernels_for(simd_isa::scalar);
+    const row_kernels &k = simd ? kernels : scalar_kernels;
+    int rows = rgb_img->rows;
+    int cols = rgb_img->cols;
+    size_t row_bytes = 3 * max<size_t>(roi.area() / rows, 1);
+
+    // in place, as in rgb2gray_simd (spans are in increasing order, so they
+    // never overwrite bytes of the spans after them)
+    tile_pool::get().for_row_tiles(rows, row_bytes, nw, [&](int first_row, int last_row) {
+        for (int i = first_row; i < last_row; i++) {
+            uchar *row = rgb_img->ptr<uchar>(i);
+            for (const pixel_span *span = roi.halo_begin(i); span != roi.halo_end(i); span++)
+                k.gray(row + 3 * span->first, row + span->first, span->last - span->first);
+        }
+    });
+
+    std::atomic<unsigned> n_different_pixels(0);
+    tile_pool::get().for_row_tiles(rows, row_bytes, nw, [&](int first_row, int last_row) {
+        vector<uchar> smoothed(cols);
+        unsigned n = 0;
+        for (int i = first_row; i < last_row; i++) {
+            const uchar *up = i > 0 ? rgb_img->ptr<uchar>(i - 1) : nullptr;
+            const uchar *mid = rgb_img->ptr<uchar>(i);
+            const uchar *down = i < rows - 1 ? rgb_img->ptr<uchar>(i + 1) : nullptr;
+            const uchar *bg = background->ptr<uchar>(i);
+
+            for (const pixel_span *span = roi.begin(i); span != roi.end(i); span++) {
+                int first = span->first, last = span->last;
+                if (up == nullptr || down == nullptr) {
+                    for (int j = first; j < last; j++)
+                        smoothed[j] = border_smooth_pixel(up, mid, down, j, cols);
+                }
+                else {
+                    // inner pixels with the row kernel, the ones on the border apart
+                    int from = max(first, 1), to = min(last, cols - 1);
+                    if (first == 0)
+                        smoothed[0] = border_smooth_pixel(up, mid, down, 0, cols);
+                    if (to > from)
+                        k.smooth(up + from - 1, mid + from - 1, down + from - 1,
+                                 smoothed.data() + from - 1, to - from + 2);
+                    if (last == cols)
+                        smoothed[cols - 1] = border_smooth_pixel(up, mid, down, cols - 1, cols);
+                }
+                if (min_detect_diff < 255)
+                    n += k.count_diff(bg + first, smoothed.data() + first, last - first,
+                                      min_detect_diff);
+            }
+        }
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(roi.area());
+    return perc_different_pixels > perc;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/specialized_funcs.hpp"
+#include "sequential/row_kernels.hpp"
+#include "auxiliary/tile_pool.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief smooth for frames COLS pixels wide.
+ *
+ * Each row is done in one go: the first and the last pixel with
+ * border_smooth_pixel, the ones in between with a loop of COLS - 2
+ * iterations and no border checks. The first and the last row of the
+ * frame are border rows as a whole.
+ */
+template<int COLS>
+static void smooth_width(Mat *gray_img, Mat *smooth_img, int nw) {
+    int rows = gray_img->rows;
+    tile_pool::get().for_row_tiles(rows, 2 * COLS, nw, [&](int first_row, int last_row) {
+        for (int i = first_row; i < last_row; i++) {
+            const uchar *up = i > 0 ? gray_img->ptr<uchar>(i - 1) : nullptr;
+            const uchar *mid = gray_img->ptr<uchar>(i);
+            const uchar *down = i < rows - 1 ? gray_img->ptr<uchar>(i + 1) : nullptr;
+            uchar *smoothed = smooth_img->ptr<uchar>(i);
+            if (up == nullptr || down == nullptr) {
+                for (int j = 0; j < COLS; j++)
+                    smoothed[j] = border_smooth_pixel(up, mid, down, j, COLS);
+                continue;
+            }
+            smoothed[0] = border_smooth_pixel(up, mid, down, 0, COLS);
+            for (int j = 1; j < COLS - 1; j++)
+                smoothed[j] = (up[j-1] + up[j] + up[j+1] +
+                               mid[j-1] + mid[j] + mid[j+1] +
+                               down[j-1] + down[j] + down[j+1]) / 9;
+            smoothed[COLS - 1] = border_smooth_pixel(up, mid, down, COLS - 1, COLS);
+        }
+    });
+}
+
+
+/**
+ * @brief smooth_radius with a radius fixed at compile time.
+ *
+ * Same running sums as smooth_radius; along a row, the pixels whose window
+ * is inside the row are done in a loop without border checks, and on the
+ * rows whose window is inside the frame the divisor is a constant.
+ */
+template<int RADIUS>
+static void smooth_radius_fixed(Mat *gray_img, Mat *smooth_img, int nw) {
+    constexpr int SIDE = 2 * RADIUS + 1;
+    int rows = gray_img->rows;
+    int cols = gray_img->cols;
+
+    int n_chunks = max(nw, 1);
+    tile_pool::get().parallel_for(n_chunks, nw, [&](int chunk) {
+        int first_row = (long)rows * chunk / n_chunks;
+        int last_row = (long)rows * (chunk + 1) / n_chunks;
+
+        vector<int> col_sums(cols, 0);
+        if (first_row < last_row)
+            for (int r = max(first_row - RADIUS - 1, 0); r < min(first_row + RADIUS, rows); r++) {
+                const uchar *row = gray_img->ptr<uchar>(r);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] += row[j];
+            }
+
+        // pixels [inner_begin, inner_end) of a row have the whole window
+        // inside the row
+        int inner_begin = min(RADIUS + 1, cols);
+        int inner_end = max(inner_begin, cols - RADIUS);
+        for (int i = first_row; i < last_row; i++) {
+            if (i + RADIUS < rows) {
+                const uchar *in = gray_img->ptr<uchar>(i + RADIUS);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] += in[j];
+            }
+            if (i - RADIUS - 1 >= 0) {
+                const uchar *out = gray_img->ptr<uchar>(i - RADIUS - 1);
+                for (int j = 0; j < cols; j++)
+                    col_sums[j] -= out[j];
+            }
+            int n_rows = min(i + RADIUS, rows - 1) - max(i - RADIUS, 0) + 1;
+
+            uchar *smoothed = smooth_img->ptr<uchar>(i);
+            const int *sums = col_sums.data();
+            int sum = 0;
+            for (int j = 0; j < min(RADIUS, cols); j++)
+                sum += sums[j];
+            auto border_pixel = [&](int j) {
+                if (j + RADIUS < cols)
+                    sum += sums[j + RADIUS];
+                if (j - RADIUS - 1 >= 0)
+                    sum -= sums[j - RADIUS - 1];
+                int n_cols = min(j + RADIUS, cols - 1) - max(j - RADIUS, 0) + 1;
+                smoothed[j] = sum / (n_rows * n_cols);
+            };
+            for (int j = 0; j < inner_begin; j++)
+                border_pixel(j);
+            if (n_rows == SIDE)
+                for (int j = inner_begin; j < inner_end; j++) {
+                    sum += sums[j + RADIUS] - sums[j - RADIUS - 1];
+                    smoothed[j] = sum / (SIDE * SIDE);
+                }
+            else
+                for (int j = inner_begin; j < inner_end; j++) {
+                    sum += sums[j + RADIUS] - sums[j - RADIUS - 1];
+                    smoothed[j] = sum / (n_rows * SIDE);
+                }
+            for (int j = inner_end; j < cols; j++)
+                border_pixel(j);
+        }
+    });
+}
+
+
+/**
+ * @brief motion_detect for frames COLS pixels wide (any width if COLS is 0)
+ * and a threshold MIN_DIFF.
+ */
+template<int COLS, unsigned MIN_DIFF>
+static bool motion_detect_fixed(Mat *img1, Mat *img2, float perc, int nw) {
+    int rows = img1->rows;
+    int cols = COLS > 0 ? COLS : img1->cols;
+
+    std::atomic<unsigned> n_different_pixels(0);
+    tile_pool::get().for_row_tiles(rows, 2 * cols, nw, [&](int first_row, int last_row) {
+        unsigned n = 0;
+        for (int i = first_row; i < last_row; i++) {
+            const uchar *a = img1->ptr<uchar>(i);
+            const uchar *b = img2->ptr<uchar>(i);
+            for (int j = 0; j < cols; j++)
+                n += unsigned(abs(a[j] - b[j])) > MIN_DIFF;
+        }
+        n_different_pixels += n;
+    });
+
+    float perc_different_pixels = float(n_different_pixels) / float(rows * cols);
+    return perc_different_pixels > perc;
+}
+
+
+// instantiations: the widths of 360p, 720p, 1080p and 2160p, the radiuses
+// up to 5 and the default threshold of the executables
+static const struct {
+    int cols;
+    smooth_kernel kernel;
+} smooth_by_width[] = {
+    {640, smooth_width<640>},
+    {1280, smooth_width<1280>},
+    {1920, smooth_width<1920>},
+    {3840, smooth_width<3840>},
+};
+
+static const struct {
+    int radius;
+    smooth_kernel kernel;
+} smooth_by_radius[] = {
+    {2, smooth_radius_fixed<2>},
+    {3, smooth_radius_fixed<3>},
+    {4, smooth_radius_fixed<4>},
+    {5, smooth_radius_fixed<5>},
+};
+
+static const struct {
+    int cols;       // 0: any width
+    unsigned min_diff;
+    detect_kernel kernel;
+} detect_by_width[] = {
+    {640, 10, motion_detect_fixed<640, 10>},
+    {1280, 10, motion_detect_fixed<1280, 10>},
+    {1920, 10, motion_detect_fixed<1920, 10>},
+    {3840, 10, motion_detect_fixed<3840, 10>},
+    {0, 10, motion_detect_fixed<0, 10>},
+};
+
+
+smooth_kernel specialized_smooth(int cols, int radius) {
+    if (radius == 1) {
+        for (auto &s : smooth_by_width)
+            if (s.cols == cols)
+                return s.kernel;
+    } else
+        for (auto &s : smooth_by_radius)
+            if (s.radius == radius)
+                return s.kernel;
+    return nullptr;
+}
+
+
+detect_kernel specialized_motion_detect(int cols, unsigned min_detect_diff) {
+    // the first match is the most specialized one
+    for (auto &d : detect_by_width)
+        if ((d.cols == cols || d.cols == 0) && d.min_diff == min_detect_diff)
+            return d.kernel;
+    return nullptr;
+}
+
+
+string specialization_name(smooth_kernel kernel) {
+    for (auto &s : smooth_by_width)
+        if (s.kernel == kernel)
+            return "width " + to_string(s.cols);
+    for (auto &s : smooth_by_radius)
+        if (s.kernel == kernel)
+            return "radius " + to_string(s.radius);
+    return "generic";
+}
+
+
+string specialization_name(detect_kernel kernel) {
+    for (auto &d : detect_by_width)
+        if (d.kernel == kernel)
+            return (d.cols > 0 ? "width " + to_string(d.cols) + ", " : "") +
+                   "min diff " + to_string(d.min_diff);
+    return "generic";
+}
+
+
+void use_specialized_kernels(pipeline_params &params, int cols) {
+    if (!params.specialize)
+        return;
+    if (params.fused || params.roi != nullptr || params.block_size > 0) {
+        cout << "The fused kernel, the region of interest and the incremental detection "
+             << "have no specialized versions, --specialize ignored" << endl;
+        return;
+    }
+
+    // the vectorized kernels (3x3 smoothing and detection) are used as
+    // they are, and so are the ones of early exit, of the running
+    // background and of the heatmap
+    if (params.radius != 1 || !params.simd)
+        params.specialized_smooth = specialized_smooth(cols, params.radius);
+    if (!params.simd && !params.early_exit && params.bg_shift == 0 && params.cell_size == 0)
+        params.specialized_detect = specialized_motion_detect(cols, params.min_diff);
+
+    cout << "Smoothing kernel: " << specialization_name(params.specialized_smooth) << endl
+         << "Motion detection kernel: " << specialization_name(params.specialized_detect)
+         << endl;
+}
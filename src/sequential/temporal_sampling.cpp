@@ -0,0 +1,145 @@
+#include <iostream>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/temporal_sampling.hpp"
+#include "sequential/mapped_video.hpp"
+#include "auxiliary/trace.hpp"
+
+
+bool seek_frame(cv::VideoCapture &cap, const std::string &path, size_t index) {
+    if (!cap.isOpened() && !cap.open(path))
+        return false;
+    if ((size_t)cap.get(cv::CAP_PROP_POS_FRAMES) == index)
+        return true;
+
+    cap.set(cv::CAP_PROP_POS_FRAMES, index);
+    if ((size_t)cap.get(cv::CAP_PROP_POS_FRAMES) == index)
+        return true;
+    if (!cap.open(path))
+        return false;
+    skip_frames(cap, index);
+    return true;
+}
+
+
+size_t skip_frames(cv::VideoCapture &cap, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        if (!cap.grab())
+            return i;
+    return n;
+}
+
+
+temporal_sampler::temporal_sampler(const std::string &path, cv::Mat *background,
+                                   const pipeline_params &params,
+                                   std::function<void(size_t, bool)> emit) :
+        path(path), background(background), params(params), emit(emit),
+        cap(make_capture(path)),
+        frame_rgb(background->rows, background->cols, CV_8UC3),
+        frame_smooth(background->rows, background->cols, CV_8UC1) {
+    refiner = std::thread(&temporal_sampler::run, this);
+}
+
+
+temporal_sampler::~temporal_sampler() {
+    if (!refiner.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        no_more_samples = true;
+    }
+    not_empty.notify_one();
+    refiner.join();
+}
+
+
+void temporal_sampler::fill(size_t index, bool motion) {
+    if (motion)
+        n_filled_motion++;
+    emit(index, motion);
+}
+
+
+bool temporal_sampler::process_next(bool &motion) {
+    *cap >> frame_rgb;
+    if (frame_rgb.empty())
+        return false;
+    motion = frame_has_motion(background, &frame_rgb, &frame_smooth, params);
+    n_refined++;
+    return true;
+}
+
+
+void temporal_sampler::sample(size_t index, bool motion) {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        samples.emplace_back(index, motion);
+    }
+    not_empty.notify_one();
+}
+
+
+void temporal_sampler::run() {
+    tracer::name_thread("sampler");
+    while (true) {
+        std::pair<size_t, bool> s;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            not_empty.wait(lk, [&]() { return !samples.empty() || no_more_samples; });
+            if (samples.empty())
+                return;
+            s = samples.front();
+            samples.pop_front();
+        }
+        refine(s.first, s.second);
+    }
+}
+
+
+void temporal_sampler::refine(size_t index, bool motion) {
+    size_t i = has_last ? last + 1 : index;
+
+    // the result flipped: look for the first frame with the new one
+    if (i < index && motion != last_motion && seek_frame(*cap, path, i)) {
+        bool m;
+        while (i < index && process_next(m)) {
+            fill(i++, m);
+            if (m == motion)
+                break;
+        }
+    }
+    for (; i < index; i++) {
+        fill(i, motion);
+        n_filled++;
+    }
+
+    emit(index, motion);
+    n_samples++;
+    has_last = true;
+    last = index;
+    last_motion = motion;
+}
+
+
+void temporal_sampler::finish() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        no_more_samples = true;
+    }
+    not_empty.notify_one();
+    refiner.join();
+
+    if (!has_last || !seek_frame(*cap, path, last + 1))
+        return;
+    bool m;
+    for (size_t i = last + 1; process_next(m); i++)
+        fill(i, m);
+    cap->release();
+}
+
+
+void temporal_sampler::report() const {
+    std::cout << "Temporal sampling: " << n_samples << " frames sampled, "
+              << n_refined << " processed around transitions or at the end, "
+              << n_filled << " not processed" << std::endl;
+}
@@ -0,0 +1,37 @@
+#include <iostream>
+#include "opencv2/opencv.hpp"
+
+#include "sequential/video_state.hpp"
+#include "sequential/specialized_funcs.hpp"
+
+
+video_state::video_state(pipeline_params &params, cv::Mat &first_frame, int max_threads) {
+    int rows = first_frame.rows, cols = first_frame.cols;
+    // with --roi, the spans of the region of interest
+    roi = roi_mask::attach(params, rows, cols);
+    // with --specialize, the kernels instantiated for the width of the frames
+    // (before the background is smoothed)
+    use_specialized_kernels(params, cols);
+    // with --pyramid, the background at low resolution (before the first
+    // frame is converted in place)
+    pyramid = pyramid_detector::attach(params, first_frame);
+    background = make_background(&first_frame, params);
+    // with --adaptive-bg, the background shared by the threads
+    running_bg = running_background::attach(params, *background, max_threads);
+    // with --incremental, the previous frames
+    incremental = incremental_detector::attach(params, rows, cols);
+    // with --heatmap, where the motion is
+    heatmap = motion_heatmap::attach(params, rows, cols);
+}
+
+
+void video_state::report() const {
+    if (pyramid)
+        pyramid->report();
+    if (incremental)
+        incremental->report();
+    if (heatmap)
+        heatmap->write();
+    if (running_bg)
+        std::cout << "Background updates: " << running_bg->updates() << std::endl;
+}